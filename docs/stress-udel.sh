@@ -0,0 +1,96 @@
+#!/bin/sh
+#
+# stress-udel.sh -- Unit removal under command load (testing.txt 2.10)
+#
+# Runs status pollers against a running melted while other connections
+# keep adding, loading, playing and deleting units. Start the server under
+# valgrind or built with -fsanitize=address and check its output as well.
+#
+# usage: stress-udel.sh [-h host] [-p port] [-t seconds] [-n pollers]
+#                       [-c consumer] [clip]
+#
+# Fails if the server stops answering or a poller receives anything but
+# 100 VTR Ready, 201 OK, 202 OK or 403 Unit not found.
+
+host=localhost
+port=5250
+seconds=300
+pollers=4
+consumer=null
+
+while getopts h:p:t:n:c: option
+do
+	case $option in
+		h) host=$OPTARG ;;
+		p) port=$OPTARG ;;
+		t) seconds=$OPTARG ;;
+		n) pollers=$OPTARG ;;
+		c) consumer=$OPTARG ;;
+		*) echo "usage: $0 [-h host] [-p port] [-t seconds] [-n pollers] [-c consumer] [clip]" >&2; exit 2 ;;
+	esac
+done
+shift `expr $OPTIND - 1`
+clip=${1:-test.dv}
+
+command -v nc > /dev/null || { echo "nc is required" >&2; exit 2; }
+
+dir=`mktemp -d` || exit 2
+trap 'touch "$dir/stop"; wait; rm -rf "$dir"' EXIT INT TERM
+
+session()
+{
+	printf "$1BYE\r\n" | nc "$host" "$port"
+}
+
+poll()
+{
+	while [ ! -f "$dir/stop" ]
+	do
+		session 'USTA U0\r\nUSTA U1\r\nLIST U1\r\n' | grep -a '^[0-9][0-9][0-9] ' >> "$dir/poll.$1"
+	done
+}
+
+churn()
+{
+	while [ ! -f "$dir/stop" ]
+	do
+		session "UADD $consumer\r\nLOAD U1 $clip\r\nPLAY U1\r\nUDEL U1\r\nUDEL U0\r\nUADD $consumer\r\n" > /dev/null
+		echo >> "$dir/churn"
+	done
+}
+
+session 'ULS\r\n' | grep -q '^201 ' || { echo "no melted answering on $host:$port" >&2; exit 1; }
+
+i=0
+while [ $i -lt $pollers ]
+do
+	poll $i &
+	i=`expr $i + 1`
+done
+churn &
+
+sleep "$seconds"
+touch "$dir/stop"
+wait
+
+status=0
+cycles=`wc -l < "$dir/churn" 2> /dev/null || echo 0`
+responses=`cat "$dir"/poll.* 2> /dev/null | wc -l`
+unexpected=`cat "$dir"/poll.* 2> /dev/null | tr -d '\r' | grep -v -E '^(100 VTR Ready|201 OK|202 OK|403 Unit not found)$'`
+
+echo "$cycles add/remove cycles, $responses poller responses"
+
+if [ -n "$unexpected" ]
+then
+	echo "unexpected responses:" >&2
+	echo "$unexpected" | sort | uniq -c >&2
+	status=1
+fi
+
+if ! session 'ULS\r\n' | grep -q '^201 '
+then
+	echo "melted stopped answering" >&2
+	status=1
+fi
+
+exit $status
@@ -58,7 +58,7 @@ static void main_cleanup( )
 
 void usage( char *app )
 {
-	fprintf( stderr, "Usage: %s [-prio NNNN|max] [-test] [-port NNNN] [-c config-file]\n", app );
+	fprintf( stderr, "Usage: %s [-prio NNNN|max] [-test] [-port NNNN] [-c config-file] [-shards N]\n", app );
 	exit( 0 );
 }
 
@@ -71,12 +71,10 @@ int main( int argc, char **argv )
 	int index = 0;
 	int background = 1;
 	int test = 0;
+	int shards = 0;
+	int worker = -1;
 	struct timespec tm = { 1, 0 };
 	mvcp_status_t status;
-	struct {
-		int clip_index;
-		int is_logged;
-	} asrun[ MAX_UNITS ];
 	const char *config_file = "/etc/melted.conf";
 
 #ifndef __DARWIN__
@@ -118,6 +116,17 @@ int main( int argc, char **argv )
 			background = 0;
 		else if ( !strcmp( argv[ index ], "-c" ) )
 			config_file = argv[ ++ index ];
+		else if ( !strcmp( argv[ index ], "-shards" ) )
+			shards = atoi( argv[ ++ index ] );
+		else if ( !strcmp( argv[ index ], "-worker" ) )
+		{
+			/* Started by a sharded server as worker N of M */
+			int count = 1;
+			if ( sscanf( argv[ ++ index ], "%d:%d", &worker, &count ) != 2 || worker < 0 || count < 1 )
+				usage( argv[ 0 ] );
+			melted_set_unit_numbering( worker, count );
+			melted_server_set_address( server, "127.0.0.1" );
+		}
 		else if ( !strcmp( argv[ index ], "-prio" ) )
 			index++;
 		else
@@ -145,44 +154,54 @@ int main( int argc, char **argv )
 
 	atexit( main_cleanup );
 
-	/* Set the config script */
-	melted_server_set_config( server, config_file );
+	/* Set the config script - workers are configured through the front end */
+	if ( worker < 0 )
+		melted_server_set_config( server, config_file );
+
+	if ( shards > 0 && worker < 0 )
+		melted_server_set_shards( server, shards, test ? "-test" : "-nodetach" );
 
 	/* Execute the server */
 	error = melted_server_execute( server );
 
-	/* Initialize the as-run log tracking */
-	for ( index = 0; index < MAX_UNITS; index ++ )
-		asrun[ index ].clip_index = -1;
-
-	/* We need to wait until we're exited.. */
-	while ( !server->shutdown )
+	/* We need to wait until we're exited, or a sharded SHUTDOWN asks us to stop */
+	while ( !server->shutdown && !server->stopping )
 	{
+		int count = 0;
+		int *units = NULL;
+
 		nanosleep( &tm, NULL );
 
-		/* As-run logging */
-		for ( index = 0; !error && index < MAX_UNITS; index ++ )
+		/* As-run logging - the tracking is kept on each unit */
+		units = melted_get_unit_list( &count );
+		melted_units_enter( );
+		for ( index = 0; !error && index < count; index ++ )
 		{
-			melted_unit unit = melted_get_unit( index );
+			melted_unit unit = melted_get_unit( units[ index ] );
 
 			if ( unit && melted_unit_get_status( unit, &status ) == 0 )
 			{
+				mlt_properties properties = unit->properties;
 				int length = status.length - 60;
 
 				/* Reset the logging if needed */
-				if ( status.clip_index != asrun[ index ].clip_index || status.position < length || status.status == unit_not_loaded )
+				if ( mlt_properties_get( properties, "asrun_clip_index" ) == NULL ||
+					 status.clip_index != mlt_properties_get_int( properties, "asrun_clip_index" ) ||
+					 status.position < length || status.status == unit_not_loaded )
 				{
-					asrun[ index ].clip_index = status.clip_index;
-					asrun[ index ].is_logged = 0;
+					mlt_properties_set_int( properties, "asrun_clip_index", status.clip_index );
+					mlt_properties_set_int( properties, "asrun_logged", 0 );
 				}
 				/* Log as-run only once when near the end */
-				if ( ! asrun[ index ].is_logged && status.length > 0 && status.position > length )
+				if ( !mlt_properties_get_int( properties, "asrun_logged" ) && status.length > 0 && status.position > length )
 				{
-					melted_log( LOG_NOTICE, "AS-RUN U%d \"%s\" len %d pos %d", index, status.clip, status.length, status.position );
-					asrun[ index ].is_logged = 1;
+					melted_log( LOG_NOTICE, "AS-RUN U%d \"%s\" len %d pos %d", units[ index ], status.clip, status.length, status.position );
+					mlt_properties_set_int( properties, "asrun_logged", 1 );
 				}
 			}
 		}
+		melted_units_leave( );
+		free( units );
 	}
 
 	return error;
@@ -0,0 +1,161 @@
+/*
+ * melted_cache.c -- Producer Cache
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdlib.h>
+#include <string.h>
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_cache.h"
+
+/** Construct a producer cache.
+*/
+
+melted_cache melted_cache_init( )
+{
+	melted_cache this = calloc( 1, sizeof( melted_cache_t ) );
+	if ( this != NULL )
+		pthread_mutex_init( &this->mutex, NULL );
+	return this;
+}
+
+/** Remove an entry, releasing the cache's reference to the producer.
+*/
+
+static void melted_cache_remove( melted_cache this, int index )
+{
+	free( this->entries[ index ].key );
+	mlt_producer_close( this->entries[ index ].producer );
+	this->entries[ index ] = this->entries[ -- this->count ];
+}
+
+/** Fetch a producer from the cache.
+
+    \return A new reference to the cached producer or NULL if not found.
+*/
+
+mlt_producer melted_cache_get( melted_cache this, const char *key )
+{
+	mlt_producer producer = NULL;
+	int i;
+
+	pthread_mutex_lock( &this->mutex );
+	for ( i = 0; i < this->count; i ++ )
+	{
+		if ( !strcmp( this->entries[ i ].key, key ) )
+		{
+			producer = this->entries[ i ].producer;
+			this->entries[ i ].used = ++ this->clock;
+			mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( producer ) );
+			break;
+		}
+	}
+	if ( producer != NULL )
+		this->hits ++;
+	else
+		this->misses ++;
+	pthread_mutex_unlock( &this->mutex );
+
+	return producer;
+}
+
+/** Evict the least recently used entries until at most size remain.
+*/
+
+static void melted_cache_evict( melted_cache this, int size )
+{
+	while ( this->count > 0 && this->count > size )
+	{
+		int oldest = 0;
+		int i;
+		for ( i = 1; i < this->count; i ++ )
+			if ( this->entries[ i ].used < this->entries[ oldest ].used )
+				oldest = i;
+		melted_cache_remove( this, oldest );
+	}
+}
+
+/** Add a producer to the cache.
+
+    The cache takes its own reference to the producer. The least recently
+    used entries are evicted to keep the cache within size.
+*/
+
+void melted_cache_put( melted_cache this, const char *key, mlt_producer producer, int size )
+{
+	melted_cache_entry *entries;
+
+	pthread_mutex_lock( &this->mutex );
+	melted_cache_evict( this, size - 1 );
+	entries = realloc( this->entries, ( this->count + 1 ) * sizeof( melted_cache_entry ) );
+	if ( size > 0 && entries != NULL )
+	{
+		this->entries = entries;
+		this->entries[ this->count ].key = strdup( key );
+		this->entries[ this->count ].producer = producer;
+		this->entries[ this->count ].used = ++ this->clock;
+		mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( producer ) );
+		this->count ++;
+	}
+	else if ( entries != NULL )
+	{
+		this->entries = entries;
+	}
+	pthread_mutex_unlock( &this->mutex );
+}
+
+/** Shrink the cache to at most size entries.
+*/
+
+void melted_cache_purge( melted_cache this, int size )
+{
+	pthread_mutex_lock( &this->mutex );
+	melted_cache_evict( this, size );
+	pthread_mutex_unlock( &this->mutex );
+}
+
+/** Get the number of cached producers.
+*/
+
+int melted_cache_count( melted_cache this )
+{
+	int count;
+	pthread_mutex_lock( &this->mutex );
+	count = this->count;
+	pthread_mutex_unlock( &this->mutex );
+	return count;
+}
+
+/** Close the cache.
+*/
+
+void melted_cache_close( melted_cache this )
+{
+	if ( this != NULL )
+	{
+		melted_cache_evict( this, 0 );
+		free( this->entries );
+		pthread_mutex_destroy( &this->mutex );
+		free( this );
+	}
+}
@@ -0,0 +1,72 @@
+/*
+ * melted_cache.h -- Producer Cache
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_CACHE_H_
+#define _MELTED_CACHE_H_
+
+/* System header files */
+#include <pthread.h>
+#include <stdint.h>
+
+/* MLT header files */
+#include <framework/mlt_producer.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Cache entry.
+*/
+
+typedef struct
+{
+	char *key;
+	mlt_producer producer;
+	int64_t used;
+}
+melted_cache_entry;
+
+/** Producer cache with least recently used eviction.
+*/
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	melted_cache_entry *entries;
+	int count;
+	int64_t clock;
+	int hits;
+	int misses;
+}
+*melted_cache, melted_cache_t;
+
+extern melted_cache melted_cache_init( );
+extern mlt_producer melted_cache_get( melted_cache, const char * );
+extern void melted_cache_put( melted_cache, const char *, mlt_producer, int );
+extern void melted_cache_purge( melted_cache, int );
+extern int melted_cache_count( melted_cache );
+extern void melted_cache_close( melted_cache );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
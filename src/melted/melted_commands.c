@@ -28,37 +28,248 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "melted_unit.h"
 #include "melted_commands.h"
 #include "melted_log.h"
+#include "melted_pool.h"
+#include "melted_frames.h"
+#include "melted_index.h"
+#include "melted_media.h"
+#include "melted_dirs.h"
+#include "melted_prefetch.h"
+
+/** The unit table.
+
+    Lookups index the current table without locking. When the table has to
+    grow, a larger copy is published and the old one is retired rather than
+    freed, so a lookup in progress never reads released memory. The live
+    units are also kept in a dense list so commands that visit every unit
+    do not scan empty slots.
+*/
+
+typedef struct unit_table_s
+{
+	struct unit_table_s *retired;
+	int size;
+	melted_unit units[];
+}
+unit_table;
+
+static unit_table *g_table = NULL;
+static int *g_live = NULL;
+static int g_live_count = 0;
+static pthread_mutex_t g_units_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Marks the slot of a deleted unit that has not been reclaimed yet.
+*/
+
+static char g_retiring;
+#define UNIT_RETIRING ( ( melted_unit )&g_retiring )
+
+/** Marks the slot of a unit whose consumer is still being created.
+*/
+
+static char g_reserved;
+#define UNIT_RESERVED ( ( melted_unit )&g_reserved )
+static int g_reserved_count = 0;
+
+/** Readers of the unit table.
 
-static melted_unit g_units[MAX_UNITS] = {NULL};
+    Anything that uses a unit obtained from melted_get_unit does so between
+    melted_units_enter and melted_units_leave. Readers register against one
+    of two phases with a single atomic increment. A deleted unit is removed
+    from the table at once, the phase is flipped, and the unit is closed
+    only when every reader of the old phase has left.
+*/
+
+static volatile int g_phase = 0;
+static volatile int g_readers[ 2 ] = { 0, 0 };
+static pthread_mutex_t g_grace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int t_depth = 0;
+static __thread int t_phase = 0;
+static __thread melted_unit *t_pending = NULL;
+static __thread int t_pending_count = 0;
+
+static void reclaim_unit( melted_unit unit );
+
+/** Enter a section that may use units - sections may be nested.
+*/
+
+void melted_units_enter( void )
+{
+	if ( t_depth ++ == 0 )
+	{
+		for ( ;; )
+		{
+			int phase = g_phase;
+			__sync_fetch_and_add( &g_readers[ phase ], 1 );
+			if ( phase == g_phase )
+			{
+				t_phase = phase;
+				break;
+			}
+			__sync_fetch_and_sub( &g_readers[ phase ], 1 );
+		}
+	}
+}
+
+/** Leave a section, closing any units this thread deleted inside it.
+*/
+
+void melted_units_leave( void )
+{
+	if ( t_depth > 0 && -- t_depth == 0 )
+	{
+		__sync_fetch_and_sub( &g_readers[ t_phase ], 1 );
+		while ( t_pending_count > 0 )
+			reclaim_unit( t_pending[ -- t_pending_count ] );
+		free( t_pending );
+		t_pending = NULL;
+	}
+}
+
+/** Wait until no reader can still hold a unit removed from the table.
+*/
+
+static void wait_for_readers( void )
+{
+	struct timespec tm = { 0, 1000000 };
+	int phase;
+
+	pthread_mutex_lock( &g_grace_mutex );
+	phase = g_phase;
+	g_phase = !phase;
+	__sync_synchronize( );
+	while ( g_readers[ phase ] > 0 )
+		nanosleep( &tm, NULL );
+	pthread_mutex_unlock( &g_grace_mutex );
+}
+
+/** Close a unit once it is out of the table and release its slot.
+*/
+
+static void reclaim_unit( melted_unit unit )
+{
+	int n = mlt_properties_get_int( unit->properties, "unit" );
+	mvcp_notifier notifier = mlt_properties_get_data( unit->properties, "notifier", NULL );
+
+	wait_for_readers( );
+	melted_unit_close( unit );
+	melted_frames_remove_unit( n );
+	if ( notifier != NULL )
+		mvcp_notifier_remove( notifier, n );
+
+	pthread_mutex_lock( &g_units_mutex );
+	g_table->units[ n ] = NULL;
+	pthread_mutex_unlock( &g_units_mutex );
+
+	melted_log( LOG_NOTICE, "Deleted unit U%d.", n ); 
+}
 
 /** Return the melted_unit given a numeric index.
 */
 
 melted_unit melted_get_unit( int n )
 {
-	if (n < MAX_UNITS)
-		return g_units[n];
+	unit_table *table = g_table;
+	if ( table != NULL && n >= 0 && n < table->size && table->units[ n ] != UNIT_RETIRING && table->units[ n ] != UNIT_RESERVED )
+		return table->units[ n ];
 	else
 		return NULL;
 }
 
+/** Compare unit numbers for sorting.
+*/
+
+static int compare_ids( const void *a, const void *b )
+{
+	return *( const int * )a - *( const int * )b;
+}
+
+/** Get the numbers of the units on the server in ascending order.
+
+    \param ids An array to receive the unit numbers (may be NULL).
+    \param size The size of the array.
+    \return The number of units, which may be larger than size.
+*/
+
+int melted_get_unit_ids( int *ids, int size )
+{
+	int count;
+	pthread_mutex_lock( &g_units_mutex );
+	count = g_live_count;
+	if ( ids != NULL )
+	{
+		if ( size > count )
+			size = count;
+		memcpy( ids, g_live, size * sizeof( int ) );
+		qsort( ids, size, sizeof( int ), compare_ids );
+	}
+	pthread_mutex_unlock( &g_units_mutex );
+	return count;
+}
+
+/** Get an allocated array of the current unit numbers.
+
+    \param count Receives the number of units.
+    \return The array, which the caller must free.
+*/
+
+int *melted_get_unit_list( int *count )
+{
+	int size = melted_get_unit_ids( NULL, 0 );
+	int *ids = malloc( ( size + 1 ) * sizeof( int ) );
+	*count = 0;
+	if ( ids != NULL )
+	{
+		*count = melted_get_unit_ids( ids, size );
+		if ( *count > size )
+			*count = size;
+	}
+	return ids;
+}
+
 /** Destroy the melted_unit given its numeric index.
+
+    The unit is taken out of the table immediately. It is closed once the
+    commands that may be using it have finished - when called from inside
+    a section that is deferred until the section is left.
 */
 
 void melted_delete_unit( int n )
 {
-	if (n < MAX_UNITS)
+	melted_unit unit = NULL;
+
+	pthread_mutex_lock( &g_units_mutex );
+	unit = melted_get_unit( n );
+	if ( unit != NULL )
 	{
-		melted_unit unit = melted_get_unit(n);
-		if (unit != NULL)
+		int i;
+		g_table->units[ n ] = UNIT_RETIRING;
+		for ( i = 0; i < g_live_count; i ++ )
+			if ( g_live[ i ] == n )
+				g_live[ i ] = g_live[ -- g_live_count ];
+	}
+	pthread_mutex_unlock( &g_units_mutex );
+
+	if ( unit != NULL && t_depth == 0 )
+	{
+		reclaim_unit( unit );
+	}
+	else if ( unit != NULL )
+	{
+		melted_unit *pending = realloc( t_pending, ( t_pending_count + 1 ) * sizeof( melted_unit ) );
+		if ( pending != NULL )
 		{
-			melted_unit_close( unit );
-			g_units[ n ] = NULL;
-			melted_log( LOG_NOTICE, "Deleted unit U%d.", n ); 
+			t_pending = pending;
+			t_pending[ t_pending_count ++ ] = unit;
+		}
+		else
+		{
+			melted_log( LOG_ERR, "Unable to defer closing unit U%d.", n );
 		}
 	}
 }
@@ -68,46 +279,141 @@ void melted_delete_unit( int n )
 
 void melted_delete_all_units( void )
 {
+	int count = 0;
+	int *ids = melted_get_unit_list( &count );
 	int i;
-	for (i = 0; i < MAX_UNITS; i++)
-		melted_delete_unit( i );
+	for ( i = 0; i < count; i++ )
+		melted_delete_unit( ids[ i ] );
+	free( ids );
+}
+
+/** Unit numbers allocated by this server are offset, offset + stride, ...
+    which keeps the numbers of the workers of a sharded server disjoint.
+*/
+
+static int g_unit_offset = 0;
+static int g_unit_stride = 1;
+
+void melted_set_unit_numbering( int offset, int stride )
+{
+	pthread_mutex_lock( &g_units_mutex );
+	g_unit_offset = offset >= 0 ? offset : 0;
+	g_unit_stride = stride > 0 ? stride : 1;
+	pthread_mutex_unlock( &g_units_mutex );
+}
+
+/** Reserve the first free unit number - must be called with the mutex held.
+
+    \return The unit number or -1 if the table could not grow.
+*/
+
+static int reserve_unit( )
+{
+	int size = g_table != NULL ? g_table->size : 0;
+	int *live;
+	int i;
+
+	for ( i = g_unit_offset; i < size; i += g_unit_stride )
+		if ( g_table->units[ i ] == NULL )
+			break;
+
+	if ( i >= size )
+	{
+		int grown = size ? size * 2 : 16;
+		unit_table *table;
+		while ( grown <= i )
+			grown *= 2;
+		table = calloc( 1, sizeof( unit_table ) + grown * sizeof( melted_unit ) );
+		if ( table == NULL )
+			return -1;
+		table->size = grown;
+		if ( g_table != NULL )
+			memcpy( table->units, g_table->units, size * sizeof( melted_unit ) );
+		table->retired = g_table;
+		__sync_synchronize( );
+		g_table = table;
+	}
+
+	live = realloc( g_live, ( g_live_count + g_reserved_count + 1 ) * sizeof( int ) );
+	if ( live == NULL )
+		return -1;
+	g_live = live;
+
+	return i;
+}
+
+/** Listener told of the unit number reserved by a UADD on this thread.
+*/
+
+static __thread melted_unit_reserved t_reserved = NULL;
+static __thread void *t_reserved_arg = NULL;
+
+void melted_set_reserve_listener( melted_unit_reserved listener, void *arg )
+{
+	t_reserved = listener;
+	t_reserved_arg = arg;
 }
 
 /** Add a virtual vtr to the server.
+
+    The unit number is reserved under the table mutex but the consumer is
+    created without it, so several UADDs can open their devices at once.
 */
 response_codes melted_add_unit( command_argument cmd_arg )
 {
-	int i = 0;
+	melted_unit unit = NULL;
+	int i;
 
-	// Initialize g_units array on first call.
-	if ( g_units[0] == NULL )
+	pthread_mutex_lock( &g_units_mutex );
+	i = reserve_unit( );
+	if ( i >= 0 )
 	{
-		for ( i = 1; i < MAX_UNITS; i ++ )
-			g_units[ i ] = NULL;
+		g_table->units[ i ] = UNIT_RESERVED;
+		g_reserved_count ++;
 	}
+	pthread_mutex_unlock( &g_units_mutex );
 
-	// Locate first empty item in g_units array.
-	for ( i = 0; i < MAX_UNITS; i ++ )
-		if ( g_units[ i ] == NULL )
-			break;
+	if ( t_reserved != NULL )
+		t_reserved( t_reserved_arg, i );
 
-	if ( i < MAX_UNITS )
+	if ( i >= 0 )
 	{
 		// Add unit.
 		char *arg = cmd_arg->argument;
-		g_units[ i ] = melted_unit_init( i, arg );
-		if ( g_units[ i ] != NULL )
+		unit = melted_unit_init( i, arg );
+		if ( unit != NULL )
+			melted_unit_set_notifier( unit, mvcp_parser_get_notifier( cmd_arg->parser ), cmd_arg->root_dir );
+
+		pthread_mutex_lock( &g_units_mutex );
+		g_reserved_count --;
+		__sync_synchronize( );
+		g_table->units[ i ] = unit;
+		if ( unit != NULL )
 		{
-			melted_unit_set_notifier( g_units[ i ], mvcp_parser_get_notifier( cmd_arg->parser ), cmd_arg->root_dir );
-			mvcp_response_printf( cmd_arg->response, 10, "U%1d\n\n", i );
+			g_live[ g_live_count ++ ] = i;
+			mvcp_response_printf( cmd_arg->response, 20, "U%1d\n\n", i );
 		}
-		return g_units[ i ] != NULL ? RESPONSE_SUCCESS_N : RESPONSE_ERROR;
+		pthread_mutex_unlock( &g_units_mutex );
 	}
+
+	if ( i >= 0 )
+		return unit != NULL ? RESPONSE_SUCCESS_N : RESPONSE_ERROR;
+
 	mvcp_response_printf( cmd_arg->response, 1024, "no more units can be created\n\n" );
 
 	return RESPONSE_ERROR;
 }
 
+/** Remove a unit from the server.
+*/
+
+response_codes melted_remove_unit( command_argument cmd_arg )
+{
+	if ( melted_get_unit( cmd_arg->unit ) == NULL )
+		return RESPONSE_INVALID_UNIT;
+	melted_delete_unit( cmd_arg->unit );
+	return RESPONSE_SUCCESS;
+}
 
 /** List all AV/C nodes on the bus.
 */
@@ -123,68 +429,109 @@ response_codes melted_list_nodes( command_argument cmd_arg )
 response_codes melted_list_units( command_argument cmd_arg )
 {
 	response_codes error = RESPONSE_SUCCESS_N;
+	int count = 0;
+	int *ids = melted_get_unit_list( &count );
 	int i = 0;
 
-	for ( i = 0; i < MAX_UNITS; i ++ )
+	for ( i = 0; i < count; i ++ )
 	{
-		melted_unit unit = melted_get_unit( i );
+		melted_unit unit = melted_get_unit( ids[ i ] );
 		if ( unit != NULL )
 		{
 			mlt_properties properties = unit->properties;
 			char *constructor = mlt_properties_get( properties, "constructor" );
 			int node = mlt_properties_get_int( properties, "node" );
 			int online = !mlt_properties_get_int( properties, "offline" );
-			mvcp_response_printf( cmd_arg->response, 1024, "U%d %02d %s %d\n", i, node, constructor, online );
+			mvcp_response_printf( cmd_arg->response, 1024, "U%d %02d %s %d\n", ids[ i ], node, constructor, online );
 		}
 	}
 	mvcp_response_printf( cmd_arg->response, 1024, "\n" );
+	free( ids );
 
 	return error;
 }
 
-static int filter_files( const struct dirent *de )
+/** Report server wide statistics.
+*/
+response_codes melted_server_stats( command_argument cmd_arg )
 {
-	return de->d_name[ 0 ] != '.';
+	long pages = 0;
+	int units = melted_get_unit_ids( NULL, 0 );
+	int fds = 0;
+	FILE *file = fopen( "/proc/self/statm", "r" );
+	DIR *dir = opendir( "/proc/self/fd" );
+
+	if ( file != NULL )
+	{
+		if ( fscanf( file, "%*s %ld", &pages ) != 1 )
+			pages = 0;
+		fclose( file );
+	}
+	if ( dir != NULL )
+	{
+		struct dirent *de;
+		while ( ( de = readdir( dir ) ) != NULL )
+			if ( de->d_name[ 0 ] != '.' )
+				fds ++;
+		closedir( dir );
+	}
+	mvcp_response_printf( cmd_arg->response, 1024, "units=%d\n", units );
+	mvcp_response_printf( cmd_arg->response, 1024, "rss=%ld\n", pages * ( sysconf( _SC_PAGESIZE ) / 1024 ) );
+	mvcp_response_printf( cmd_arg->response, 1024, "fds=%d\n", fds );
+	melted_frames_report( cmd_arg->response );
+	melted_index_report( cmd_arg->response );
+	melted_media_report( cmd_arg->response );
+	melted_dirs_report( cmd_arg->response );
+	melted_prefetch_report( cmd_arg->response );
+	mvcp_response_printf( cmd_arg->response, 1024, "\n" );
+
+	return RESPONSE_SUCCESS_N;
 }
 
-/** List clips in a directory.
+/** List a directory for CLS or MLS.
+
+    {path} [{offset} {count} [{prefix}]] lists only the count entries
+    starting at offset, counting the subdirectories first, of the names
+    starting with prefix.
 */
-response_codes melted_list_clips( command_argument cmd_arg )
+static response_codes list_clips( command_argument cmd_arg, int media )
 {
-	response_codes error = RESPONSE_BAD_FILE;
 	const char *dir_name = (const char*) cmd_arg->argument;
-	DIR *dir;
 	char fullname[1024];
-	struct dirent **de = NULL;
-	int i, n;
-	
-	snprintf( fullname, 1023, "%s%s", cmd_arg->root_dir, dir_name );
-	dir = opendir( fullname );
-	if (dir != NULL)
+	char *prefix = NULL;
+	int offset = 0;
+	int count = -1;
+
+	if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) > 3 )
 	{
-		struct stat info;
-		error = RESPONSE_SUCCESS_N;
-		n = scandir( fullname, &de, filter_files, alphasort );
-		for (i = 0; i < n; i++ )
-		{
-			snprintf( fullname, 1023, "%s%s/%s", cmd_arg->root_dir, dir_name, de[i]->d_name );
-			if ( stat( fullname, &info ) == 0 && S_ISDIR( info.st_mode ) )
-				mvcp_response_printf( cmd_arg->response, 1024, "\"%s/\"\n", de[i]->d_name );
-		}
-		for (i = 0; i < n; i++ )
-		{
-			snprintf( fullname, 1023, "%s%s/%s", cmd_arg->root_dir, dir_name, de[i]->d_name );
-			if ( lstat( fullname, &info ) == 0 && 
-				 ( S_ISREG( info.st_mode ) || S_ISLNK( info.st_mode ) || ( strstr( fullname, ".clip" ) && info.st_mode | S_IXUSR ) ) )
-				mvcp_response_printf( cmd_arg->response, 1024, "\"%s\" %llu\n", de[i]->d_name, (unsigned long long) info.st_size );
-			free( de[ i ] );
-		}
-		free( de );
-		closedir( dir );
-		mvcp_response_write( cmd_arg->response, "\n", 1 );
+		offset = atoi( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 2 ) );
+		count = atoi( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 3 ) );
+		if ( offset < 0 || count < 0 )
+			return RESPONSE_OUT_OF_RANGE;
+		if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) > 4 )
+			prefix = mvcp_tokeniser_get_string( cmd_arg->tokeniser, 4 );
 	}
 
-	return error;
+	snprintf( fullname, 1023, "%s%s", cmd_arg->root_dir, dir_name );
+	if ( melted_dirs_list( fullname, prefix, offset, count, media, cmd_arg->response ) != 0 )
+		return RESPONSE_BAD_FILE;
+	mvcp_response_write( cmd_arg->response, "\n", 1 );
+
+	return RESPONSE_SUCCESS_N;
+}
+
+/** List clips in a directory.
+*/
+response_codes melted_list_clips( command_argument cmd_arg )
+{
+	return list_clips( cmd_arg, 0 );
+}
+
+/** List clips in a directory with the length and frame rate of each file.
+*/
+response_codes melted_list_media( command_argument cmd_arg )
+{
+	return list_clips( cmd_arg, 1 );
 }
 
 /** Set a server configuration property.
@@ -205,14 +552,18 @@ response_codes melted_set_global_property( command_argument cmd_arg )
 	if ( strncasecmp( key, "root", 1024) == 0 )
 	{
 		int len = strlen(value);
+		int count = 0;
+		int *ids = melted_get_unit_list( &count );
 		int i;
 		
 		/* stop all units and unload clips */
-		for (i = 0; i < MAX_UNITS; i++)
+		for (i = 0; i < count; i++)
 		{
-			if (g_units[i] != NULL)
-				melted_unit_terminate( g_units[i] );
+			melted_unit unit = melted_get_unit( ids[ i ] );
+			if (unit != NULL)
+				melted_unit_terminate( unit );
 		}
+		free( ids );
 
 		/* set the property */
 		strncpy( cmd_arg->root_dir, value, 1023 );
@@ -224,6 +575,38 @@ response_codes melted_set_global_property( command_argument cmd_arg )
 			cmd_arg->root_dir[ len + 1 ] = '\0';
 		}
 	}
+	else if ( strncasecmp( key, "pool.", 5 ) == 0 && key[ 5 ] != '\0' )
+	{
+		/* keep that many idle consumers of a unit constructor */
+		melted_pool_set( key + 5, atoi( value ) );
+	}
+	else if ( strncasecmp( key, "frames", 1024 ) == 0 )
+	{
+		/* share decoded images between units, up to that many megabytes */
+		melted_frames_set_budget( ( int64_t )atoi( value ) << 20 );
+	}
+	else if ( strncasecmp( key, "index", 1024 ) == 0 )
+	{
+		/* keep the keyframe layout of media files in that file */
+		if ( melted_index_open( value ) != 0 )
+			return RESPONSE_BAD_FILE;
+	}
+	else if ( strncasecmp( key, "media", 1024 ) == 0 )
+	{
+		/* keep the description of media files in that file */
+		if ( melted_media_open( value ) != 0 )
+			return RESPONSE_BAD_FILE;
+	}
+	else if ( strncasecmp( key, "dirs", 1024 ) == 0 )
+	{
+		/* keep the listings of that many directories for CLS */
+		melted_dirs_set_size( atoi( value ) );
+	}
+	else if ( strncasecmp( key, "prefetch", 1024 ) == 0 )
+	{
+		/* read ahead upcoming media, up to that many megabytes per second */
+		melted_prefetch_set_budget( ( int64_t )atoi( value ) << 20 );
+	}
 	else
 		return RESPONSE_OUT_OF_RANGE;
 	
@@ -242,6 +625,38 @@ response_codes melted_get_global_property( command_argument cmd_arg )
 		mvcp_response_write( cmd_arg->response, cmd_arg->root_dir, strlen(cmd_arg->root_dir) );
 		return RESPONSE_SUCCESS_1;
 	}
+	else if ( strncasecmp( key, "pool.", 5 ) == 0 && key[ 5 ] != '\0' )
+	{
+		mvcp_response_printf( cmd_arg->response, 32, "%d", melted_pool_count( key + 5 ) );
+		return RESPONSE_SUCCESS_1;
+	}
+	else if ( strncasecmp( key, "frames", 1024 ) == 0 )
+	{
+		mvcp_response_printf( cmd_arg->response, 32, "%lld", ( long long )( melted_frames_get_budget( ) >> 20 ) );
+		return RESPONSE_SUCCESS_1;
+	}
+	else if ( strncasecmp( key, "index", 1024 ) == 0 )
+	{
+		const char *path = melted_index_path( );
+		mvcp_response_printf( cmd_arg->response, 1024, "%s", path != NULL ? path : "" );
+		return RESPONSE_SUCCESS_1;
+	}
+	else if ( strncasecmp( key, "media", 1024 ) == 0 )
+	{
+		const char *path = melted_media_path( );
+		mvcp_response_printf( cmd_arg->response, 1024, "%s", path != NULL ? path : "" );
+		return RESPONSE_SUCCESS_1;
+	}
+	else if ( strncasecmp( key, "dirs", 1024 ) == 0 )
+	{
+		mvcp_response_printf( cmd_arg->response, 32, "%d", melted_dirs_get_size( ) );
+		return RESPONSE_SUCCESS_1;
+	}
+	else if ( strncasecmp( key, "prefetch", 1024 ) == 0 )
+	{
+		mvcp_response_printf( cmd_arg->response, 32, "%lld", ( long long )( melted_prefetch_get_budget( ) >> 20 ) );
+		return RESPONSE_SUCCESS_1;
+	}
 	else
 		return RESPONSE_OUT_OF_RANGE;
 	
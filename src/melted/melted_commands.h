@@ -31,16 +31,30 @@ extern "C"
 {
 #endif
 
+/** Callback receiving the unit number reserved by UADD, or -1.
+*/
+
+typedef void ( *melted_unit_reserved )( void *, int );
+
 extern melted_unit melted_get_unit( int );
+extern int melted_get_unit_ids( int *, int );
+extern int *melted_get_unit_list( int * );
 extern void melted_delete_unit( int );
 extern void melted_delete_all_units( void );
+extern void melted_set_unit_numbering( int, int );
+extern void melted_set_reserve_listener( melted_unit_reserved, void * );
+extern void melted_units_enter( void );
+extern void melted_units_leave( void );
 //extern void raw1394_start_service_threads( void );
 //extern void raw1394_stop_service_threads( void );
 
 extern response_codes melted_add_unit( command_argument );
+extern response_codes melted_remove_unit( command_argument );
 extern response_codes melted_list_nodes( command_argument );
 extern response_codes melted_list_units( command_argument );
 extern response_codes melted_list_clips( command_argument );
+extern response_codes melted_list_media( command_argument );
+extern response_codes melted_server_stats( command_argument );
 extern response_codes melted_set_global_property( command_argument );
 extern response_codes melted_get_global_property( command_argument );
 
@@ -154,26 +154,52 @@ static int connection_read( int fd, char *command, int length )
 	return nchars;
 }
 
-int connection_status( int fd, mvcp_notifier notifier )
+/** Send the status of every unit and then each status change.
+
+    The clip id is only sent to a client which asked for it with STATUS ID,
+    as older clients expect 17 fields.
+*/
+
+int connection_status( int fd, mvcp_notifier notifier, int with_id )
 {
 	int error = 0;
 	int index = 0;
 	mvcp_status_t status;
 	char text[ 10240 ];
 	mvcp_socket socket = mvcp_socket_init_fd( fd );
-	
-	for ( index = 0; !error && index < MAX_UNITS; index ++ )
+	int count = mvcp_notifier_units( notifier, NULL, 0 );
+	int *units = malloc( ( count + 1 ) * sizeof( int ) );
+
+	if ( units != NULL )
+	{
+		int stored = mvcp_notifier_units( notifier, units, count );
+		if ( stored < count )
+			count = stored;
+	}
+	else
 	{
-		mvcp_notifier_get( notifier, &status, index );
-		mvcp_status_serialise( &status, text, sizeof( text ) );
+		count = 0;
+	}
+
+	for ( index = 0; !error && index < count; index ++ )
+	{
+		mvcp_notifier_get( notifier, &status, units[ index ] );
+		if ( with_id )
+			mvcp_status_serialise_id( &status, text, sizeof( text ) );
+		else
+			mvcp_status_serialise( &status, text, sizeof( text ) );
 		error = mvcp_socket_write_data( socket, text, strlen( text )  ) != strlen( text );
 	}
+	free( units );
 
 	while ( !error )
 	{
 		if ( mvcp_notifier_wait( notifier, &status ) == 0 )
 		{
-			mvcp_status_serialise( &status, text, sizeof( text ) );
+			if ( with_id )
+				mvcp_status_serialise_id( &status, text, sizeof( text ) );
+			else
+				mvcp_status_serialise( &status, text, sizeof( text ) );
 			error = mvcp_socket_write_data( socket, text, strlen( text ) ) != strlen( text );
 		}
 		else
@@ -299,7 +325,10 @@ void *parser_thread( void *arg )
 			else
 			{
 				// Start sending status repeatedly
-				error = connection_status( fd, mvcp_parser_get_notifier( parser ) );
+				char *argument = command + 6;
+				while ( *argument == ' ' )
+					argument ++;
+				error = connection_status( fd, mvcp_parser_get_notifier( parser ), !strncasecmp( argument, "ID", 2 ) );
 			}
 		}
 	}
@@ -0,0 +1,680 @@
+/*
+ * melted_dirs.c -- Cached Directory Listings
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_dirs.h"
+#include "melted_media.h"
+#include "melted_log.h"
+
+/** A listed directory entry.
+*/
+
+typedef struct
+{
+	char *name;
+	int dir;
+	int file;
+	unsigned long long size;
+	time_t mtime;
+	int link;
+	int media;
+	int length;
+	double fps;
+}
+dir_entry;
+
+/** The listing of a directory, shared by the requests using it.
+
+    The described length and frame rate of its entries are filled in by
+    MLS under the mutex, the rest never changes once read.
+*/
+
+typedef struct
+{
+	int refs;
+	int wd;
+	unsigned long used;
+	time_t mtime;
+	time_t ctime;
+	char *resolved;
+	int count;
+	dir_entry *entries;
+}
+*dir_listing, dir_listing_t;
+
+/** The reads in progress of a directory not cached yet.
+
+    A change reported while the directory is read bumps the generation,
+    and the listing read is then returned but not cached.
+*/
+
+typedef struct
+{
+	int readers;
+	int generation;
+}
+dir_pending;
+
+static pthread_mutex_t g_dirs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t g_watch_thread;
+static int g_running = 0;
+static int g_fd = -1;
+static int g_size = 0;
+static int g_cached = 0;
+static unsigned long g_clock = 0;
+static mlt_properties g_listings = NULL;
+static mlt_properties g_watches = NULL;
+static mlt_properties g_pending = NULL;
+static mlt_properties g_stats = NULL;
+
+/** Release a reference to a listing.
+*/
+
+static void release_listing( dir_listing listing )
+{
+	if ( listing != NULL && __sync_sub_and_fetch( &listing->refs, 1 ) == 0 )
+	{
+		int i;
+		for ( i = 0; i < listing->count; i ++ )
+			free( listing->entries[ i ].name );
+		free( listing->entries );
+		free( listing->resolved );
+		free( listing );
+	}
+}
+
+static int filter_files( const struct dirent *de )
+{
+	return de->d_name[ 0 ] != '.';
+}
+
+/** Read a directory.
+
+    Each entry costs one lstat, and a stat only for symbolic links which
+    are listed as directories when they point to one. The size and
+    modification time kept here let MLS find a file in the media store
+    without looking at it again.
+
+    \return The listing or NULL if the directory can not be read.
+*/
+
+static dir_listing read_listing( const char *path )
+{
+	dir_listing listing = calloc( 1, sizeof( dir_listing_t ) );
+	struct dirent **de = NULL;
+	struct stat info;
+	char fullname[ 1024 ];
+	int i, n;
+
+	if ( listing == NULL )
+		return NULL;
+	if ( stat( path, &info ) != 0 || ( n = scandir( path, &de, filter_files, alphasort ) ) < 0 )
+	{
+		free( listing );
+		return NULL;
+	}
+
+	listing->refs = 1;
+	listing->wd = -1;
+	listing->mtime = info.st_mtime;
+	listing->ctime = info.st_ctime;
+	listing->resolved = realpath( path, NULL );
+	listing->entries = calloc( n > 0 ? n : 1, sizeof( dir_entry ) );
+	for ( i = 0; i < n; i ++ )
+	{
+		dir_entry *entry = &listing->entries[ listing->count ];
+		snprintf( fullname, 1023, "%s/%s", path, de[ i ]->d_name );
+		if ( listing->entries != NULL && lstat( fullname, &info ) == 0 )
+		{
+			entry->file = S_ISREG( info.st_mode ) || S_ISLNK( info.st_mode ) || ( strstr( fullname, ".clip" ) && info.st_mode | S_IXUSR );
+			entry->size = info.st_size;
+			entry->mtime = info.st_mtime;
+			entry->link = S_ISLNK( info.st_mode );
+			if ( entry->link )
+				entry->dir = stat( fullname, &info ) == 0 && S_ISDIR( info.st_mode );
+			else
+				entry->dir = S_ISDIR( info.st_mode );
+			if ( entry->dir || entry->file )
+			{
+				entry->name = strdup( de[ i ]->d_name );
+				listing->count ++;
+			}
+		}
+		free( de[ i ] );
+	}
+	free( de );
+
+	return listing;
+}
+
+/** Drop the cached listing of a directory - must be called with the mutex
+    held.
+*/
+
+static void drop_listing( const char *path )
+{
+	dir_listing listing = mlt_properties_get_data( g_listings, path, NULL );
+	dir_pending *pending = mlt_properties_get_data( g_pending, path, NULL );
+	char key[ 32 ];
+
+	if ( pending != NULL )
+		pending->generation ++;
+	if ( listing != NULL )
+	{
+#ifdef __linux__
+		if ( listing->wd >= 0 )
+		{
+			inotify_rm_watch( g_fd, listing->wd );
+			snprintf( key, sizeof( key ), "%d", listing->wd );
+			mlt_properties_set( g_watches, key, NULL );
+		}
+#endif
+		mlt_properties_set_data( g_listings, path, NULL, 0, NULL, NULL );
+		g_cached --;
+	}
+}
+
+/** Drop the least recently used listing - must be called with the mutex
+    held.
+
+    \return 0 if a listing was dropped.
+*/
+
+static int evict_listing( void )
+{
+	dir_listing oldest = NULL;
+	char *path = NULL;
+	int i;
+
+	for ( i = 0; g_listings != NULL && i < mlt_properties_count( g_listings ); i ++ )
+	{
+		dir_listing listing = mlt_properties_get_data_at( g_listings, i, NULL );
+		if ( listing != NULL && ( oldest == NULL || listing->used < oldest->used ) )
+		{
+			oldest = listing;
+			path = mlt_properties_get_name( g_listings, i );
+		}
+	}
+	if ( path != NULL )
+	{
+		path = strdup( path );
+		drop_listing( path );
+		free( path );
+	}
+
+	return path == NULL;
+}
+
+/** Rebuild the tables once dropped listings and finished reads have left
+    more empty names than live ones - must be called with the mutex held.
+
+    A dropped name keeps its place in mlt_properties, so a server listing
+    many directories over time would otherwise grow the tables for ever.
+*/
+
+static void compact_tables( void )
+{
+	mlt_properties table;
+	int i;
+
+	if ( g_listings == NULL || mlt_properties_count( g_listings ) + mlt_properties_count( g_watches ) + mlt_properties_count( g_pending ) <= 4 * g_cached + 64 )
+		return;
+
+	table = mlt_properties_new( );
+	for ( i = 0; i < mlt_properties_count( g_listings ); i ++ )
+	{
+		dir_listing listing = mlt_properties_get_data_at( g_listings, i, NULL );
+		if ( listing != NULL )
+		{
+			// The old table releases its own reference when closed
+			__sync_fetch_and_add( &listing->refs, 1 );
+			mlt_properties_set_data( table, mlt_properties_get_name( g_listings, i ), listing, 0, ( mlt_destructor )release_listing, NULL );
+		}
+	}
+	mlt_properties_close( g_listings );
+	g_listings = table;
+
+	table = mlt_properties_new( );
+	for ( i = 0; i < mlt_properties_count( g_watches ); i ++ )
+		if ( mlt_properties_get_value( g_watches, i ) != NULL )
+			mlt_properties_set( table, mlt_properties_get_name( g_watches, i ), mlt_properties_get_value( g_watches, i ) );
+	mlt_properties_close( g_watches );
+	g_watches = table;
+
+	// Each reader frees its own entry when done, none are owned here
+	table = mlt_properties_new( );
+	for ( i = 0; i < mlt_properties_count( g_pending ); i ++ )
+		if ( mlt_properties_get_data_at( g_pending, i, NULL ) != NULL )
+			mlt_properties_set_data( table, mlt_properties_get_name( g_pending, i ), mlt_properties_get_data_at( g_pending, i, NULL ), 0, NULL, NULL );
+	mlt_properties_close( g_pending );
+	g_pending = table;
+}
+
+/** Drop every cached listing - must be called with the mutex held.
+*/
+
+static void drop_listings( void )
+{
+	int i;
+	for ( i = 0; g_listings != NULL && i < mlt_properties_count( g_listings ); i ++ )
+		if ( mlt_properties_get_data_at( g_listings, i, NULL ) != NULL )
+			drop_listing( mlt_properties_get_name( g_listings, i ) );
+}
+
+#ifdef __linux__
+
+/** The watching thread - drops the listings of changed directories.
+*/
+
+static void *watch_worker( void *arg )
+{
+	char buffer[ 16384 ] __attribute__ ( ( aligned( __alignof__( struct inotify_event ) ) ) );
+
+	while ( g_running )
+	{
+		struct pollfd fds = { g_fd, POLLIN, 0 };
+		ssize_t length;
+		char *p;
+
+		if ( poll( &fds, 1, 500 ) <= 0 || ( length = read( g_fd, buffer, sizeof( buffer ) ) ) <= 0 )
+			continue;
+
+		pthread_mutex_lock( &g_dirs_mutex );
+		for ( p = buffer; p < buffer + length; p += sizeof( struct inotify_event ) + ( ( struct inotify_event * )p )->len )
+		{
+			struct inotify_event *event = ( struct inotify_event * )p;
+			char key[ 32 ];
+			char *path;
+			snprintf( key, sizeof( key ), "%d", event->wd );
+			path = mlt_properties_get( g_watches, key );
+			if ( path != NULL )
+			{
+				path = strdup( path );
+				drop_listing( path );
+				free( path );
+			}
+		}
+		compact_tables( );
+		pthread_mutex_unlock( &g_dirs_mutex );
+	}
+
+	return NULL;
+}
+
+#endif
+
+/** Set the number of directory listings kept - 0 disables the cache.
+*/
+
+void melted_dirs_set_size( int size )
+{
+	pthread_mutex_lock( &g_dirs_mutex );
+	g_size = size > 0 ? size : 0;
+	if ( g_listings == NULL )
+	{
+		g_listings = mlt_properties_new( );
+		g_watches = mlt_properties_new( );
+		g_pending = mlt_properties_new( );
+	}
+	while ( g_cached > g_size && evict_listing( ) == 0 )
+		;
+	compact_tables( );
+#ifdef __linux__
+	if ( g_size > 0 && !g_running )
+	{
+		g_fd = inotify_init( );
+		if ( g_fd >= 0 )
+		{
+			g_running = 1;
+			pthread_create( &g_watch_thread, NULL, watch_worker, NULL );
+		}
+		else
+		{
+			melted_log( LOG_WARNING, "Unable to watch directories, listings are checked by modification time only" );
+		}
+	}
+#endif
+	pthread_mutex_unlock( &g_dirs_mutex );
+}
+
+/** Get the number of directory listings kept.
+*/
+
+int melted_dirs_get_size( void )
+{
+	return g_size;
+}
+
+/** Record a listing latency in milliseconds - must be called with the mutex
+    held.
+
+    Maintains name.last, name.count, name.mean and name.max.
+*/
+
+static void record_latency( const char *name, double value )
+{
+	char key[ 256 ];
+	int count;
+	double mean;
+
+	if ( g_stats == NULL )
+		g_stats = mlt_properties_new( );
+
+	snprintf( key, sizeof( key ), "%s.count", name );
+	count = mlt_properties_get_int( g_stats, key ) + 1;
+	mlt_properties_set_int( g_stats, key, count );
+
+	snprintf( key, sizeof( key ), "%s.mean", name );
+	mean = mlt_properties_get_double( g_stats, key );
+	mlt_properties_set_double( g_stats, key, mean + ( value - mean ) / count );
+
+	snprintf( key, sizeof( key ), "%s.max", name );
+	if ( count == 1 || value > mlt_properties_get_double( g_stats, key ) )
+		mlt_properties_set_double( g_stats, key, value );
+
+	snprintf( key, sizeof( key ), "%s.last", name );
+	mlt_properties_set_double( g_stats, key, value );
+}
+
+/** Get a listing, from the cache if it is current.
+
+    A directory read is cached in place of the least recently used
+    listing once the cache is full.
+
+    \param cold Set to 1 if the directory was read.
+*/
+
+static dir_listing get_listing( const char *path, int *cold )
+{
+	dir_listing listing;
+	dir_pending *pending = NULL;
+	struct stat info;
+	int generation = 0;
+	int wd = -1;
+	char key[ 32 ];
+
+	*cold = 0;
+	pthread_mutex_lock( &g_dirs_mutex );
+	listing = g_listings != NULL ? mlt_properties_get_data( g_listings, path, NULL ) : NULL;
+	if ( listing != NULL )
+	{
+		// Changes made by other hosts on network storage are not reported
+		if ( stat( path, &info ) != 0 || info.st_mtime != listing->mtime || info.st_ctime != listing->ctime )
+			drop_listing( path );
+		else
+			__sync_fetch_and_add( &listing->refs, 1 );
+		listing = mlt_properties_get_data( g_listings, path, NULL );
+		if ( listing != NULL )
+			listing->used = ++ g_clock;
+	}
+	if ( listing == NULL && g_size > 0 )
+	{
+		pending = mlt_properties_get_data( g_pending, path, NULL );
+		if ( pending == NULL && ( pending = calloc( 1, sizeof( dir_pending ) ) ) != NULL )
+			mlt_properties_set_data( g_pending, path, pending, 0, NULL, NULL );
+		if ( pending != NULL )
+		{
+			pending->readers ++;
+			generation = pending->generation;
+		}
+#ifdef __linux__
+		// Watch before reading so that no change is missed
+		if ( pending != NULL && g_fd >= 0 && ( wd = inotify_add_watch( g_fd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+			IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF ) ) >= 0 )
+		{
+			snprintf( key, sizeof( key ), "%d", wd );
+			mlt_properties_set( g_watches, key, path );
+		}
+#endif
+	}
+	pthread_mutex_unlock( &g_dirs_mutex );
+
+	if ( listing != NULL )
+		return listing;
+
+	*cold = 1;
+	listing = read_listing( path );
+
+	if ( pending != NULL )
+	{
+		pthread_mutex_lock( &g_dirs_mutex );
+		if ( listing != NULL && g_size > 0 && mlt_properties_get_data( g_listings, path, NULL ) == NULL &&
+			 pending->generation == generation )
+		{
+			while ( g_cached >= g_size && evict_listing( ) == 0 )
+				;
+			listing->wd = wd;
+			listing->used = ++ g_clock;
+			__sync_fetch_and_add( &listing->refs, 1 );
+			mlt_properties_set_data( g_listings, path, listing, 0, ( mlt_destructor )release_listing, NULL );
+			g_cached ++;
+		}
+#ifdef __linux__
+		else if ( wd >= 0 )
+		{
+			// A concurrent read of the same directory may have cached it under the same watch
+			dir_listing cached = mlt_properties_get_data( g_listings, path, NULL );
+			snprintf( key, sizeof( key ), "%d", wd );
+			if ( ( cached == NULL || cached->wd != wd ) &&
+				 mlt_properties_get( g_watches, key ) != NULL && !strcmp( mlt_properties_get( g_watches, key ), path ) )
+			{
+				inotify_rm_watch( g_fd, wd );
+				mlt_properties_set( g_watches, key, NULL );
+			}
+		}
+#endif
+		if ( -- pending->readers == 0 )
+		{
+			if ( mlt_properties_get_data( g_pending, path, NULL ) == pending )
+				mlt_properties_set_data( g_pending, path, NULL, 0, NULL, NULL );
+			free( pending );
+		}
+		compact_tables( );
+		pthread_mutex_unlock( &g_dirs_mutex );
+	}
+
+	return listing;
+}
+
+/** Write a listing entry to the response.
+
+    \param media Add the length and frame rate columns of MLS.
+*/
+
+static void list_entry( const char *path, dir_listing listing, dir_entry *entry, int dir, int media, mvcp_response response )
+{
+	char fullname[ PATH_MAX ];
+	melted_media_t description;
+
+	if ( dir )
+	{
+		mvcp_response_printf( response, 1024, "\"%s/\"\n", entry->name );
+	}
+	else if ( !media )
+	{
+		mvcp_response_printf( response, 1024, "\"%s\" %llu\n", entry->name, entry->size );
+	}
+	else if ( melted_media_path( ) == NULL )
+	{
+		mvcp_response_printf( response, 1024, "\"%s\" %llu 0 0\n", entry->name, entry->size );
+	}
+	else
+	{
+		int described, length = 0;
+		double fps = 0;
+
+		pthread_mutex_lock( &g_dirs_mutex );
+		described = entry->media;
+		if ( described )
+		{
+			length = entry->length;
+			fps = entry->fps;
+		}
+		pthread_mutex_unlock( &g_dirs_mutex );
+
+		if ( !described )
+		{
+			int error;
+			// Links are resolved and looked at again, plain files are not
+			if ( !entry->link && listing->resolved != NULL )
+			{
+				snprintf( fullname, sizeof( fullname ), "%s/%s", listing->resolved, entry->name );
+				error = melted_media_lookup_resolved( fullname, entry->size, entry->mtime, &description );
+			}
+			else
+			{
+				snprintf( fullname, sizeof( fullname ), "%s/%s", path, entry->name );
+				error = melted_media_lookup( fullname, &description );
+			}
+			if ( error == 0 && description.profile_den > 0 )
+			{
+				length = description.length;
+				fps = ( double )description.profile_num / description.profile_den;
+				described = 1;
+				pthread_mutex_lock( &g_dirs_mutex );
+				entry->length = length;
+				entry->fps = fps;
+				entry->media = 1;
+				pthread_mutex_unlock( &g_dirs_mutex );
+			}
+			else
+			{
+				/* describe the file in the background for the next listing */
+				snprintf( fullname, sizeof( fullname ), "%s/%s", path, entry->name );
+				melted_media_request( fullname );
+			}
+		}
+		if ( described )
+			mvcp_response_printf( response, 1024, "\"%s\" %llu %d %.3f\n", entry->name, entry->size, length, fps );
+		else
+			mvcp_response_printf( response, 1024, "\"%s\" %llu 0 0\n", entry->name, entry->size );
+	}
+}
+
+/** List a directory, subdirectories first.
+
+    \param prefix Only list the names starting with it, or NULL for all.
+    \param offset The number of matching entries to skip.
+    \param count The number of entries to list or -1 for all.
+    \param media List the length and frame rate of each file as MLS does.
+    \return 0 on success or 1 if the directory can not be read.
+*/
+
+int melted_dirs_list( const char *path, const char *prefix, int offset, int count, int media, mvcp_response response )
+{
+	struct timeval start, end;
+	dir_listing listing;
+	size_t length = prefix != NULL ? strlen( prefix ) : 0;
+	int cold;
+	int pass, i;
+
+	gettimeofday( &start, NULL );
+	listing = get_listing( path, &cold );
+	if ( listing == NULL )
+		return 1;
+
+	for ( pass = 1; pass >= 0; pass -- )
+	{
+		for ( i = 0; i < listing->count && count != 0; i ++ )
+		{
+			dir_entry *entry = &listing->entries[ i ];
+			if ( !( pass ? entry->dir : entry->file ) || ( length > 0 && strncmp( entry->name, prefix, length ) ) )
+				continue;
+			if ( offset > 0 )
+			{
+				offset --;
+				continue;
+			}
+			list_entry( path, listing, entry, pass, media, response );
+			if ( count > 0 )
+				count --;
+		}
+	}
+	release_listing( listing );
+
+	gettimeofday( &end, NULL );
+	pthread_mutex_lock( &g_dirs_mutex );
+	record_latency( cold ? "cls.cold" : "cls.warm", ( end.tv_sec - start.tv_sec ) * 1000.0 + ( end.tv_usec - start.tv_usec ) / 1000.0 );
+	pthread_mutex_unlock( &g_dirs_mutex );
+
+	return 0;
+}
+
+/** Report the number of cached listings and the listing latencies.
+*/
+
+void melted_dirs_report( mvcp_response response )
+{
+	int i;
+
+	pthread_mutex_lock( &g_dirs_mutex );
+	if ( g_size > 0 )
+		mvcp_response_printf( response, 1024, "dirs.size=%d\n", g_cached );
+	for ( i = 0; g_stats != NULL && i < mlt_properties_count( g_stats ); i ++ )
+		mvcp_response_printf( response, 1024, "%s=%s\n", mlt_properties_get_name( g_stats, i ), mlt_properties_get_value( g_stats, i ) );
+	pthread_mutex_unlock( &g_dirs_mutex );
+}
+
+/** Stop watching and drop every listing.
+*/
+
+void melted_dirs_close( void )
+{
+	int running;
+
+	pthread_mutex_lock( &g_dirs_mutex );
+	running = g_running;
+	g_running = 0;
+	pthread_mutex_unlock( &g_dirs_mutex );
+
+	if ( running )
+		pthread_join( g_watch_thread, NULL );
+
+	pthread_mutex_lock( &g_dirs_mutex );
+	drop_listings( );
+	if ( g_fd >= 0 )
+		close( g_fd );
+	g_fd = -1;
+	g_size = 0;
+	mlt_properties_close( g_listings );
+	mlt_properties_close( g_watches );
+	mlt_properties_close( g_pending );
+	mlt_properties_close( g_stats );
+	g_listings = g_watches = g_pending = g_stats = NULL;
+	pthread_mutex_unlock( &g_dirs_mutex );
+}
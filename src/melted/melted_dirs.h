@@ -0,0 +1,49 @@
+/*
+ * melted_dirs.h -- Cached Directory Listings
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_DIRS_H_
+#define _MELTED_DIRS_H_
+
+/* Application header files */
+#include <mvcp/mvcp_response.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Directory listing API.
+
+    The listings served to CLS and MLS are kept in memory, up to a number of
+    directories, and dropped as soon as inotify reports a change or the
+    directory's modification time moves.
+*/
+
+extern void melted_dirs_set_size( int size );
+extern int melted_dirs_get_size( void );
+extern int melted_dirs_list( const char *path, const char *prefix, int offset, int count, int media, mvcp_response response );
+extern void melted_dirs_report( mvcp_response response );
+extern void melted_dirs_close( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
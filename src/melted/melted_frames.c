@@ -0,0 +1,849 @@
+/*
+ * melted_frames.c -- Shared Decoded Frame Cache
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_frames.h"
+#include "melted_log.h"
+
+/** Number of hash buckets.
+*/
+
+#define FRAME_BUCKETS 4096
+
+/** Bytes of primed frames kept for each unit.
+*/
+
+#define PRIME_BUDGET ( ( int64_t )256 << 20 )
+
+/** A cached image.
+*/
+
+typedef struct frame_entry_s
+{
+	struct frame_entry_s *newer;
+	struct frame_entry_s *older;
+	struct frame_entry_s *bucket;
+	char *key;
+	uint8_t *image;
+	int size;
+	mlt_image_format format;
+	int width;
+	int height;
+	int progressive;
+	int top_field_first;
+	int batch;
+}
+frame_entry;
+
+/** A set of cached images with its own budget, evicted least recently
+    used first.
+*/
+
+typedef struct
+{
+	frame_entry *buckets[ FRAME_BUCKETS ];
+	frame_entry *newest;
+	frame_entry *oldest;
+	int64_t budget;
+	int64_t bytes;
+	int count;
+}
+frame_store;
+
+/** The counters, the ring, the primed frames and the last requested image
+    of a unit.
+*/
+
+typedef struct
+{
+	int64_t hits;
+	int64_t misses;
+	frame_store *ring;
+	frame_store *primed;
+	int batch;
+	mlt_image_format format;
+	int width;
+	int height;
+}
+frame_unit;
+
+static pthread_mutex_t g_frames_mutex = PTHREAD_MUTEX_INITIALIZER;
+static frame_store g_shared;
+static frame_unit *g_units = NULL;
+static int g_unit_count = 0;
+
+/** Number of enabled stores - the shared cache, the rings and the primed
+    frames. Changed with the mutex held but read without it, so frames go
+    through untouched while nothing is cached.
+*/
+
+static int g_stores = 0;
+
+/** Hash a key.
+*/
+
+static unsigned int hash_key( const char *key )
+{
+	unsigned int hash = 2166136261u;
+	while ( *key )
+		hash = ( hash ^ ( unsigned char )*key ++ ) * 16777619u;
+	return hash % FRAME_BUCKETS;
+}
+
+/** Free an entry which is not in a store.
+*/
+
+static void free_entry( frame_entry *entry )
+{
+	free( entry->image );
+	free( entry->key );
+	free( entry );
+}
+
+/** Find an entry - must be called with the mutex held.
+*/
+
+static frame_entry *find_entry( frame_store *store, const char *key )
+{
+	frame_entry *entry = store->buckets[ hash_key( key ) ];
+	while ( entry != NULL && strcmp( entry->key, key ) )
+		entry = entry->bucket;
+	return entry;
+}
+
+/** Unlink an entry from the recency list - must be called with the mutex held.
+*/
+
+static void unlink_entry( frame_store *store, frame_entry *entry )
+{
+	if ( entry->newer != NULL )
+		entry->newer->older = entry->older;
+	else
+		store->newest = entry->older;
+	if ( entry->older != NULL )
+		entry->older->newer = entry->newer;
+	else
+		store->oldest = entry->newer;
+	entry->newer = entry->older = NULL;
+}
+
+/** Make an entry the most recently used - must be called with the mutex held.
+*/
+
+static void touch_entry( frame_store *store, frame_entry *entry )
+{
+	if ( entry != store->newest )
+	{
+		if ( entry->older != NULL || entry->newer != NULL || entry == store->oldest )
+			unlink_entry( store, entry );
+		entry->older = store->newest;
+		if ( store->newest != NULL )
+			store->newest->newer = entry;
+		store->newest = entry;
+		if ( store->oldest == NULL )
+			store->oldest = entry;
+	}
+}
+
+/** Remove and free an entry - must be called with the mutex held.
+*/
+
+static void remove_entry( frame_store *store, frame_entry *entry )
+{
+	frame_entry **link = &store->buckets[ hash_key( entry->key ) ];
+	while ( *link != entry )
+		link = &( *link )->bucket;
+	*link = entry->bucket;
+	unlink_entry( store, entry );
+	store->bytes -= entry->size;
+	store->count --;
+	free_entry( entry );
+}
+
+/** Evict the least recently used entries until the store fits its budget -
+    must be called with the mutex held.
+*/
+
+static void evict_entries( frame_store *store )
+{
+	while ( store->oldest != NULL && store->bytes > store->budget )
+		remove_entry( store, store->oldest );
+}
+
+/** Get the slot of a unit, growing the table as needed - must be called
+    with the mutex held.
+*/
+
+static frame_unit *get_unit( int unit )
+{
+	if ( unit < 0 )
+		return NULL;
+	if ( unit >= g_unit_count )
+	{
+		frame_unit *units = realloc( g_units, ( unit + 1 ) * sizeof( frame_unit ) );
+		if ( units == NULL )
+			return NULL;
+		memset( units + g_unit_count, 0, ( unit + 1 - g_unit_count ) * sizeof( frame_unit ) );
+		g_units = units;
+		g_unit_count = unit + 1;
+	}
+	return &g_units[ unit ];
+}
+
+/** Copy an entry's image to a frame.
+*/
+
+static int copy_entry( frame_entry *entry, mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height )
+{
+	uint8_t *copy = mlt_pool_alloc( entry->size );
+
+	if ( copy != NULL )
+	{
+		mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+		memcpy( copy, entry->image, entry->size );
+		mlt_frame_set_image( frame, copy, entry->size, ( mlt_destructor )mlt_pool_release );
+		mlt_properties_set_int( properties, "progressive", entry->progressive );
+		mlt_properties_set_int( properties, "top_field_first", entry->top_field_first );
+		*image = copy;
+		*format = entry->format;
+		*width = entry->width;
+		*height = entry->height;
+	}
+
+	return copy == NULL;
+}
+
+/** Copy a cached image to a frame, from the unit's primed frames, its
+    ring or the shared cache, and remember what the unit asked for.
+
+    Primed frames are looked up by their own key, which leaves out the
+    image format: a frame primed before the unit first asked for an image
+    is decoded as yuv422 and converted by mlt_frame_get_image if the
+    consumer wants another format.
+
+    \return 0 if the image was found.
+*/
+
+static int fetch_image( const char *key, const char *primed, int unit, mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height )
+{
+	frame_unit *slot;
+	frame_entry *entry = NULL;
+	frame_store *store = NULL;
+	int error = 1;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	slot = get_unit( unit );
+	if ( slot != NULL )
+	{
+		slot->format = *format;
+		slot->width = *width;
+		slot->height = *height;
+		if ( slot->primed != NULL && ( entry = find_entry( slot->primed, primed ) ) != NULL )
+			store = slot->primed;
+		else if ( slot->ring != NULL && ( entry = find_entry( slot->ring, key ) ) != NULL )
+			store = slot->ring;
+	}
+	if ( entry == NULL && g_shared.budget > 0 && ( entry = find_entry( &g_shared, key ) ) != NULL )
+		store = &g_shared;
+	if ( entry != NULL && ( error = copy_entry( entry, frame, image, format, width, height ) ) == 0 )
+	{
+		// A primed frame is handed over once
+		if ( slot != NULL && store == slot->primed )
+			remove_entry( store, entry );
+		else
+			touch_entry( store, entry );
+	}
+	if ( slot != NULL )
+	{
+		if ( error )
+			slot->misses ++;
+		else
+			slot->hits ++;
+	}
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	return error;
+}
+
+/** Make a copy of an image to cache.
+*/
+
+static frame_entry *copy_image( const char *key, uint8_t *image, mlt_image_format format, int width, int height, int progressive, int top_field_first )
+{
+	int size = mlt_image_format_size( format, width, height, NULL );
+	frame_entry *entry = size > 0 ? calloc( 1, sizeof( frame_entry ) ) : NULL;
+
+	if ( entry != NULL )
+	{
+		entry->image = malloc( size );
+		entry->key = strdup( key );
+		if ( entry->image == NULL || entry->key == NULL )
+		{
+			free_entry( entry );
+			return NULL;
+		}
+		memcpy( entry->image, image, size );
+		entry->size = size;
+		entry->format = format;
+		entry->width = width;
+		entry->height = height;
+		entry->progressive = progressive;
+		entry->top_field_first = top_field_first;
+	}
+
+	return entry;
+}
+
+/** Add an entry to a store unless it has the key already - must be called
+    with the mutex held.
+
+    \return 0 if the store took the entry.
+*/
+
+static int insert_entry( frame_store *store, frame_entry *entry )
+{
+	unsigned int bucket;
+
+	// An image that would flush most of the store is not worth keeping
+	if ( store->budget <= 0 || entry->size > store->budget / 4 || find_entry( store, entry->key ) != NULL )
+		return 1;
+
+	bucket = hash_key( entry->key );
+	entry->bucket = store->buckets[ bucket ];
+	store->buckets[ bucket ] = entry;
+	touch_entry( store, entry );
+	store->bytes += entry->size;
+	store->count ++;
+	evict_entries( store );
+
+	return 0;
+}
+
+/** Add a decoded image to the shared cache and to the unit's ring.
+
+    The copies are made off lock, so the stores are checked again when
+    the copies are inserted.
+*/
+
+static void store_image( const char *key, int unit, mlt_frame frame, uint8_t *image, mlt_image_format format, int width, int height )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int progressive = mlt_properties_get_int( properties, "progressive" );
+	int top_field_first = mlt_properties_get_int( properties, "top_field_first" );
+	frame_entry *shared = NULL;
+	frame_entry *ring = NULL;
+	frame_unit *slot;
+	int want_shared;
+	int want_ring;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	want_shared = g_shared.budget > 0;
+	want_ring = unit >= 0 && unit < g_unit_count && g_units[ unit ].ring != NULL;
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	if ( want_shared )
+		shared = copy_image( key, image, format, width, height, progressive, top_field_first );
+	if ( want_ring )
+		ring = copy_image( key, image, format, width, height, progressive, top_field_first );
+	if ( shared == NULL && ring == NULL )
+		return;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	if ( shared != NULL && insert_entry( &g_shared, shared ) == 0 )
+		shared = NULL;
+	slot = get_unit( unit );
+	if ( ring != NULL && slot != NULL && slot->ring != NULL && insert_entry( slot->ring, ring ) == 0 )
+		ring = NULL;
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	if ( shared != NULL )
+		free_entry( shared );
+	if ( ring != NULL )
+		free_entry( ring );
+}
+
+/** Build the cache key of an image.
+*/
+
+static void image_key( char *key, size_t size, const char *resource, mlt_position position, mlt_image_format format, int width, int height )
+{
+	snprintf( key, size, "%s|%d|%d|%dx%d", resource, ( int )position, format, width, height );
+}
+
+/** Build the key of a primed image, which matches any image format.
+*/
+
+static void primed_key( char *key, size_t size, const char *resource, mlt_position position, int width, int height )
+{
+	snprintf( key, size, "%s|%d|primed|%dx%d", resource, ( int )position, width, height );
+}
+
+/** Get the image of a frame, from the cache if it was decoded before.
+*/
+
+static int frames_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	mlt_filter filter = mlt_frame_pop_service( frame );
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	int unit = mlt_properties_get_int( properties, "unit" );
+	mlt_position position = mlt_properties_get_position( MLT_FRAME_PROPERTIES( frame ), "melted.frame_position" );
+	char key[ 4096 ];
+	char primed[ 4096 ];
+	int error;
+
+	image_key( key, sizeof( key ), mlt_properties_get( properties, "resource" ), position, *format, *width, *height );
+	primed_key( primed, sizeof( primed ), mlt_properties_get( properties, "resource" ), position, *width, *height );
+
+	if ( fetch_image( key, primed, unit, frame, image, format, width, height ) == 0 )
+		return 0;
+
+	error = mlt_frame_get_image( frame, image, format, width, height, writable );
+	if ( error == 0 && *image != NULL )
+		store_image( key, unit, frame, *image, *format, *width, *height );
+
+	return error;
+}
+
+/** Filter process - looks the image up before the producer decodes it.
+*/
+
+static mlt_frame frames_process( mlt_filter filter, mlt_frame frame )
+{
+	int unit = mlt_properties_get_int( MLT_FILTER_PROPERTIES( filter ), "unit" );
+	int enabled;
+
+	if ( __sync_fetch_and_add( &g_stores, 0 ) == 0 )
+		return frame;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	enabled = g_shared.budget > 0 || ( unit >= 0 && unit < g_unit_count && ( g_units[ unit ].ring != NULL || g_units[ unit ].primed != NULL ) );
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	if ( enabled )
+	{
+		mlt_properties_set_position( MLT_FRAME_PROPERTIES( frame ), "melted.frame_position", mlt_frame_get_position( frame ) );
+		mlt_frame_push_service( frame, filter );
+		mlt_frame_push_get_image( frame, frames_get_image );
+	}
+	return frame;
+}
+
+/** Set the memory budget of the shared cache in bytes - 0 disables it.
+*/
+
+void melted_frames_set_budget( int64_t bytes )
+{
+	pthread_mutex_lock( &g_frames_mutex );
+	if ( ( bytes > 0 ) != ( g_shared.budget > 0 ) )
+		__sync_add_and_fetch( &g_stores, bytes > 0 ? 1 : -1 );
+	g_shared.budget = bytes > 0 ? bytes : 0;
+	evict_entries( &g_shared );
+	pthread_mutex_unlock( &g_frames_mutex );
+	melted_log( LOG_NOTICE, "frame cache budget %lld MB", ( long long )( bytes >> 20 ) );
+}
+
+/** Get the memory budget of the shared cache in bytes.
+*/
+
+int64_t melted_frames_get_budget( void )
+{
+	int64_t budget;
+	pthread_mutex_lock( &g_frames_mutex );
+	budget = g_shared.budget;
+	pthread_mutex_unlock( &g_frames_mutex );
+	return budget;
+}
+
+/** Set the memory budget of a unit's ring in bytes - 0 removes the ring.
+*/
+
+void melted_frames_set_ring( int unit, int64_t bytes )
+{
+	frame_store *ring = NULL;
+	frame_unit *slot;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	slot = get_unit( unit );
+	if ( slot != NULL )
+	{
+		if ( bytes > 0 && slot->ring == NULL && ( slot->ring = calloc( 1, sizeof( frame_store ) ) ) != NULL )
+			__sync_add_and_fetch( &g_stores, 1 );
+		if ( slot->ring != NULL )
+		{
+			slot->ring->budget = bytes > 0 ? bytes : 0;
+			evict_entries( slot->ring );
+			if ( bytes <= 0 )
+			{
+				ring = slot->ring;
+				slot->ring = NULL;
+				__sync_sub_and_fetch( &g_stores, 1 );
+			}
+		}
+	}
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	free( ring );
+}
+
+/** Get the store a batch of decoded images goes to - must be called with
+    the mutex held.
+
+    Batch 0 is the unit's ring, any other the unit's primed frames.
+*/
+
+static frame_store *batch_store( int unit, int batch )
+{
+	frame_unit *slot = get_unit( unit );
+	if ( slot == NULL )
+		return NULL;
+	return batch == 0 ? slot->ring : slot->primed;
+}
+
+/** Decode frames of a producer into one of a unit's stores, skipping those
+    it holds already.
+
+    Primed frames stop once they would push out a frame of the same batch:
+    only frames of earlier batches make way for them.
+
+    \return The number of frames decoded.
+*/
+
+static int decode_images( int unit, int batch, mlt_producer producer, const char *resource, mlt_position position, int count, mlt_image_format format, int width, int height )
+{
+	frame_store *store;
+	int decoded = 0;
+	int full = 0;
+	char key[ 4096 ];
+
+	for ( ; count > 0 && !full; count --, position ++ )
+	{
+		mlt_frame frame = NULL;
+		mlt_image_format actual = format;
+		int actual_width = width;
+		int actual_height = height;
+		uint8_t *image = NULL;
+		int present;
+
+		if ( batch == 0 )
+			image_key( key, sizeof( key ), resource, position, format, width, height );
+		else
+			primed_key( key, sizeof( key ), resource, position, width, height );
+		pthread_mutex_lock( &g_frames_mutex );
+		store = batch_store( unit, batch );
+		present = store == NULL || find_entry( store, key ) != NULL;
+		pthread_mutex_unlock( &g_frames_mutex );
+		if ( present )
+			continue;
+
+		mlt_producer_seek( producer, position );
+		if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &frame, 0 ) == 0 && frame != NULL )
+		{
+			if ( mlt_frame_get_image( frame, &image, &actual, &actual_width, &actual_height, 0 ) == 0 && image != NULL )
+			{
+				mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+				frame_entry *entry = copy_image( key, image, actual, actual_width, actual_height,
+					mlt_properties_get_int( properties, "progressive" ), mlt_properties_get_int( properties, "top_field_first" ) );
+				pthread_mutex_lock( &g_frames_mutex );
+				store = batch_store( unit, batch );
+				if ( entry != NULL )
+					entry->batch = batch;
+				if ( entry != NULL && store != NULL && batch != 0 )
+				{
+					while ( store->oldest != NULL && store->oldest->batch != batch && store->bytes + entry->size > store->budget )
+						remove_entry( store, store->oldest );
+					full = store->bytes + entry->size > store->budget;
+				}
+				if ( entry != NULL && store != NULL && !full && insert_entry( store, entry ) == 0 )
+					entry = NULL;
+				pthread_mutex_unlock( &g_frames_mutex );
+				if ( entry != NULL )
+					free_entry( entry );
+				decoded ++;
+			}
+			mlt_frame_close( frame );
+		}
+	}
+
+	return decoded;
+}
+
+/** Decode frames of a producer into a unit's ring.
+
+    The frames from position on are decoded in order, which a long GOP
+    decoder does far quicker than the same frames in reverse, at the format
+    and size the unit last asked for. Frames already in the ring are
+    skipped.
+
+    \return The number of frames decoded.
+*/
+
+int melted_frames_fill( int unit, mlt_producer producer, const char *resource, mlt_position position, int count )
+{
+	mlt_image_format format = mlt_image_yuv422;
+	int width = 0;
+	int height = 0;
+	frame_unit *slot;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	slot = get_unit( unit );
+	if ( slot == NULL || slot->ring == NULL || slot->width <= 0 )
+		count = 0;
+	else
+		format = slot->format, width = slot->width, height = slot->height;
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	return decode_images( unit, 0, producer, resource, position, count, format, width, height );
+}
+
+/** Decode the frames a unit is about to play and keep them for it.
+
+    Each primed frame is handed to the unit's playlist once and only the
+    frames of the last two calls are kept, so a cue followed by the
+    preparation of the next clip both stay available, within PRIME_BUDGET
+    bytes. Until the unit has asked for an image the frames are decoded as
+    yuv422 at the profile size. The producer must not be read by the
+    playlist while it is primed.
+
+    \return The number of frames decoded.
+*/
+
+int melted_frames_prime( int unit, mlt_producer producer, const char *resource, mlt_position position, int count )
+{
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) );
+	mlt_image_format format = mlt_image_yuv422;
+	int width = profile != NULL ? profile->width : 0;
+	int height = profile != NULL ? profile->height : 0;
+	frame_entry *entry;
+	frame_entry *newer;
+	frame_unit *slot;
+	int batch = 0;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	slot = get_unit( unit );
+	if ( slot != NULL && slot->primed == NULL && ( slot->primed = calloc( 1, sizeof( frame_store ) ) ) != NULL )
+		__sync_add_and_fetch( &g_stores, 1 );
+	if ( slot == NULL || slot->primed == NULL )
+	{
+		count = 0;
+	}
+	else
+	{
+		batch = ++ slot->batch;
+		slot->primed->budget = PRIME_BUDGET;
+		for ( entry = slot->primed->oldest; entry != NULL; entry = newer )
+		{
+			newer = entry->newer;
+			if ( entry->batch < batch - 1 )
+				remove_entry( slot->primed, entry );
+		}
+		if ( slot->width > 0 )
+			format = slot->format, width = slot->width, height = slot->height;
+	}
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	return width > 0 ? decode_images( unit, batch, producer, resource, position, count, format, width, height ) : 0;
+}
+
+/** Drop the primed frames of a unit.
+*/
+
+void melted_frames_unprime( int unit )
+{
+	frame_store *primed = NULL;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	if ( unit >= 0 && unit < g_unit_count && g_units[ unit ].primed != NULL )
+	{
+		primed = g_units[ unit ].primed;
+		g_units[ unit ].primed = NULL;
+		__sync_sub_and_fetch( &g_stores, 1 );
+		primed->budget = 0;
+		evict_entries( primed );
+	}
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	free( primed );
+}
+
+/** Make a newly opened producer share its decoded images through the
+    cache and the unit's ring.
+
+    The images are only looked up while the cache, the ring or primed
+    frames are enabled; otherwise each frame only costs an atomic read.
+*/
+
+void melted_frames_attach( mlt_producer producer, const char *resource, int unit )
+{
+	mlt_filter filter;
+
+	if ( resource == NULL || ( filter = mlt_filter_new( ) ) == NULL )
+		return;
+
+	filter->process = frames_process;
+	mlt_properties_set( MLT_FILTER_PROPERTIES( filter ), "resource", resource );
+	mlt_properties_set_int( MLT_FILTER_PROPERTIES( filter ), "unit", unit );
+	mlt_producer_attach( producer, filter );
+	mlt_filter_close( filter );
+}
+
+/** Report the server wide cache counters.
+*/
+
+void melted_frames_report( mvcp_response response )
+{
+	int64_t hits = 0;
+	int64_t misses = 0;
+	int i;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	for ( i = 0; i < g_unit_count; i ++ )
+	{
+		hits += g_units[ i ].hits;
+		misses += g_units[ i ].misses;
+	}
+	mvcp_response_printf( response, 1024, "frames.budget=%lld\n", ( long long )g_shared.budget );
+	mvcp_response_printf( response, 1024, "frames.bytes=%lld\n", ( long long )g_shared.bytes );
+	mvcp_response_printf( response, 1024, "frames.size=%d\n", g_shared.count );
+	mvcp_response_printf( response, 1024, "frames.hits=%lld\n", ( long long )hits );
+	mvcp_response_printf( response, 1024, "frames.misses=%lld\n", ( long long )misses );
+	if ( hits + misses > 0 )
+		mvcp_response_printf( response, 1024, "frames.hit_rate=%.2f\n", ( double )hits / ( hits + misses ) );
+	pthread_mutex_unlock( &g_frames_mutex );
+}
+
+/** Report the cache counters and the ring of a unit.
+*/
+
+void melted_frames_report_unit( int unit, mvcp_response response )
+{
+	pthread_mutex_lock( &g_frames_mutex );
+	if ( unit >= 0 && unit < g_unit_count )
+	{
+		frame_unit *slot = &g_units[ unit ];
+		if ( slot->hits + slot->misses > 0 )
+		{
+			mvcp_response_printf( response, 1024, "frames.hits=%lld\n", ( long long )slot->hits );
+			mvcp_response_printf( response, 1024, "frames.misses=%lld\n", ( long long )slot->misses );
+			mvcp_response_printf( response, 1024, "frames.hit_rate=%.2f\n", ( double )slot->hits / ( slot->hits + slot->misses ) );
+		}
+		if ( slot->ring != NULL )
+		{
+			mvcp_response_printf( response, 1024, "ring.bytes=%lld\n", ( long long )slot->ring->bytes );
+			mvcp_response_printf( response, 1024, "ring.size=%d\n", slot->ring->count );
+		}
+	}
+	pthread_mutex_unlock( &g_frames_mutex );
+}
+
+/** Get the bytes of images held for a unit alone, in its ring and its
+    primed frames.
+*/
+
+int64_t melted_frames_unit_bytes( int unit )
+{
+	int64_t bytes = 0;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	if ( unit >= 0 && unit < g_unit_count )
+	{
+		if ( g_units[ unit ].ring != NULL )
+			bytes += g_units[ unit ].ring->bytes;
+		if ( g_units[ unit ].primed != NULL )
+			bytes += g_units[ unit ].primed->bytes;
+	}
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	return bytes;
+}
+
+/** Forget a deleted unit - its ring, its primed frames and its counters -
+    so a new unit given the same number starts afresh.
+*/
+
+void melted_frames_remove_unit( int unit )
+{
+	frame_store *ring = NULL;
+	frame_store *primed = NULL;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	if ( unit >= 0 && unit < g_unit_count )
+	{
+		ring = g_units[ unit ].ring;
+		primed = g_units[ unit ].primed;
+		if ( ring != NULL )
+		{
+			ring->budget = 0;
+			evict_entries( ring );
+			__sync_sub_and_fetch( &g_stores, 1 );
+		}
+		if ( primed != NULL )
+		{
+			primed->budget = 0;
+			evict_entries( primed );
+			__sync_sub_and_fetch( &g_stores, 1 );
+		}
+		memset( &g_units[ unit ], 0, sizeof( frame_unit ) );
+	}
+	pthread_mutex_unlock( &g_frames_mutex );
+
+	free( ring );
+	free( primed );
+}
+
+/** Release every cached image.
+*/
+
+void melted_frames_close( void )
+{
+	int i;
+
+	pthread_mutex_lock( &g_frames_mutex );
+	g_shared.budget = 0;
+	evict_entries( &g_shared );
+	for ( i = 0; i < g_unit_count; i ++ )
+	{
+		if ( g_units[ i ].ring != NULL )
+		{
+			g_units[ i ].ring->budget = 0;
+			evict_entries( g_units[ i ].ring );
+			free( g_units[ i ].ring );
+		}
+		if ( g_units[ i ].primed != NULL )
+		{
+			g_units[ i ].primed->budget = 0;
+			evict_entries( g_units[ i ].primed );
+			free( g_units[ i ].primed );
+		}
+	}
+	free( g_units );
+	g_units = NULL;
+	g_unit_count = 0;
+	__sync_and_and_fetch( &g_stores, 0 );
+	pthread_mutex_unlock( &g_frames_mutex );
+}
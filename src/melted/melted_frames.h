@@ -0,0 +1,63 @@
+/*
+ * melted_frames.h -- Shared Decoded Frame Cache
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_FRAMES_H_
+#define _MELTED_FRAMES_H_
+
+/* System header files */
+#include <stdint.h>
+
+/* MLT header files */
+#include <framework/mlt_producer.h>
+
+/* Application header files */
+#include <mvcp/mvcp_response.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Frame cache API.
+
+    Decoded images are shared by every unit of the server, keyed by the
+    media file, the frame number, the image format and the size. A unit
+    may also keep its own ring of images around the playhead, and the
+    frames primed for it to play next.
+*/
+
+extern void melted_frames_set_budget( int64_t bytes );
+extern int64_t melted_frames_get_budget( void );
+extern void melted_frames_set_ring( int unit, int64_t bytes );
+extern int melted_frames_fill( int unit, mlt_producer producer, const char *resource, mlt_position position, int count );
+extern int melted_frames_prime( int unit, mlt_producer producer, const char *resource, mlt_position position, int count );
+extern void melted_frames_unprime( int unit );
+extern void melted_frames_attach( mlt_producer producer, const char *resource, int unit );
+extern void melted_frames_report( mvcp_response response );
+extern void melted_frames_report_unit( int unit, mvcp_response response );
+extern int64_t melted_frames_unit_bytes( int unit );
+extern void melted_frames_remove_unit( int unit );
+extern void melted_frames_close( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,554 @@
+/*
+ * melted_index.c -- Persistent Keyframe Index
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_index.h"
+#include "melted_log.h"
+
+/** Number of records in the index file.
+*/
+
+#define INDEX_SLOTS 65536
+
+/** Number of frames probed at the start of a file.
+*/
+
+#define INDEX_WINDOW 128
+
+/** Number of seconds the identity of a media file is trusted before it is
+    checked again.
+*/
+
+#define KEY_RECHECK 10
+
+/** Magic string at the start of the index file.
+*/
+
+#define INDEX_MAGIC "MLTKIDX1"
+
+/** Header of the index file.
+*/
+
+typedef struct
+{
+	char magic[ 8 ];
+	uint32_t slots;
+	uint32_t count;
+}
+index_header;
+
+/** The keyframe layout of a media file, identified by the hash of its path,
+    size and modification time.
+
+    A gop of 0 means no regular layout was found.
+*/
+
+typedef struct
+{
+	uint64_t key;
+	int32_t gop;
+	int32_t offset;
+}
+index_record;
+
+/** The identity of a media file and when it was last checked.
+*/
+
+typedef struct
+{
+	uint64_t key;
+	double checked;
+}
+key_entry;
+
+static pthread_mutex_t g_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_index_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_index_thread;
+static int g_running = 0;
+static char *g_path = NULL;
+static index_header *g_header = NULL;
+static size_t g_length = 0;
+static mlt_deque g_queue = NULL;
+static mlt_properties g_pending = NULL;
+static mlt_properties g_keys = NULL;
+
+static double time_seconds( void );
+
+/** Get the records following the header.
+*/
+
+static index_record *index_records( void )
+{
+	return ( index_record * )( g_header + 1 );
+}
+
+/** Hash the identity of a media file.
+
+    \return 0 if the resource is not a file.
+*/
+
+static uint64_t index_key( const char *resource )
+{
+	struct stat buf;
+	char text[ 4096 ];
+	uint64_t hash = 14695981039346656037ULL;
+	const char *p = text;
+
+	if ( resource == NULL || stat( resource, &buf ) != 0 || !S_ISREG( buf.st_mode ) )
+		return 0;
+
+	snprintf( text, sizeof( text ), "%s|%lld|%lld", resource, ( long long )buf.st_size, ( long long )buf.st_mtime );
+	while ( *p )
+		hash = ( hash ^ ( unsigned char )*p ++ ) * 1099511628211ULL;
+
+	return hash != 0 ? hash : 1;
+}
+
+/** Get the identity of a media file, only looking at the file again once
+    KEY_RECHECK seconds have passed since it was last looked at.
+
+    \return 0 if the resource is not a file.
+*/
+
+static uint64_t cached_key( const char *resource )
+{
+	double now = time_seconds( );
+	key_entry *entry = NULL;
+	uint64_t key;
+
+	if ( resource == NULL )
+		return 0;
+
+	pthread_mutex_lock( &g_index_mutex );
+	if ( g_keys != NULL && ( entry = mlt_properties_get_data( g_keys, resource, NULL ) ) != NULL && now - entry->checked < KEY_RECHECK )
+	{
+		key = entry->key;
+		pthread_mutex_unlock( &g_index_mutex );
+		return key;
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+
+	key = index_key( resource );
+
+	pthread_mutex_lock( &g_index_mutex );
+	if ( g_keys != NULL )
+	{
+		entry = mlt_properties_get_data( g_keys, resource, NULL );
+		if ( entry == NULL && ( entry = malloc( sizeof( key_entry ) ) ) != NULL )
+			mlt_properties_set_data( g_keys, resource, entry, 0, free, NULL );
+		if ( entry != NULL )
+		{
+			entry->key = key;
+			entry->checked = now;
+		}
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+
+	return key;
+}
+
+/** Find the slot of a key - must be called with the mutex held.
+
+    \return The record holding the key or the empty record where it belongs,
+    NULL if the index is full.
+*/
+
+static index_record *find_record( uint64_t key )
+{
+	index_record *records = index_records( );
+	uint32_t slot = key % g_header->slots;
+	uint32_t i;
+
+	for ( i = 0; i < g_header->slots; i ++, slot = ( slot + 1 ) % g_header->slots )
+		if ( records[ slot ].key == key || records[ slot ].key == 0 )
+			return &records[ slot ];
+
+	return NULL;
+}
+
+/** Get the time in seconds.
+*/
+
+static double time_seconds( void )
+{
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/** Find the keyframe layout of a producer.
+
+    Stepping backwards one frame at a time makes the decoder seek to the
+    preceding keyframe and decode forward for each frame, so the cost of a
+    frame rises with its distance from its keyframe and drops sharply on the
+    next one. The drops at the start of the file give the keyframes.
+*/
+
+static void probe_keyframes( mlt_producer producer, int32_t *gop, int32_t *offset )
+{
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) );
+	double cost[ INDEX_WINDOW ];
+	int keyframes[ INDEX_WINDOW ];
+	int window = mlt_producer_get_length( producer );
+	double least = 0;
+	double most = 0;
+	int count = 1;
+	int p;
+
+	*gop = 0;
+	*offset = 0;
+	if ( window > INDEX_WINDOW )
+		window = INDEX_WINDOW;
+	if ( window < 4 )
+		return;
+
+	for ( p = window - 1; p >= 0; p -- )
+	{
+		mlt_frame frame = NULL;
+		double start = time_seconds( );
+		cost[ p ] = 0;
+		mlt_producer_seek( producer, p );
+		if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &frame, 0 ) == 0 && frame != NULL )
+		{
+			mlt_image_format format = mlt_image_yuv422;
+			int width = profile->width;
+			int height = profile->height;
+			uint8_t *image = NULL;
+			mlt_frame_get_image( frame, &image, &format, &width, &height, 0 );
+			mlt_frame_close( frame );
+		}
+		cost[ p ] = time_seconds( ) - start;
+	}
+
+	// The first probe opened the decoder, so leave it out
+	for ( p = 0; p < window - 1; p ++ )
+	{
+		if ( p == 0 || cost[ p ] < least )
+			least = cost[ p ];
+		if ( p == 0 || cost[ p ] > most )
+			most = cost[ p ];
+	}
+	if ( most < least * 2 )
+	{
+		// Every frame costs the same - each one is a keyframe
+		*gop = 1;
+		return;
+	}
+
+	keyframes[ 0 ] = 0;
+	for ( p = 1; p < window - 1; p ++ )
+		if ( cost[ p ] * 1.5 < cost[ p - 1 ] )
+			keyframes[ count ++ ] = p;
+
+	// The spacing must repeat at least twice, an open GOP may make the first one differ
+	if ( count >= 3 )
+	{
+		int spacing = keyframes[ count - 1 ] - keyframes[ count - 2 ];
+		int first = count - 2;
+		while ( first > 0 && keyframes[ first ] - keyframes[ first - 1 ] == spacing )
+			first --;
+		if ( count - 1 - first >= 2 )
+		{
+			*gop = spacing;
+			*offset = keyframes[ first ];
+		}
+	}
+}
+
+/** Index one media file with a private producer.
+*/
+
+static void index_resource( mlt_profile profile, const char *resource )
+{
+	uint64_t key = index_key( resource );
+	mlt_producer producer = key != 0 ? mlt_factory_producer( profile, NULL, resource ) : NULL;
+	int32_t gop = 0;
+	int32_t offset = 0;
+
+	if ( producer == NULL )
+		return;
+
+	probe_keyframes( producer, &gop, &offset );
+	mlt_producer_close( producer );
+
+	pthread_mutex_lock( &g_index_mutex );
+	if ( g_header != NULL )
+	{
+		index_record *record = find_record( key );
+		if ( record != NULL )
+		{
+			if ( record->key == 0 )
+				g_header->count ++;
+			record->gop = gop;
+			record->offset = offset;
+			record->key = key;
+		}
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+
+	melted_log( LOG_DEBUG, "indexed %s: gop %d from %d", resource, gop, offset );
+}
+
+/** The indexing thread - works through the queue of new media files.
+*/
+
+static void *index_worker( void *arg )
+{
+	mlt_profile profile = mlt_profile_init( NULL );
+
+	pthread_mutex_lock( &g_index_mutex );
+	while ( g_running )
+	{
+		char *resource = mlt_deque_pop_front( g_queue );
+		if ( resource == NULL )
+		{
+			pthread_cond_wait( &g_index_cond, &g_index_mutex );
+			continue;
+		}
+		pthread_mutex_unlock( &g_index_mutex );
+		index_resource( profile, resource );
+		pthread_mutex_lock( &g_index_mutex );
+		mlt_properties_set( g_pending, resource, NULL );
+		free( resource );
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+
+	mlt_profile_close( profile );
+
+	return NULL;
+}
+
+/** Unmap the index file - must be called with the mutex held.
+*/
+
+static void unmap_index( void )
+{
+	if ( g_header != NULL )
+	{
+		msync( g_header, g_length, MS_ASYNC );
+		munmap( g_header, g_length );
+		g_header = NULL;
+	}
+	free( g_path );
+	g_path = NULL;
+}
+
+/** Use the given file as the keyframe index, creating it if needed - NULL
+    or an empty path disables the index.
+
+    A file which is not empty is only used if it starts with the index
+    magic, so naming some other file by mistake never overwrites it. An
+    index of another size is started afresh.
+
+    \return 0 on success.
+*/
+
+int melted_index_open( const char *path )
+{
+	size_t length = sizeof( index_header ) + INDEX_SLOTS * sizeof( index_record );
+	index_header *header = NULL;
+	index_header existing;
+	struct stat buf;
+	int fd = -1;
+
+	if ( path != NULL && *path != '\0' )
+	{
+		int fresh;
+
+		fd = open( path, O_RDWR | O_CREAT, 0644 );
+		if ( fd < 0 || fstat( fd, &buf ) != 0 )
+		{
+			melted_log( LOG_ERR, "Unable to open keyframe index %s", path );
+			if ( fd >= 0 )
+				close( fd );
+			return 1;
+		}
+		if ( buf.st_size != 0 && ( pread( fd, &existing, sizeof( existing ), 0 ) != sizeof( existing ) ||
+			 memcmp( existing.magic, INDEX_MAGIC, 8 ) ) )
+		{
+			melted_log( LOG_ERR, "%s is not a keyframe index, not using it", path );
+			close( fd );
+			return 1;
+		}
+		fresh = buf.st_size != length || existing.slots != INDEX_SLOTS;
+		if ( ( fresh && ftruncate( fd, 0 ) != 0 ) || ftruncate( fd, length ) != 0 )
+		{
+			melted_log( LOG_ERR, "Unable to open keyframe index %s", path );
+			close( fd );
+			return 1;
+		}
+		header = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+		close( fd );
+		if ( header == MAP_FAILED )
+		{
+			melted_log( LOG_ERR, "Unable to map keyframe index %s", path );
+			return 1;
+		}
+		if ( fresh )
+		{
+			memcpy( header->magic, INDEX_MAGIC, 8 );
+			header->slots = INDEX_SLOTS;
+			header->count = 0;
+		}
+	}
+
+	pthread_mutex_lock( &g_index_mutex );
+	unmap_index( );
+	if ( header != NULL )
+	{
+		g_header = header;
+		g_length = length;
+		g_path = strdup( path );
+		if ( !g_running )
+		{
+			g_queue = mlt_deque_init( );
+			g_pending = mlt_properties_new( );
+			g_keys = mlt_properties_new( );
+			g_running = 1;
+			pthread_create( &g_index_thread, NULL, index_worker, NULL );
+		}
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+
+	return 0;
+}
+
+/** Get the path of the keyframe index or NULL if it is disabled.
+*/
+
+const char *melted_index_path( void )
+{
+	return g_path;
+}
+
+/** Queue a newly probed media file for indexing unless it is known.
+*/
+
+void melted_index_request( const char *resource )
+{
+	uint64_t key;
+
+	if ( g_header == NULL || ( key = cached_key( resource ) ) == 0 )
+		return;
+
+	pthread_mutex_lock( &g_index_mutex );
+	if ( g_header != NULL && g_running && mlt_properties_get( g_pending, resource ) == NULL )
+	{
+		index_record *record = find_record( key );
+		if ( record != NULL && record->key == 0 )
+		{
+			mlt_properties_set( g_pending, resource, "1" );
+			mlt_deque_push_back( g_queue, strdup( resource ) );
+			pthread_cond_broadcast( &g_index_cond );
+		}
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+}
+
+/** Get the keyframe at or before a frame of a media file.
+
+    \return The keyframe position or the given position if it is not known.
+*/
+
+mlt_position melted_index_keyframe( const char *resource, mlt_position position )
+{
+	uint64_t key;
+	mlt_position result = position;
+
+	if ( g_header == NULL || position <= 0 || ( key = cached_key( resource ) ) == 0 )
+		return position;
+
+	pthread_mutex_lock( &g_index_mutex );
+	if ( g_header != NULL )
+	{
+		index_record *record = find_record( key );
+		if ( record != NULL && record->key == key && record->gop > 0 )
+		{
+			if ( position < record->offset )
+				result = 0;
+			else
+				result = record->offset + ( position - record->offset ) / record->gop * record->gop;
+		}
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+
+	return result;
+}
+
+/** Report the index counters.
+*/
+
+void melted_index_report( mvcp_response response )
+{
+	pthread_mutex_lock( &g_index_mutex );
+	if ( g_header != NULL )
+	{
+		mvcp_response_printf( response, 1024, "index.size=%u\n", g_header->count );
+		mvcp_response_printf( response, 1024, "index.pending=%d\n", mlt_deque_count( g_queue ) );
+	}
+	pthread_mutex_unlock( &g_index_mutex );
+}
+
+/** Stop indexing and unmap the index.
+*/
+
+void melted_index_close( void )
+{
+	char *resource;
+	int running;
+
+	pthread_mutex_lock( &g_index_mutex );
+	running = g_running;
+	g_running = 0;
+	pthread_cond_broadcast( &g_index_cond );
+	pthread_mutex_unlock( &g_index_mutex );
+
+	if ( running )
+		pthread_join( g_index_thread, NULL );
+
+	pthread_mutex_lock( &g_index_mutex );
+	unmap_index( );
+	if ( g_queue != NULL )
+	{
+		while ( ( resource = mlt_deque_pop_front( g_queue ) ) != NULL )
+			free( resource );
+		mlt_deque_close( g_queue );
+		g_queue = NULL;
+	}
+	mlt_properties_close( g_pending );
+	g_pending = NULL;
+	mlt_properties_close( g_keys );
+	g_keys = NULL;
+	pthread_mutex_unlock( &g_index_mutex );
+}
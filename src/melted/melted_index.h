@@ -0,0 +1,56 @@
+/*
+ * melted_index.h -- Persistent Keyframe Index
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_INDEX_H_
+#define _MELTED_INDEX_H_
+
+/* MLT header files */
+#include <framework/mlt_producer.h>
+
+/* Application header files */
+#include <mvcp/mvcp_response.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Keyframe index API.
+
+    The keyframe layout of each media file is estimated in the background
+    the first time the file is opened and kept in a memory mapped file,
+    keyed by the path, size and modification time of the media. MLT does
+    not expose the demuxer's keyframes, so the layout is inferred from
+    decode times and only steers where the ring starts decoding; seeks are
+    left to MLT.
+*/
+
+extern int melted_index_open( const char *path );
+extern const char *melted_index_path( void );
+extern void melted_index_request( const char *resource );
+extern mlt_position melted_index_keyframe( const char *resource, mlt_position position );
+extern void melted_index_report( mvcp_response response );
+extern void melted_index_close( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
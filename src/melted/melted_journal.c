@@ -0,0 +1,317 @@
+/*
+ * melted_journal.c -- Unit State Journal
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Application header files */
+#include "melted_journal.h"
+#include "melted_log.h"
+
+/** Build the name of one of the journal files.
+*/
+
+static char *journal_path( melted_journal this, const char *suffix )
+{
+	char *path = malloc( strlen( this->base ) + strlen( suffix ) + 1 );
+	if ( path != NULL )
+		sprintf( path, "%s%s", this->base, suffix );
+	return path;
+}
+
+/** Open the journal with the given base name, creating it if needed.
+
+    \return The journal or NULL if the journal file can not be opened.
+*/
+
+melted_journal melted_journal_open( const char *base )
+{
+	melted_journal this = calloc( 1, sizeof( melted_journal_t ) );
+	char *path = NULL;
+
+	if ( this != NULL )
+	{
+		pthread_mutex_init( &this->mutex, NULL );
+		this->base = strdup( base );
+		path = journal_path( this, ".journal" );
+		this->fd = path != NULL ? open( path, O_RDWR | O_CREAT | O_APPEND, 0644 ) : -1;
+		if ( this->fd < 0 )
+		{
+			melted_log( LOG_ERR, "Unable to open journal %s", path != NULL ? path : base );
+			melted_journal_close( this );
+			this = NULL;
+		}
+		free( path );
+	}
+
+	return this;
+}
+
+/** Rebuild the state by passing each record of the snapshot and then the
+    journal tail to apply.
+
+    A record left incomplete by a crash ends the replay and is cut from the
+    journal so that new records are not appended to it.
+
+    \return The number of records applied.
+*/
+
+int melted_journal_replay( melted_journal this, melted_journal_apply apply, void *arg )
+{
+	char *path = journal_path( this, ".snapshot" );
+	FILE *file = path != NULL ? fopen( path, "r" ) : NULL;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+	long long sequence = 0;
+	off_t offset = 0;
+	int count = 0;
+
+	pthread_mutex_lock( &this->mutex );
+
+	if ( file != NULL )
+	{
+		if ( getline( &line, &size, file ) > 0 && sscanf( line, "melted-snapshot %lld", &sequence ) == 1 )
+		{
+			while ( ( length = getline( &line, &size, file ) ) > 0 && line[ length - 1 ] == '\n' )
+			{
+				line[ length - 1 ] = '\0';
+				apply( arg, line );
+				count ++;
+			}
+		}
+		fclose( file );
+	}
+	free( path );
+
+	this->snapshot = this->sequence = sequence;
+	this->records = 0;
+
+	path = journal_path( this, ".journal" );
+	file = path != NULL ? fopen( path, "r" ) : NULL;
+	if ( file != NULL )
+	{
+		while ( ( length = getline( &line, &size, file ) ) > 0 && line[ length - 1 ] == '\n' )
+		{
+			int skip = 0;
+			line[ length - 1 ] = '\0';
+			if ( sscanf( line, "%lld %n", &sequence, &skip ) == 1 && skip > 0 )
+			{
+				if ( sequence > this->snapshot )
+				{
+					apply( arg, line + skip );
+					this->records ++;
+					count ++;
+				}
+				if ( sequence > this->sequence )
+					this->sequence = sequence;
+			}
+			offset += length;
+		}
+		if ( length > 0 )
+		{
+			melted_log( LOG_WARNING, "Discarding incomplete record at the end of %s", path );
+			if ( ftruncate( this->fd, offset ) != 0 )
+				melted_log( LOG_ERR, "Unable to truncate %s", path );
+		}
+		fclose( file );
+	}
+	free( path );
+	free( line );
+
+	pthread_mutex_unlock( &this->mutex );
+
+	return count;
+}
+
+/** Append a record to the journal from a variable argument list.
+
+    The record is sized to fit, whatever its length. A record which can not
+    be built is logged and left out rather than written incomplete.
+
+    \param sync Non zero to wait for the record to reach the disk.
+*/
+
+void melted_journal_vwrite( melted_journal this, int sync, const char *format, va_list list )
+{
+	char *body = NULL;
+	char *record = NULL;
+	int length;
+
+	if ( vasprintf( &body, format, list ) < 0 )
+	{
+		melted_log( LOG_ERR, "Unable to build a record for journal %s", this->base );
+		return;
+	}
+
+	pthread_mutex_lock( &this->mutex );
+	length = asprintf( &record, "%lld %s\n", ( long long )( this->sequence + 1 ), body );
+	if ( length < 0 )
+	{
+		melted_log( LOG_ERR, "Unable to build a record for journal %s", this->base );
+	}
+	else
+	{
+		this->sequence ++;
+		if ( write( this->fd, record, length ) != length )
+			melted_log( LOG_ERR, "Unable to write to journal %s", this->base );
+		else if ( sync )
+			fdatasync( this->fd );
+		this->records ++;
+		free( record );
+	}
+	pthread_mutex_unlock( &this->mutex );
+
+	free( body );
+}
+
+/** Append a record to the journal.
+
+    \param sync Non zero to wait for the record to reach the disk.
+*/
+
+void melted_journal_write( melted_journal this, int sync, const char *format, ... )
+{
+	va_list list;
+
+	va_start( list, format );
+	melted_journal_vwrite( this, sync, format, list );
+	va_end( list );
+}
+
+/** Flush the directory holding a path, so that a rename in it is durable.
+
+    \return 0 on success.
+*/
+
+static int sync_directory( const char *path )
+{
+	const char *slash = strrchr( path, '/' );
+	char *directory = slash == NULL ? strdup( "." ) : slash == path ? strdup( "/" ) : strndup( path, slash - path );
+	int fd = directory != NULL ? open( directory, O_RDONLY ) : -1;
+	int error = fd < 0 || fsync( fd ) != 0;
+
+	if ( fd >= 0 )
+		close( fd );
+	free( directory );
+
+	return error;
+}
+
+/** Get the number of records written since the last snapshot.
+*/
+
+int melted_journal_records( melted_journal this )
+{
+	return this->records;
+}
+
+/** Replace the snapshot by the given records and empty the journal.
+
+    The snapshot is written aside, renamed over the old one and the
+    directory flushed before the journal is emptied, so a crash leaves
+    either the old or the new snapshot. It is stamped with the last
+    journal sequence number so records it already includes are skipped if
+    the journal is not emptied.
+
+    \return 0 on success.
+*/
+
+int melted_journal_snapshot( melted_journal this, const char *records )
+{
+	char *temp = journal_path( this, ".snapshot.tmp" );
+	char *path = journal_path( this, ".snapshot" );
+	char header[ 64 ];
+	int error = temp == NULL || path == NULL;
+	int fd = -1;
+
+	pthread_mutex_lock( &this->mutex );
+
+	if ( !error )
+		fd = open( temp, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd >= 0 )
+	{
+		size_t length = strlen( records );
+		sprintf( header, "melted-snapshot %lld\n", ( long long )this->sequence );
+		error = write( fd, header, strlen( header ) ) != strlen( header ) ||
+				write( fd, records, length ) != length ||
+				fsync( fd ) != 0;
+		close( fd );
+	}
+	else
+	{
+		error = 1;
+	}
+
+	if ( !error && rename( temp, path ) == 0 )
+	{
+		// The journal is only emptied once the new name is on the disk
+		if ( sync_directory( path ) != 0 )
+			melted_log( LOG_WARNING, "Unable to flush the directory of %s", path );
+		this->snapshot = this->sequence;
+		this->records = 0;
+		if ( ftruncate( this->fd, 0 ) != 0 )
+			melted_log( LOG_WARNING, "Unable to empty journal %s", this->base );
+	}
+	else
+	{
+		melted_log( LOG_ERR, "Unable to write snapshot %s", path != NULL ? path : this->base );
+		if ( temp != NULL )
+			unlink( temp );
+		error = 1;
+	}
+
+	pthread_mutex_unlock( &this->mutex );
+
+	free( temp );
+	free( path );
+
+	return error;
+}
+
+/** Get the base name of the journal files.
+*/
+
+const char *melted_journal_base( melted_journal this )
+{
+	return this->base;
+}
+
+/** Close the journal.
+*/
+
+void melted_journal_close( melted_journal this )
+{
+	if ( this != NULL )
+	{
+		if ( this->fd >= 0 )
+			close( this->fd );
+		pthread_mutex_destroy( &this->mutex );
+		free( this->base );
+		free( this );
+	}
+}
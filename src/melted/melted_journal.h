@@ -0,0 +1,71 @@
+/*
+ * melted_journal.h -- Unit State Journal
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_JOURNAL_H_
+#define _MELTED_JOURNAL_H_
+
+/* System header files */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Journal of a unit's state.
+
+    The state is kept in two files: <base>.snapshot holds a compact list of
+    records rebuilding the whole state and <base>.journal the numbered
+    records appended since. Each record is a single text line, so a record
+    torn by a crash is simply ignored on replay.
+*/
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	char *base;
+	int fd;
+	int64_t sequence;
+	int64_t snapshot;
+	int records;
+}
+*melted_journal, melted_journal_t;
+
+/** Callback receiving each record on replay.
+*/
+
+typedef void ( *melted_journal_apply )( void *, char * );
+
+extern melted_journal melted_journal_open( const char * );
+extern int melted_journal_replay( melted_journal, melted_journal_apply, void * );
+extern void melted_journal_write( melted_journal, int, const char *, ... );
+extern void melted_journal_vwrite( melted_journal, int, const char *, va_list );
+extern int melted_journal_records( melted_journal );
+extern int melted_journal_snapshot( melted_journal, const char * );
+extern const char *melted_journal_base( melted_journal );
+extern void melted_journal_close( melted_journal );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -44,6 +44,12 @@
 #include "melted_commands.h"
 #include "melted_unit_commands.h"
 #include "melted_log.h"
+#include "melted_pool.h"
+#include "melted_frames.h"
+#include "melted_index.h"
+#include "melted_media.h"
+#include "melted_dirs.h"
+#include "melted_prefetch.h"
 
 /** Private melted_local structure.
 */
@@ -172,10 +178,13 @@ static command_t vocabulary[] =
 	{"HELP", melted_help, 0, ATYPE_NONE, "Display this information!"},
 	{"NLS", melted_list_nodes, 0, ATYPE_NONE, "List the AV/C nodes on the 1394 bus."},
 	{"UADD", melted_add_unit, 0, ATYPE_STRING, "Create a new playout unit (virtual VTR) to transmit to receiver specified in GUID argument."},
+	{"UDEL", melted_remove_unit, 1, ATYPE_NONE, "Remove a playout unit from the server, closing it once commands using it finish."},
 	{"ULS", melted_list_units, 0, ATYPE_NONE, "Lists the units that have already been added to the server."},
-	{"CLS", melted_list_clips, 0, ATYPE_STRING, "Lists the clips at directory name argument."},
+	{"CLS", melted_list_clips, 0, ATYPE_STRING, "Lists the clips at directory name argument, optionally from an offset, a count and a name prefix."},
+	{"MLS", melted_list_media, 0, ATYPE_STRING, "Lists the clips at directory name argument as CLS does, with the length and frame rate of each file."},
 	{"SET", melted_set_global_property, 0, ATYPE_PAIR, "Set a server configuration property."},
 	{"GET", melted_get_global_property, 0, ATYPE_STRING, "Get a server configuration property."},
+	{"STATS", melted_server_stats, 0, ATYPE_NONE, "Report server resource usage and statistics."},
 	{"RUN", melted_run, 0, ATYPE_STRING, "Run a batch file." },
 	{"LIST", melted_list, 1, ATYPE_NONE, "List the playlist associated to a unit."},
 	{"LOAD", melted_load, 1, ATYPE_STRING, "Load clip specified in absolute filename argument."},
@@ -186,7 +195,9 @@ static command_t vocabulary[] =
 	{"CLEAR", melted_clear, 1, ATYPE_NONE, "Clear a unit by removing all clips."},
 	{"MOVE", melted_move, 1, ATYPE_INT, "Move a clip to another clip index."},
 	{"APND", melted_append, 1, ATYPE_STRING, "Append a clip specified in absolute filename argument."},
+	{"SYNC", melted_sync, 1, ATYPE_STRING, "Bring the clips after the playing one in line with the list in the file argument."},
 	{"PLAY", melted_play, 1, ATYPE_NONE, "Play a loaded clip at speed -2000 to 2000 where 1000 = normal forward speed."},
+	{"CUE", melted_cue, 1, ATYPE_NONE, "Seek to the optional frame and clip, decode ahead and hold paused ready to PLAY."},
 	{"STOP", melted_stop, 1, ATYPE_NONE, "Stop a loaded and playing clip."},
 	{"PAUSE", melted_pause, 1, ATYPE_NONE, "Pause a playing clip."},
 	{"REW", melted_rewind, 1, ATYPE_NONE, "Rewind a unit. If stopped, seek to beginning of clip. If playing, play fast backwards."},
@@ -196,9 +207,11 @@ static command_t vocabulary[] =
 	{"SIN", melted_set_in_point, 1, ATYPE_INT, "Set the IN point of the loaded clip to frame number argument. -1 = reset in point to 0"},
 	{"SOUT", melted_set_out_point, 1, ATYPE_INT, "Set the OUT point of the loaded clip to frame number argument. -1 = reset out point to maximum."},
 	{"USTA", melted_get_unit_status, 1, ATYPE_NONE, "Report information about the unit."},
+	{"USTATS", melted_get_unit_stats, 1, ATYPE_NONE, "Report the performance statistics of the unit."},
 	{"USET", melted_set_unit_property, 1, ATYPE_PAIR, "Set a unit configuration property."},
 	{"UGET", melted_get_unit_property, 1, ATYPE_STRING, "Get a unit configuration property."},
 	{"XFER", melted_transfer, 1, ATYPE_STRING, "Transfer the unit's clip to another unit specified as argument."},
+	{"UOUT", melted_set_output, 1, ATYPE_STRING, "Switch the unit to the output specified as argument without stopping playback."},
 	{"SHUTDOWN", melted_shutdown, 0, ATYPE_NONE, "Shutdown the server."},
 	{NULL, NULL, 0, ATYPE_NONE, NULL}
 };
@@ -489,7 +502,10 @@ static mvcp_response melted_local_execute( melted_local local, char *command )
 
 			if ( melted_command_get_error( &cmd ) == RESPONSE_SUCCESS )
 			{
-				response_codes error = vocabulary[ index ].operation( &cmd );
+				response_codes error;
+				melted_units_enter( );
+				error = vocabulary[ index ].operation( &cmd );
+				melted_units_leave( );
 				melted_command_set_error( &cmd, error );
 			}
 
@@ -531,7 +547,9 @@ static mvcp_response melted_local_receive( melted_local local, char *command, ch
 			melted_command_set_error( &cmd, RESPONSE_MISSING_ARG );
 		position ++;
 
+		melted_units_enter( );
 		melted_receive( &cmd, doc );
+		melted_units_leave( );
 		melted_command_set_error( &cmd, RESPONSE_SUCCESS );
 
 		free( cmd.argument );
@@ -571,7 +589,9 @@ static mvcp_response melted_local_push( melted_local local, char *command, mlt_s
 			melted_command_set_error( &cmd, RESPONSE_MISSING_ARG );
 		position ++;
 
+		melted_units_enter( );
 		melted_push( &cmd, service );
+		melted_units_leave( );
 		melted_command_set_error( &cmd, RESPONSE_SUCCESS );
 
 		free( cmd.argument );
@@ -588,6 +608,12 @@ static mvcp_response melted_local_push( melted_local local, char *command, mlt_s
 static void melted_local_close( melted_local local )
 {
 	melted_delete_all_units();
+	melted_pool_close();
+	melted_frames_close();
+	melted_index_close();
+	melted_media_close();
+	melted_prefetch_close();
+	melted_dirs_close();
 #ifdef linux
 	//pthread_kill_other_threads_np();
 	melted_log( LOG_DEBUG, "Clean shutdown." );
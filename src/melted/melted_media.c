@@ -0,0 +1,498 @@
+/*
+ * melted_media.c -- Persistent Media Metadata Store
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_media.h"
+#include "melted_log.h"
+
+/** Number of records in the metadata file.
+*/
+
+#define MEDIA_SLOTS 65536
+
+/** Magic string at the start of the metadata file.
+*/
+
+#define MEDIA_MAGIC "MLTMEDA1"
+
+/** Header of the metadata file.
+*/
+
+typedef struct
+{
+	char magic[ 8 ];
+	uint32_t slots;
+	uint32_t count;
+}
+media_header;
+
+/** The description of a media file, identified by the hash of its resolved
+    path, size and modification time.
+*/
+
+typedef struct
+{
+	uint64_t key;
+	melted_media_t media;
+}
+media_record;
+
+static pthread_mutex_t g_media_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_media_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_media_thread;
+static int g_running = 0;
+static char *g_path = NULL;
+static media_header *g_header = NULL;
+static size_t g_length = 0;
+static mlt_deque g_queue = NULL;
+static mlt_properties g_pending = NULL;
+static int64_t g_hits = 0;
+static int64_t g_misses = 0;
+
+/** Get the records following the header.
+*/
+
+static media_record *media_records( void )
+{
+	return ( media_record * )( g_header + 1 );
+}
+
+/** Hash the resolved path, size and modification time of a media file.
+*/
+
+static uint64_t identity_key( const char *resolved, int64_t size, int64_t mtime )
+{
+	char text[ PATH_MAX + 64 ];
+	uint64_t hash = 14695981039346656037ULL;
+	const char *p = text;
+
+	snprintf( text, sizeof( text ), "%s|%lld|%lld", resolved, ( long long )size, ( long long )mtime );
+	while ( *p )
+		hash = ( hash ^ ( unsigned char )*p ++ ) * 1099511628211ULL;
+
+	return hash != 0 ? hash : 1;
+}
+
+/** Hash the identity of a media file.
+
+    \return 0 if the resource is not a file.
+*/
+
+static uint64_t media_key( const char *resource )
+{
+	struct stat buf;
+	char resolved[ PATH_MAX ];
+
+	if ( resource == NULL || realpath( resource, resolved ) == NULL || stat( resolved, &buf ) != 0 || !S_ISREG( buf.st_mode ) )
+		return 0;
+
+	return identity_key( resolved, buf.st_size, buf.st_mtime );
+}
+
+/** Find the slot of a key - must be called with the mutex held.
+
+    \return The record holding the key or the empty record where it belongs,
+    NULL if the store is full.
+*/
+
+static media_record *find_record( uint64_t key )
+{
+	media_record *records = media_records( );
+	uint32_t slot = key % g_header->slots;
+	uint32_t i;
+
+	for ( i = 0; i < g_header->slots; i ++, slot = ( slot + 1 ) % g_header->slots )
+		if ( records[ slot ].key == key || records[ slot ].key == 0 )
+			return &records[ slot ];
+
+	return NULL;
+}
+
+/** Describe an open producer.
+*/
+
+static void describe_media( mlt_producer producer, melted_media media )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) );
+	int streams = mlt_properties_get_int( properties, "meta.media.nb_streams" );
+	char *title = mlt_properties_get( properties, "meta.attr.title.markup" );
+	char key[ 64 ];
+	int i;
+
+	memset( media, 0, sizeof( melted_media_t ) );
+	media->length = mlt_producer_get_length( producer );
+	if ( profile != NULL )
+	{
+		media->profile_num = profile->frame_rate_num;
+		media->profile_den = profile->frame_rate_den;
+	}
+	media->fps_num = mlt_properties_get_int( properties, "meta.media.frame_rate_num" );
+	media->fps_den = mlt_properties_get_int( properties, "meta.media.frame_rate_den" );
+	media->width = mlt_properties_get_int( properties, "meta.media.width" );
+	media->height = mlt_properties_get_int( properties, "meta.media.height" );
+
+	for ( i = 0; i < streams; i ++ )
+	{
+		char *type;
+		snprintf( key, sizeof( key ), "meta.media.%d.stream.type", i );
+		type = mlt_properties_get( properties, key );
+		if ( type != NULL && !strcmp( type, "video" ) )
+		{
+			media->video_streams ++;
+		}
+		else if ( type != NULL && !strcmp( type, "audio" ) )
+		{
+			if ( media->audio_streams ++ == 0 )
+			{
+				snprintf( key, sizeof( key ), "meta.media.%d.codec.channels", i );
+				media->channels = mlt_properties_get_int( properties, key );
+				snprintf( key, sizeof( key ), "meta.media.%d.codec.sample_rate", i );
+				media->frequency = mlt_properties_get_int( properties, key );
+			}
+		}
+	}
+
+	if ( title == NULL )
+		title = mlt_properties_get( properties, "title" );
+	if ( title != NULL )
+		strncpy( media->title, title, sizeof( media->title ) - 1 );
+}
+
+/** Record the description of a media file - must be called with the mutex
+    held.
+*/
+
+static void store_record( uint64_t key, melted_media media )
+{
+	media_record *record;
+
+	if ( g_header == NULL || ( record = find_record( key ) ) == NULL )
+		return;
+	if ( record->key == 0 )
+		g_header->count ++;
+	record->media = *media;
+	record->key = key;
+}
+
+/** The probing thread - describes the listed files not known yet.
+*/
+
+static void *media_worker( void *arg )
+{
+	mlt_profile profile = mlt_profile_init( NULL );
+
+	pthread_mutex_lock( &g_media_mutex );
+	while ( g_running )
+	{
+		char *resource = mlt_deque_pop_front( g_queue );
+		uint64_t key;
+		if ( resource == NULL )
+		{
+			pthread_cond_wait( &g_media_cond, &g_media_mutex );
+			continue;
+		}
+		pthread_mutex_unlock( &g_media_mutex );
+		if ( ( key = media_key( resource ) ) != 0 )
+		{
+			mlt_producer producer = mlt_factory_producer( profile, NULL, resource );
+			if ( producer != NULL )
+			{
+				melted_media_t media;
+				describe_media( producer, &media );
+				mlt_producer_close( producer );
+				pthread_mutex_lock( &g_media_mutex );
+				store_record( key, &media );
+				pthread_mutex_unlock( &g_media_mutex );
+			}
+		}
+		pthread_mutex_lock( &g_media_mutex );
+		mlt_properties_set( g_pending, resource, NULL );
+		free( resource );
+	}
+	pthread_mutex_unlock( &g_media_mutex );
+
+	mlt_profile_close( profile );
+
+	return NULL;
+}
+
+/** Unmap the metadata file - must be called with the mutex held.
+*/
+
+static void unmap_media( void )
+{
+	if ( g_header != NULL )
+	{
+		msync( g_header, g_length, MS_ASYNC );
+		munmap( g_header, g_length );
+		g_header = NULL;
+	}
+	free( g_path );
+	g_path = NULL;
+}
+
+/** Use the given file as the metadata store, creating it if needed - NULL
+    or an empty path disables the store.
+
+    A file which is not empty is only used if it starts with the store
+    magic, so naming some other file by mistake never overwrites it. A
+    store of another size is started afresh.
+
+    \return 0 on success.
+*/
+
+int melted_media_open( const char *path )
+{
+	size_t length = sizeof( media_header ) + MEDIA_SLOTS * sizeof( media_record );
+	media_header *header = NULL;
+	media_header existing;
+	struct stat buf;
+	int fd = -1;
+
+	if ( path != NULL && *path != '\0' )
+	{
+		int fresh;
+
+		fd = open( path, O_RDWR | O_CREAT, 0644 );
+		if ( fd < 0 || fstat( fd, &buf ) != 0 )
+		{
+			melted_log( LOG_ERR, "Unable to open media store %s", path );
+			if ( fd >= 0 )
+				close( fd );
+			return 1;
+		}
+		if ( buf.st_size != 0 && ( pread( fd, &existing, sizeof( existing ), 0 ) != sizeof( existing ) ||
+			 memcmp( existing.magic, MEDIA_MAGIC, 8 ) ) )
+		{
+			melted_log( LOG_ERR, "%s is not a media store, not using it", path );
+			close( fd );
+			return 1;
+		}
+		fresh = buf.st_size != length || existing.slots != MEDIA_SLOTS;
+		if ( ( fresh && ftruncate( fd, 0 ) != 0 ) || ftruncate( fd, length ) != 0 )
+		{
+			melted_log( LOG_ERR, "Unable to open media store %s", path );
+			close( fd );
+			return 1;
+		}
+		header = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+		close( fd );
+		if ( header == MAP_FAILED )
+		{
+			melted_log( LOG_ERR, "Unable to map media store %s", path );
+			return 1;
+		}
+		if ( fresh )
+		{
+			memcpy( header->magic, MEDIA_MAGIC, 8 );
+			header->slots = MEDIA_SLOTS;
+			header->count = 0;
+		}
+	}
+
+	pthread_mutex_lock( &g_media_mutex );
+	unmap_media( );
+	if ( header != NULL )
+	{
+		g_header = header;
+		g_length = length;
+		g_path = strdup( path );
+		if ( !g_running )
+		{
+			g_queue = mlt_deque_init( );
+			g_pending = mlt_properties_new( );
+			g_running = 1;
+			pthread_create( &g_media_thread, NULL, media_worker, NULL );
+		}
+	}
+	pthread_mutex_unlock( &g_media_mutex );
+
+	return 0;
+}
+
+/** Get the path of the metadata store or NULL if it is disabled.
+*/
+
+const char *melted_media_path( void )
+{
+	return g_path;
+}
+
+/** Record the description of a newly opened producer.
+*/
+
+void melted_media_store( const char *resource, mlt_producer producer )
+{
+	melted_media_t media;
+	uint64_t key;
+
+	if ( g_header == NULL || ( key = media_key( resource ) ) == 0 )
+		return;
+
+	describe_media( producer, &media );
+	pthread_mutex_lock( &g_media_mutex );
+	store_record( key, &media );
+	pthread_mutex_unlock( &g_media_mutex );
+}
+
+/** Get the description stored under a key.
+
+    \return 0 if the file is known.
+*/
+
+static int lookup_key( uint64_t key, melted_media media )
+{
+	int error = 1;
+
+	pthread_mutex_lock( &g_media_mutex );
+	if ( g_header != NULL )
+	{
+		media_record *record = find_record( key );
+		if ( record != NULL && record->key == key )
+		{
+			*media = record->media;
+			error = 0;
+		}
+	}
+	if ( error )
+		g_misses ++;
+	else
+		g_hits ++;
+	pthread_mutex_unlock( &g_media_mutex );
+
+	return error;
+}
+
+/** Get the description of a media file.
+
+    \return 0 if the file is known.
+*/
+
+int melted_media_lookup( const char *resource, melted_media media )
+{
+	uint64_t key;
+
+	if ( g_header == NULL || ( key = media_key( resource ) ) == 0 )
+		return 1;
+
+	return lookup_key( key, media );
+}
+
+/** Get the description of a regular file whose resolved path, size and
+    modification time are known already, as when listing a directory,
+    without looking at the file again.
+
+    \return 0 if the file is known.
+*/
+
+int melted_media_lookup_resolved( const char *resolved, int64_t size, int64_t mtime, melted_media media )
+{
+	if ( g_header == NULL || resolved == NULL )
+		return 1;
+
+	return lookup_key( identity_key( resolved, size, mtime ), media );
+}
+
+/** Queue a media file to be described in the background unless it is
+    known.
+*/
+
+void melted_media_request( const char *resource )
+{
+	uint64_t key;
+
+	if ( g_header == NULL || ( key = media_key( resource ) ) == 0 )
+		return;
+
+	pthread_mutex_lock( &g_media_mutex );
+	if ( g_header != NULL && g_running && mlt_properties_get( g_pending, resource ) == NULL )
+	{
+		media_record *record = find_record( key );
+		if ( record != NULL && record->key == 0 )
+		{
+			mlt_properties_set( g_pending, resource, "1" );
+			mlt_deque_push_back( g_queue, strdup( resource ) );
+			pthread_cond_broadcast( &g_media_cond );
+		}
+	}
+	pthread_mutex_unlock( &g_media_mutex );
+}
+
+/** Report the store counters.
+*/
+
+void melted_media_report( mvcp_response response )
+{
+	pthread_mutex_lock( &g_media_mutex );
+	if ( g_header != NULL )
+	{
+		mvcp_response_printf( response, 1024, "media.size=%u\n", g_header->count );
+		mvcp_response_printf( response, 1024, "media.pending=%d\n", mlt_deque_count( g_queue ) );
+		mvcp_response_printf( response, 1024, "media.hits=%lld\n", ( long long )g_hits );
+		mvcp_response_printf( response, 1024, "media.misses=%lld\n", ( long long )g_misses );
+	}
+	pthread_mutex_unlock( &g_media_mutex );
+}
+
+/** Stop probing and unmap the store.
+*/
+
+void melted_media_close( void )
+{
+	char *resource;
+	int running;
+
+	pthread_mutex_lock( &g_media_mutex );
+	running = g_running;
+	g_running = 0;
+	pthread_cond_broadcast( &g_media_cond );
+	pthread_mutex_unlock( &g_media_mutex );
+
+	if ( running )
+		pthread_join( g_media_thread, NULL );
+
+	pthread_mutex_lock( &g_media_mutex );
+	unmap_media( );
+	if ( g_queue != NULL )
+	{
+		while ( ( resource = mlt_deque_pop_front( g_queue ) ) != NULL )
+			free( resource );
+		mlt_deque_close( g_queue );
+		g_queue = NULL;
+	}
+	mlt_properties_close( g_pending );
+	g_pending = NULL;
+	pthread_mutex_unlock( &g_media_mutex );
+}
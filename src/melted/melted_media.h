@@ -0,0 +1,80 @@
+/*
+ * melted_media.h -- Persistent Media Metadata Store
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_MEDIA_H_
+#define _MELTED_MEDIA_H_
+
+/* System header files */
+#include <stdint.h>
+
+/* MLT header files */
+#include <framework/mlt_producer.h>
+
+/* Application header files */
+#include <mvcp/mvcp_response.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** What a probe of a media file found.
+
+    The length is in frames of the profile the file was probed with.
+*/
+
+typedef struct
+{
+	int32_t length;
+	int32_t profile_num;
+	int32_t profile_den;
+	int32_t fps_num;
+	int32_t fps_den;
+	int32_t width;
+	int32_t height;
+	int16_t video_streams;
+	int16_t audio_streams;
+	int32_t channels;
+	int32_t frequency;
+	char title[ 208 ];
+}
+*melted_media, melted_media_t;
+
+/** Media metadata API.
+
+    Media files are described the first time they are opened, or in the
+    background once listed, and the description is kept in a memory mapped
+    file keyed by the resolved path, size and modification time.
+*/
+
+extern int melted_media_open( const char *path );
+extern const char *melted_media_path( void );
+extern void melted_media_store( const char *resource, mlt_producer producer );
+extern int melted_media_lookup( const char *resource, melted_media media );
+extern int melted_media_lookup_resolved( const char *resolved, int64_t size, int64_t mtime, melted_media media );
+extern void melted_media_request( const char *resource );
+extern void melted_media_report( mvcp_response response );
+extern void melted_media_close( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
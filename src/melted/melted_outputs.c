@@ -0,0 +1,369 @@
+/*
+ * melted_outputs.c -- Mirrored Unit Outputs
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_outputs.h"
+#include "melted_log.h"
+
+/** Frames queued for each output unless the "queue" property says otherwise.
+*/
+
+#define DEFAULT_QUEUE 10
+
+typedef struct outputs_s *outputs;
+
+/** One output and the frames waiting for it.
+*/
+
+typedef struct
+{
+	outputs parent;
+	mlt_consumer consumer;
+	char *name;
+	pthread_t thread;
+	mlt_deque queue;
+	int dropping;
+}
+output;
+
+/** The consumer the unit sees.
+*/
+
+struct outputs_s
+{
+	struct mlt_consumer_s parent;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int running;
+	int count;
+	output *outputs;
+};
+
+/** Output thread - puts the queued frames to one output.
+
+    Only this thread waits while the output is busy with a frame.
+*/
+
+static void *output_run( void *arg )
+{
+	output *out = arg;
+	outputs self = out->parent;
+
+	pthread_mutex_lock( &self->mutex );
+	while ( self->running )
+	{
+		mlt_frame frame;
+		if ( mlt_deque_count( out->queue ) == 0 )
+		{
+			pthread_cond_wait( &self->cond, &self->mutex );
+			continue;
+		}
+		frame = mlt_deque_pop_front( out->queue );
+		pthread_cond_broadcast( &self->cond );
+		pthread_mutex_unlock( &self->mutex );
+		mlt_consumer_put_frame( out->consumer, frame );
+		pthread_mutex_lock( &self->mutex );
+	}
+	pthread_mutex_unlock( &self->mutex );
+
+	return NULL;
+}
+
+/** Render thread - renders each frame once and queues a copy for every
+    output.
+
+    The first output sets the pace: its queue is waited on when full. Any
+    other output whose queue is full loses its oldest frame instead.
+*/
+
+static void *outputs_run( void *arg )
+{
+	outputs self = arg;
+	mlt_consumer consumer = &self->parent;
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+	mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+	int size = mlt_properties_get( properties, "queue" ) != NULL ? mlt_properties_get_int( properties, "queue" ) : DEFAULT_QUEUE;
+
+	if ( size < 1 )
+		size = 1;
+
+	while ( self->running )
+	{
+		mlt_frame frame = mlt_consumer_rt_frame( consumer );
+		mlt_image_format format = mlt_image_yuv422;
+		mlt_audio_format audio_format = mlt_audio_s16;
+		int width = profile->width;
+		int height = profile->height;
+		int frequency = mlt_properties_get( properties, "frequency" ) != NULL ? mlt_properties_get_int( properties, "frequency" ) : 48000;
+		int channels = mlt_properties_get( properties, "channels" ) != NULL ? mlt_properties_get_int( properties, "channels" ) : 2;
+		int samples;
+		uint8_t *image = NULL;
+		void *pcm = NULL;
+		int i;
+
+		if ( frame == NULL )
+			continue;
+
+		// Render once - the outputs get deep copies
+		samples = mlt_sample_calculator( mlt_profile_fps( profile ), frequency, mlt_frame_get_position( frame ) );
+		mlt_frame_get_image( frame, &image, &format, &width, &height, 0 );
+		mlt_frame_get_audio( frame, &pcm, &audio_format, &frequency, &channels, &samples );
+
+		pthread_mutex_lock( &self->mutex );
+		while ( self->running && mlt_deque_count( self->outputs[ 0 ].queue ) >= size )
+			pthread_cond_wait( &self->cond, &self->mutex );
+		for ( i = 0; self->running && i < self->count; i ++ )
+		{
+			output *out = &self->outputs[ i ];
+			if ( mlt_deque_count( out->queue ) >= size )
+			{
+				mlt_frame_close( mlt_deque_pop_front( out->queue ) );
+				if ( !out->dropping )
+					melted_log( LOG_WARNING, "output %s is falling behind, dropping frames", out->name );
+				out->dropping = 1;
+			}
+			else
+			{
+				out->dropping = 0;
+			}
+			mlt_deque_push_back( out->queue, mlt_frame_clone( frame, 1 ) );
+		}
+		pthread_cond_broadcast( &self->cond );
+		pthread_mutex_unlock( &self->mutex );
+
+		mlt_events_fire( properties, "consumer-frame-show", frame, NULL );
+		mlt_frame_close( frame );
+	}
+
+	mlt_consumer_stopped( consumer );
+
+	return NULL;
+}
+
+/** Drop the frames queued for every output - must be called with the mutex
+    held.
+*/
+
+static void drop_queued( outputs self )
+{
+	int i;
+	for ( i = 0; i < self->count; i ++ )
+		while ( mlt_deque_count( self->outputs[ i ].queue ) > 0 )
+			mlt_frame_close( mlt_deque_pop_front( self->outputs[ i ].queue ) );
+}
+
+/** Start the outputs and their threads.
+*/
+
+static int outputs_start( mlt_consumer consumer )
+{
+	outputs self = consumer->child;
+	int i;
+
+	if ( !self->running )
+	{
+		self->running = 1;
+		for ( i = 0; i < self->count; i ++ )
+		{
+			mlt_consumer_start( self->outputs[ i ].consumer );
+			pthread_create( &self->outputs[ i ].thread, NULL, output_run, &self->outputs[ i ] );
+		}
+		pthread_create( &self->thread, NULL, outputs_run, self );
+	}
+
+	return 0;
+}
+
+/** Stop the threads and the outputs.
+
+    Stopping an output releases its thread if it is waiting in
+    mlt_consumer_put_frame.
+*/
+
+static int outputs_stop( mlt_consumer consumer )
+{
+	outputs self = consumer->child;
+	int i;
+
+	pthread_mutex_lock( &self->mutex );
+	if ( self->running )
+	{
+		self->running = 0;
+		pthread_cond_broadcast( &self->cond );
+		pthread_mutex_unlock( &self->mutex );
+
+		pthread_join( self->thread, NULL );
+		for ( i = 0; i < self->count; i ++ )
+		{
+			mlt_consumer_stop( self->outputs[ i ].consumer );
+			pthread_join( self->outputs[ i ].thread, NULL );
+		}
+
+		pthread_mutex_lock( &self->mutex );
+		drop_queued( self );
+	}
+	pthread_mutex_unlock( &self->mutex );
+
+	return 0;
+}
+
+/** Determine if the outputs are stopped.
+*/
+
+static int outputs_is_stopped( mlt_consumer consumer )
+{
+	outputs self = consumer->child;
+	return !self->running;
+}
+
+/** Drop every frame which has not reached an output yet.
+*/
+
+static void outputs_purge( mlt_consumer consumer )
+{
+	outputs self = consumer->child;
+	int i;
+
+	pthread_mutex_lock( &self->mutex );
+	drop_queued( self );
+	pthread_cond_broadcast( &self->cond );
+	pthread_mutex_unlock( &self->mutex );
+
+	for ( i = 0; i < self->count; i ++ )
+		mlt_consumer_purge( self->outputs[ i ].consumer );
+}
+
+/** Close the outputs and the consumer.
+*/
+
+static void outputs_close( mlt_consumer consumer )
+{
+	outputs self = consumer->child;
+	int i;
+
+	mlt_consumer_stop( consumer );
+	consumer->close = NULL;
+	mlt_consumer_close( consumer );
+
+	for ( i = 0; i < self->count; i ++ )
+	{
+		mlt_consumer_close( self->outputs[ i ].consumer );
+		mlt_deque_close( self->outputs[ i ].queue );
+		free( self->outputs[ i ].name );
+	}
+	free( self->outputs );
+	pthread_mutex_destroy( &self->mutex );
+	pthread_cond_destroy( &self->cond );
+	free( self );
+}
+
+/** Construct one output such as decklink:0.
+
+    \return 0 on success.
+*/
+
+static int add_output( outputs self, mlt_profile profile, char *name )
+{
+	output *list = realloc( self->outputs, ( self->count + 1 ) * sizeof( output ) );
+	char *arg = strchr( name, ':' );
+	mlt_consumer consumer;
+
+	if ( list == NULL )
+		return -1;
+	self->outputs = list;
+
+	if ( arg != NULL )
+		*arg ++ = '\0';
+	consumer = mlt_factory_consumer( profile, name, arg );
+	if ( consumer == NULL )
+	{
+		melted_log( LOG_ERR, "Unable to construct output %s", name );
+		return -1;
+	}
+
+	// Frames only arrive through mlt_consumer_put_frame
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "put_mode", 1 );
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "terminate_on_pause", 0 );
+
+	memset( &list[ self->count ], 0, sizeof( output ) );
+	list[ self->count ].parent = self;
+	list[ self->count ].consumer = consumer;
+	list[ self->count ].name = strdup( name );
+	list[ self->count ].queue = mlt_deque_init( );
+	self->count ++;
+
+	return 0;
+}
+
+/** Construct the mirrored outputs of a comma separated constructor.
+
+    \return The consumer or NULL if any output could not be constructed.
+*/
+
+mlt_consumer melted_outputs_init( mlt_profile profile, const char *constructor )
+{
+	outputs self = calloc( 1, sizeof( struct outputs_s ) );
+
+	if ( self != NULL && mlt_consumer_init( &self->parent, self, profile ) == 0 )
+	{
+		mlt_consumer consumer = &self->parent;
+		char *list = strdup( constructor );
+		char *save = NULL;
+		char *name = strtok_r( list, ",", &save );
+		int error = 0;
+
+		pthread_mutex_init( &self->mutex, NULL );
+		pthread_cond_init( &self->cond, NULL );
+		consumer->start = outputs_start;
+		consumer->stop = outputs_stop;
+		consumer->is_stopped = outputs_is_stopped;
+		consumer->purge = outputs_purge;
+		consumer->close = outputs_close;
+
+		while ( !error && name != NULL )
+		{
+			error = add_output( self, profile, name );
+			name = strtok_r( NULL, ",", &save );
+		}
+		free( list );
+
+		if ( error || self->count == 0 )
+		{
+			mlt_consumer_close( consumer );
+			return NULL;
+		}
+		return consumer;
+	}
+
+	free( self );
+
+	return NULL;
+}
@@ -0,0 +1,46 @@
+/*
+ * melted_outputs.h -- Mirrored Unit Outputs
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_OUTPUTS_H_
+#define _MELTED_OUTPUTS_H_
+
+/* MLT header files */
+#include <framework/mlt_consumer.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Mirrored outputs API.
+
+    A consumer which renders each frame once and hands a copy to every
+    output of a comma separated list such as decklink:0,decklink:1. Each
+    output is fed from a bounded queue of its own by a thread of its own,
+    so a slow output drops frames instead of holding up the others.
+*/
+
+extern mlt_consumer melted_outputs_init( mlt_profile profile, const char *constructor );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,368 @@
+/*
+ * melted_pool.c -- Consumer Pool
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_pool.h"
+#include "melted_outputs.h"
+#include "melted_log.h"
+
+/** Seconds before a consumer which could not be constructed is tried
+    again, doubled on each further failure up to POOL_RETRY_MAX.
+*/
+
+#define POOL_RETRY 1
+#define POOL_RETRY_MAX 60
+
+/** The idle consumers of one constructor.
+*/
+
+typedef struct
+{
+	char *constructor;
+	int size;
+	int count;
+	int filling;
+	int failures;
+	time_t retry;
+	mlt_consumer *consumers;
+}
+consumer_pool;
+
+static consumer_pool *g_pools = NULL;
+static int g_pool_count = 0;
+static pthread_mutex_t g_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_pool_thread;
+static int g_pool_running = 0;
+
+/** Construct a consumer from a unit constructor string such as decklink:0.
+
+    A comma separated list of outputs gives mirrored outputs, which render
+    each frame once and hand a copy to every output through a queue of its
+    own (see melted_outputs.c).
+*/
+
+mlt_consumer melted_pool_create( const char *constructor )
+{
+	mlt_profile profile = mlt_profile_init( NULL );
+	char *id = strdup( constructor );
+	char *arg = strchr( id, ':' );
+	mlt_consumer consumer;
+
+	profile->is_explicit = 1;
+	if ( strchr( id, ',' ) == NULL )
+	{
+		if ( arg != NULL )
+			*arg ++ = '\0';
+		consumer = mlt_factory_consumer( profile, id, arg );
+	}
+	else
+	{
+		consumer = melted_outputs_init( profile, constructor );
+	}
+	free( id );
+
+	return consumer;
+}
+
+/** Find the pool of a constructor - must be called with the mutex held.
+*/
+
+static consumer_pool *find_pool( const char *constructor )
+{
+	int i;
+	for ( i = 0; i < g_pool_count; i ++ )
+		if ( !strcmp( g_pools[ i ].constructor, constructor ) )
+			return &g_pools[ i ];
+	return NULL;
+}
+
+/** Pool thread - constructs consumers until every pool is full.
+
+    A constructor which fails is tried again after a delay growing with
+    each failure, so a missing device is not retried in a tight loop and
+    the configured size still applies once it is back.
+*/
+
+static void *pool_fill( void *arg )
+{
+	pthread_mutex_lock( &g_pool_mutex );
+	while ( g_pool_running )
+	{
+		consumer_pool *pool = NULL;
+		time_t now = time( NULL );
+		time_t retry = 0;
+		char *constructor;
+		mlt_consumer consumer;
+		int i;
+
+		for ( i = 0; pool == NULL && i < g_pool_count; i ++ )
+		{
+			if ( g_pools[ i ].count + g_pools[ i ].filling >= g_pools[ i ].size )
+				continue;
+			if ( g_pools[ i ].retry <= now )
+				pool = &g_pools[ i ];
+			else if ( retry == 0 || g_pools[ i ].retry < retry )
+				retry = g_pools[ i ].retry;
+		}
+
+		if ( pool == NULL && retry != 0 )
+		{
+			struct timespec until = { retry, 0 };
+			pthread_cond_timedwait( &g_pool_cond, &g_pool_mutex, &until );
+			continue;
+		}
+		if ( pool == NULL )
+		{
+			pthread_cond_wait( &g_pool_cond, &g_pool_mutex );
+			continue;
+		}
+
+		// Construct off lock - the pool array may move meanwhile
+		pool->filling ++;
+		constructor = strdup( pool->constructor );
+		pthread_mutex_unlock( &g_pool_mutex );
+		consumer = melted_pool_create( constructor );
+		if ( consumer == NULL )
+			melted_log( LOG_ERR, "Unable to construct pooled consumer %s", constructor );
+		pthread_mutex_lock( &g_pool_mutex );
+
+		pool = find_pool( constructor );
+		pool->filling --;
+		if ( consumer != NULL )
+		{
+			pool->failures = 0;
+			pool->retry = 0;
+		}
+		else
+		{
+			int delay = POOL_RETRY << ( pool->failures < 6 ? pool->failures : 6 );
+			delay = delay < POOL_RETRY_MAX ? delay : POOL_RETRY_MAX;
+			pool->failures ++;
+			pool->retry = time( NULL ) + delay;
+			melted_log( LOG_WARNING, "Pool %s is %d short, trying again in %d seconds", constructor, pool->size - pool->count, delay );
+		}
+		if ( consumer != NULL && pool->count < pool->size )
+		{
+			pool->consumers[ pool->count ++ ] = consumer;
+			consumer = NULL;
+		}
+		free( constructor );
+
+		if ( consumer != NULL )
+		{
+			pthread_mutex_unlock( &g_pool_mutex );
+			mlt_consumer_close( consumer );
+			pthread_mutex_lock( &g_pool_mutex );
+		}
+	}
+	pthread_mutex_unlock( &g_pool_mutex );
+
+	return NULL;
+}
+
+/** Set the number of idle consumers to keep for a constructor.
+
+    The pool is filled in the background. Extra idle consumers are closed.
+*/
+
+void melted_pool_set( const char *constructor, int size )
+{
+	mlt_consumer *extra = NULL;
+	int count = 0;
+	consumer_pool *pool;
+
+	pthread_mutex_lock( &g_pool_mutex );
+	pool = find_pool( constructor );
+	if ( pool == NULL )
+	{
+		consumer_pool *pools = realloc( g_pools, ( g_pool_count + 1 ) * sizeof( consumer_pool ) );
+		if ( pools != NULL )
+		{
+			g_pools = pools;
+			pool = &g_pools[ g_pool_count ++ ];
+			memset( pool, 0, sizeof( consumer_pool ) );
+			pool->constructor = strdup( constructor );
+		}
+	}
+	if ( pool != NULL )
+	{
+		mlt_consumer *consumers;
+
+		size = size > 0 ? size : 0;
+		// Take the surplus out before the array shrinks
+		if ( pool->count > size )
+		{
+			count = pool->count - size;
+			extra = malloc( count * sizeof( mlt_consumer ) );
+			if ( extra != NULL )
+			{
+				memcpy( extra, pool->consumers + size, count * sizeof( mlt_consumer ) );
+				pool->count = size;
+			}
+			else
+			{
+				count = 0;
+				size = pool->count;
+			}
+		}
+		consumers = realloc( pool->consumers, ( size > 0 ? size : 1 ) * sizeof( mlt_consumer ) );
+		if ( consumers != NULL )
+		{
+			pool->consumers = consumers;
+			pool->size = size;
+		}
+		else if ( size < pool->size )
+		{
+			pool->size = size;
+		}
+		pool->failures = 0;
+		pool->retry = 0;
+		if ( !g_pool_running )
+			g_pool_running = pthread_create( &g_pool_thread, NULL, pool_fill, NULL ) == 0;
+		pthread_cond_broadcast( &g_pool_cond );
+	}
+	pthread_mutex_unlock( &g_pool_mutex );
+
+	while ( count -- )
+		mlt_consumer_close( extra[ count ] );
+	free( extra );
+}
+
+/** Get the number of idle consumers of a constructor.
+*/
+
+int melted_pool_count( const char *constructor )
+{
+	consumer_pool *pool;
+	int count;
+
+	pthread_mutex_lock( &g_pool_mutex );
+	pool = find_pool( constructor );
+	count = pool != NULL ? pool->count : 0;
+	pthread_mutex_unlock( &g_pool_mutex );
+
+	return count;
+}
+
+/** Get a consumer for a constructor, from the pool if it has one.
+
+    \return The consumer or NULL if none could be constructed.
+*/
+
+mlt_consumer melted_pool_take( const char *constructor )
+{
+	mlt_consumer consumer = NULL;
+	consumer_pool *pool;
+
+	pthread_mutex_lock( &g_pool_mutex );
+	pool = find_pool( constructor );
+	if ( pool != NULL && pool->count > 0 )
+	{
+		consumer = pool->consumers[ -- pool->count ];
+		pthread_cond_broadcast( &g_pool_cond );
+	}
+	pthread_mutex_unlock( &g_pool_mutex );
+
+	if ( consumer == NULL )
+		consumer = melted_pool_create( constructor );
+	else
+		melted_log( LOG_DEBUG, "took pooled consumer %s", constructor );
+
+	return consumer;
+}
+
+/** Determine if the pool of a constructor has room for a returned consumer.
+*/
+
+int melted_pool_wants( const char *constructor )
+{
+	consumer_pool *pool;
+	int wants;
+
+	pthread_mutex_lock( &g_pool_mutex );
+	pool = find_pool( constructor );
+	wants = g_pool_running && pool != NULL && pool->count < pool->size;
+	pthread_mutex_unlock( &g_pool_mutex );
+
+	return wants;
+}
+
+/** Return a stopped and disconnected consumer to its pool.
+
+    The consumer is closed if the pool is full - ownership is taken either way.
+*/
+
+void melted_pool_give( const char *constructor, mlt_consumer consumer )
+{
+	consumer_pool *pool;
+
+	pthread_mutex_lock( &g_pool_mutex );
+	pool = find_pool( constructor );
+	if ( g_pool_running && pool != NULL && pool->count < pool->size )
+	{
+		pool->consumers[ pool->count ++ ] = consumer;
+		consumer = NULL;
+	}
+	pthread_mutex_unlock( &g_pool_mutex );
+
+	if ( consumer != NULL )
+		mlt_consumer_close( consumer );
+}
+
+/** Stop filling the pools and close every idle consumer.
+*/
+
+void melted_pool_close( void )
+{
+	int i;
+
+	pthread_mutex_lock( &g_pool_mutex );
+	if ( g_pool_running )
+	{
+		g_pool_running = 0;
+		pthread_cond_broadcast( &g_pool_cond );
+		pthread_mutex_unlock( &g_pool_mutex );
+		pthread_join( g_pool_thread, NULL );
+		pthread_mutex_lock( &g_pool_mutex );
+	}
+	for ( i = 0; i < g_pool_count; i ++ )
+	{
+		while ( g_pools[ i ].count > 0 )
+			mlt_consumer_close( g_pools[ i ].consumers[ -- g_pools[ i ].count ] );
+		free( g_pools[ i ].consumers );
+		free( g_pools[ i ].constructor );
+	}
+	free( g_pools );
+	g_pools = NULL;
+	g_pool_count = 0;
+	pthread_mutex_unlock( &g_pool_mutex );
+}
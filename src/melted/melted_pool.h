@@ -0,0 +1,51 @@
+/*
+ * melted_pool.h -- Consumer Pool
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_POOL_H_
+#define _MELTED_POOL_H_
+
+/* MLT header files */
+#include <framework/mlt_consumer.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Consumer pool API.
+
+    Idle consumers are kept per unit constructor string (such as sdl or
+    decklink:0), so a UADD takes one that is already constructed and a
+    deleted unit can hand its consumer back.
+*/
+
+extern mlt_consumer melted_pool_create( const char *constructor );
+extern void melted_pool_set( const char *constructor, int size );
+extern int melted_pool_count( const char *constructor );
+extern mlt_consumer melted_pool_take( const char *constructor );
+extern int melted_pool_wants( const char *constructor );
+extern void melted_pool_give( const char *constructor, mlt_consumer consumer );
+extern void melted_pool_close( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
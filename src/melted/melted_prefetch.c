@@ -0,0 +1,337 @@
+/*
+ * melted_prefetch.c -- Storage Prefetcher
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_prefetch.h"
+#include "melted_commands.h"
+#include "melted_unit.h"
+#include "melted_log.h"
+
+/** Seconds of media kept read ahead of each clip.
+*/
+
+#define PREFETCH_SECONDS 5
+
+/** Number of clips after the playing one that are read ahead.
+*/
+
+#define PREFETCH_CLIPS 2
+
+/** Milliseconds between passes.
+*/
+
+#define PREFETCH_INTERVAL 500
+
+static pthread_mutex_t g_prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_prefetch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_stopped_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_prefetch_thread;
+static int g_running = 0;
+static int g_stopping = 0;
+static int64_t g_budget = 0;
+static int64_t g_issued = 0;
+static int64_t g_wanted = 0;
+static int64_t g_resident = 0;
+static mlt_properties g_advised = NULL;
+
+/** Count the bytes of a file range held in the page cache.
+*/
+
+static int64_t resident_bytes( int fd, off_t offset, size_t length )
+{
+	long page = sysconf( _SC_PAGESIZE );
+	off_t start = offset - offset % page;
+	size_t size = length + ( offset - start );
+	size_t pages = ( size + page - 1 ) / page;
+	unsigned char *vector;
+	int64_t resident = 0;
+	void *map;
+	size_t i;
+
+	if ( length == 0 || ( vector = malloc( pages ) ) == NULL )
+		return 0;
+	map = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, start );
+	if ( map != MAP_FAILED )
+	{
+		if ( mincore( map, size, vector ) == 0 )
+			for ( i = 0; i < pages; i ++ )
+				if ( vector[ i ] & 1 )
+					resident += page;
+		munmap( map, size );
+	}
+	free( vector );
+
+	return resident < ( int64_t )length ? resident : ( int64_t )length;
+}
+
+/** Read ahead the window of one item within the remaining budget.
+
+    The read position is estimated from the media position in proportion
+    to the file size. Only the part of the window not advised in an earlier
+    pass is advised again, so a steady playhead only costs the bytes it
+    moved on.
+
+    \param wanted Incremented by the size of the window.
+    \param resident Incremented by the bytes of the window in the page cache.
+    \return The number of bytes advised.
+*/
+
+static int64_t prefetch_item( mlt_properties item, mlt_properties advised, int64_t budget, int64_t *wanted, int64_t *resident )
+{
+	char *resource = mlt_properties_get( item, "resource" );
+	mlt_position length = mlt_properties_get_position( item, "length" );
+	double fps = mlt_properties_get_double( item, "fps" );
+	int fd = open( resource, O_RDONLY );
+	int64_t issued = 0;
+	struct stat info;
+
+	if ( fd < 0 )
+		return 0;
+
+	if ( fstat( fd, &info ) == 0 && S_ISREG( info.st_mode ) && length > 0 && info.st_size > 0 )
+	{
+		double per_frame = ( double )info.st_size / length;
+		int64_t start = per_frame * mlt_properties_get_position( item, "position" );
+		int64_t end = start + per_frame * fps * PREFETCH_SECONDS;
+		int64_t from;
+		char key[ 4096 ];
+		size_t size;
+
+		if ( start < 0 )
+			start = 0;
+		if ( start > info.st_size )
+			start = info.st_size;
+		if ( end > info.st_size )
+			end = info.st_size;
+		from = start;
+
+		// Continue from where the last pass left off if the window overlaps it
+		size = snprintf( key, sizeof( key ) - 8, "%s|%s", resource, mlt_properties_get_int( item, "current" ) ? "read" : "start" );
+		strcpy( key + size, ".end" );
+		if ( g_advised != NULL && mlt_properties_get( g_advised, key ) != NULL )
+		{
+			int64_t advised_end = mlt_properties_get_int64( g_advised, key );
+			strcpy( key + size, ".start" );
+			if ( mlt_properties_get_int64( g_advised, key ) <= start && advised_end >= start )
+				from = advised_end < end ? advised_end : end;
+		}
+		if ( end - from > budget )
+			end = from + budget;
+		if ( end > from )
+		{
+			posix_fadvise( fd, from, end - from, POSIX_FADV_WILLNEED );
+			issued = end - from;
+		}
+		else
+		{
+			end = from;
+		}
+
+		strcpy( key + size, ".start" );
+		mlt_properties_set_int64( advised, key, start );
+		strcpy( key + size, ".end" );
+		mlt_properties_set_int64( advised, key, end );
+
+		*wanted += end - start;
+		*resident += resident_bytes( fd, start, end - start );
+	}
+	close( fd );
+
+	return issued;
+}
+
+/** Gather the media every unit reads next.
+*/
+
+static mlt_properties gather_items( void )
+{
+	mlt_properties all = mlt_properties_new( );
+	int count = 0;
+	int *ids;
+	int i, j, n = 0;
+
+	melted_units_enter( );
+	ids = melted_get_unit_list( &count );
+	for ( i = 0; i < count; i ++ )
+	{
+		melted_unit unit = melted_get_unit( ids[ i ] );
+		mlt_properties items = unit != NULL ? melted_unit_upcoming( unit, PREFETCH_CLIPS ) : NULL;
+		for ( j = 0; items != NULL && j < mlt_properties_count( items ); j ++ )
+		{
+			mlt_properties item = mlt_properties_get_data_at( items, j, NULL );
+			char key[ 16 ];
+			snprintf( key, sizeof( key ), "%d", n ++ );
+			mlt_properties_inc_ref( item );
+			mlt_properties_set_data( all, key, item, 0, ( mlt_destructor )mlt_properties_close, NULL );
+		}
+		mlt_properties_close( items );
+	}
+	free( ids );
+	melted_units_leave( );
+
+	return all;
+}
+
+/** The prefetch thread.
+
+    Each pass reads ahead the playing clips first and then the starts of
+    the clips following them, until the budget of the pass is spent.
+*/
+
+static void *prefetch_worker( void *arg )
+{
+	pthread_mutex_lock( &g_prefetch_mutex );
+	while ( g_running )
+	{
+		int64_t budget = g_budget * PREFETCH_INTERVAL / 1000;
+		int64_t total = 0;
+		int64_t wanted = 0;
+		int64_t resident = 0;
+		mlt_properties items;
+		mlt_properties advised;
+		struct timeval now;
+		struct timespec until;
+		int pass, i;
+
+		pthread_mutex_unlock( &g_prefetch_mutex );
+		items = gather_items( );
+		advised = mlt_properties_new( );
+		for ( pass = 1; pass >= 0; pass -- )
+		{
+			for ( i = 0; i < mlt_properties_count( items ); i ++ )
+			{
+				mlt_properties item = mlt_properties_get_data_at( items, i, NULL );
+				if ( mlt_properties_get_int( item, "current" ) == pass )
+				{
+					int64_t issued = prefetch_item( item, advised, budget, &wanted, &resident );
+					budget -= issued;
+					total += issued;
+				}
+			}
+		}
+		mlt_properties_close( items );
+
+		pthread_mutex_lock( &g_prefetch_mutex );
+		mlt_properties_close( g_advised );
+		g_advised = advised;
+		g_issued += total;
+		g_wanted = wanted;
+		g_resident = resident;
+
+		gettimeofday( &now, NULL );
+		until.tv_sec = now.tv_sec + ( now.tv_usec / 1000 + PREFETCH_INTERVAL ) / 1000;
+		until.tv_nsec = ( ( now.tv_usec / 1000 + PREFETCH_INTERVAL ) % 1000 ) * 1000000;
+		if ( g_running )
+			pthread_cond_timedwait( &g_prefetch_cond, &g_prefetch_mutex, &until );
+	}
+	pthread_mutex_unlock( &g_prefetch_mutex );
+
+	return NULL;
+}
+
+/** Set the read ahead budget in bytes per second - 0 stops prefetching.
+
+    A thread being stopped is joined before another can be started, so
+    the handle of a running thread is never overwritten.
+*/
+
+void melted_prefetch_set_budget( int64_t bytes )
+{
+	pthread_mutex_lock( &g_prefetch_mutex );
+	while ( g_stopping )
+		pthread_cond_wait( &g_stopped_cond, &g_prefetch_mutex );
+	g_budget = bytes > 0 ? bytes : 0;
+	if ( g_budget > 0 && !g_running )
+	{
+		g_running = 1;
+		pthread_create( &g_prefetch_thread, NULL, prefetch_worker, NULL );
+	}
+	else if ( g_budget == 0 && g_running )
+	{
+		g_running = 0;
+		g_stopping = 1;
+		pthread_cond_broadcast( &g_prefetch_cond );
+		pthread_mutex_unlock( &g_prefetch_mutex );
+
+		pthread_join( g_prefetch_thread, NULL );
+
+		pthread_mutex_lock( &g_prefetch_mutex );
+		g_stopping = 0;
+		pthread_cond_broadcast( &g_stopped_cond );
+	}
+	pthread_mutex_unlock( &g_prefetch_mutex );
+}
+
+/** Get the read ahead budget in bytes per second.
+*/
+
+int64_t melted_prefetch_get_budget( void )
+{
+	int64_t budget;
+
+	pthread_mutex_lock( &g_prefetch_mutex );
+	budget = g_budget;
+	pthread_mutex_unlock( &g_prefetch_mutex );
+
+	return budget;
+}
+
+/** Report the prefetch counters.
+*/
+
+void melted_prefetch_report( mvcp_response response )
+{
+	pthread_mutex_lock( &g_prefetch_mutex );
+	if ( g_budget > 0 )
+	{
+		mvcp_response_printf( response, 1024, "prefetch.budget=%lld\n", ( long long )g_budget );
+		mvcp_response_printf( response, 1024, "prefetch.bytes=%lld\n", ( long long )g_issued );
+		mvcp_response_printf( response, 1024, "prefetch.wanted=%lld\n", ( long long )g_wanted );
+		mvcp_response_printf( response, 1024, "prefetch.resident=%lld\n", ( long long )g_resident );
+	}
+	pthread_mutex_unlock( &g_prefetch_mutex );
+}
+
+/** Stop prefetching.
+*/
+
+void melted_prefetch_close( void )
+{
+	melted_prefetch_set_budget( 0 );
+	pthread_mutex_lock( &g_prefetch_mutex );
+	mlt_properties_close( g_advised );
+	g_advised = NULL;
+	pthread_mutex_unlock( &g_prefetch_mutex );
+}
@@ -0,0 +1,50 @@
+/*
+ * melted_prefetch.h -- Storage Prefetcher
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_PREFETCH_H_
+#define _MELTED_PREFETCH_H_
+
+/* System header files */
+#include <stdint.h>
+
+/* Application header files */
+#include <mvcp/mvcp_response.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Prefetch API.
+
+    A server thread asks the kernel to read ahead the media each unit plays
+    and the starts of the clips following it.
+*/
+
+extern void melted_prefetch_set_budget( int64_t bytes );
+extern int64_t melted_prefetch_get_budget( void );
+extern void melted_prefetch_report( mvcp_response response );
+extern void melted_prefetch_close( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
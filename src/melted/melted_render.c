@@ -0,0 +1,206 @@
+/*
+ * melted_render.c -- Background Composition Renderer
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+/* Application header files */
+#include "melted_render.h"
+#include "melted_log.h"
+
+/** Nice value of the render threads.
+*/
+
+#define RENDER_NICE 19
+
+/** The render thread.
+
+    The state and cancel flags are shared with the unit's worker thread and
+    only accessed atomically. The priority is lowered before the consumer is created so that the
+    threads it starts run below the units playing to air.
+*/
+
+static void *render_worker( void *arg )
+{
+	melted_render render = arg;
+	struct timespec tm = { 0, 100000000 };
+	mlt_producer producer;
+	mlt_consumer consumer = NULL;
+	int error = 1;
+
+#ifdef __linux__
+	setpriority( PRIO_PROCESS, syscall( SYS_gettid ), RENDER_NICE );
+#endif
+
+	producer = mlt_factory_producer( render->profile, "xml", render->source );
+	if ( producer != NULL )
+		consumer = mlt_factory_consumer( render->profile, "avformat", render->partial );
+	if ( consumer != NULL )
+	{
+		mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+		mlt_properties_set_int( properties, "real_time", -1 );
+		mlt_properties_set_int( properties, "terminate_on_pause", 1 );
+		mlt_properties_inherit( properties, render->options );
+		mlt_consumer_connect( consumer, MLT_PRODUCER_SERVICE( producer ) );
+		if ( mlt_consumer_start( consumer ) == 0 )
+		{
+			while ( !melted_render_cancelled( render ) && !mlt_consumer_is_stopped( consumer ) )
+				nanosleep( &tm, NULL );
+			mlt_consumer_stop( consumer );
+			error = melted_render_cancelled( render );
+		}
+		mlt_consumer_close( consumer );
+	}
+	mlt_producer_close( producer );
+
+	if ( error == 0 && rename( render->partial, render->target ) == 0 )
+	{
+		melted_log( LOG_INFO, "rendered %s", render->target );
+		__sync_bool_compare_and_swap( &render->state, 0, 1 );
+	}
+	else
+	{
+		if ( !melted_render_cancelled( render ) )
+			melted_log( LOG_WARNING, "unable to render %s", render->source );
+		unlink( render->partial );
+		__sync_bool_compare_and_swap( &render->state, 0, -1 );
+	}
+
+	return NULL;
+}
+
+/** Start rendering a saved composition.
+
+    The file is written aside and only appears under the target name once
+    it is complete.
+
+    \param options Properties of the avformat consumer, such as vcodec.
+    \return The render or NULL if it could not be started.
+*/
+
+melted_render melted_render_start( mlt_profile profile, const char *source, const char *target, mlt_properties options )
+{
+	melted_render render = calloc( 1, sizeof( melted_render_t ) );
+	const char *name = strrchr( target, '/' );
+
+	if ( render != NULL )
+	{
+		size_t length = strlen( target ) + 2;
+		char *description;
+
+		// The render keeps its own copy of the profile of the unit's consumer
+		render->profile = mlt_profile_init( NULL );
+		description = render->profile->description;
+		*render->profile = *profile;
+		render->profile->description = description;
+		render->options = mlt_properties_new( );
+		mlt_properties_inherit( render->options, options );
+		render->source = strdup( source );
+		render->target = strdup( target );
+		render->partial = malloc( length );
+
+		// A hidden name keeps the partial file out of CLS
+		name = name != NULL ? name + 1 : target;
+		snprintf( render->partial, length, "%.*s.%s", ( int )( name - target ), target, name );
+
+		if ( pthread_create( &render->thread, NULL, render_worker, render ) != 0 )
+		{
+			mlt_profile_close( render->profile );
+			mlt_properties_close( render->options );
+			free( render->source );
+			free( render->target );
+			free( render->partial );
+			free( render );
+			render = NULL;
+		}
+	}
+
+	return render;
+}
+
+/** Get the state of a render.
+
+    \return 0 while rendering, 1 once the target is complete, -1 if it failed
+            or was cancelled.
+*/
+
+int melted_render_state( melted_render render )
+{
+	return __sync_fetch_and_add( &render->state, 0 );
+}
+
+/** Ask a render to stop without waiting for it.
+
+    The state becomes -1 once the render thread has given up, after which
+    melted_render_close returns without delay.
+*/
+
+void melted_render_cancel( melted_render render )
+{
+	__sync_bool_compare_and_swap( &render->cancel, 0, 1 );
+}
+
+/** Determine if a render has been asked to stop.
+*/
+
+int melted_render_cancelled( melted_render render )
+{
+	return __sync_fetch_and_add( &render->cancel, 0 );
+}
+
+/** Get the file a render writes.
+*/
+
+const char *melted_render_target( melted_render render )
+{
+	return render->target;
+}
+
+/** Cancel a render if it is still running and release it.
+
+    A completed target is left in place.
+*/
+
+void melted_render_close( melted_render render )
+{
+	if ( render != NULL )
+	{
+		melted_render_cancel( render );
+		pthread_join( render->thread, NULL );
+		unlink( render->source );
+		mlt_profile_close( render->profile );
+		mlt_properties_close( render->options );
+		free( render->source );
+		free( render->target );
+		free( render->partial );
+		free( render );
+	}
+}
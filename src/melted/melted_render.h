@@ -0,0 +1,63 @@
+/*
+ * melted_render.h -- Background Composition Renderer
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_RENDER_H_
+#define _MELTED_RENDER_H_
+
+/* System header files */
+#include <pthread.h>
+
+/* MLT header files */
+#include <framework/mlt_profile.h>
+#include <framework/mlt_properties.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** A render of a saved composition to a media file on its own thread.
+*/
+
+typedef struct
+{
+	pthread_t thread;
+	mlt_profile profile;
+	mlt_properties options;
+	char *source;
+	char *target;
+	char *partial;
+	int cancel;
+	int state;
+}
+*melted_render, melted_render_t;
+
+extern melted_render melted_render_start( mlt_profile profile, const char *source, const char *target, mlt_properties options );
+extern int melted_render_state( melted_render render );
+extern void melted_render_cancel( melted_render render );
+extern int melted_render_cancelled( melted_render render );
+extern const char *melted_render_target( melted_render render );
+extern void melted_render_close( melted_render render );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
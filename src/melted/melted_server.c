@@ -40,6 +40,8 @@
 #include "melted_server.h"
 #include "melted_connection.h"
 #include "melted_local.h"
+#include "melted_shard.h"
+#include "melted_startup.h"
 #include "melted_log.h"
 #include "melted_commands.h"
 #include <mvcp/mvcp_remote.h>
@@ -119,6 +121,28 @@ void melted_server_set_proxy( melted_server server, char *proxy )
 	mvcp_tokeniser_close( tokeniser );
 }
 
+/** Set the address the server listens on - all interfaces by default.
+*/
+
+void melted_server_set_address( melted_server server, const char *address )
+{
+	free( server->address );
+	server->address = address != NULL ? strdup( address ) : NULL;
+}
+
+/** Run the units in the given number of worker processes.
+
+    The server then only routes commands to the workers, which are started
+    with the mode option (-test or -nodetach) on the ports after its own.
+*/
+
+void melted_server_set_shards( melted_server server, int shards, const char *mode )
+{
+	server->shards = shards;
+	free( server->shard_mode );
+	server->shard_mode = mode != NULL ? strdup( mode ) : NULL;
+}
+
 /** Wait for a connection.
 */
 
@@ -193,10 +217,11 @@ int melted_server_execute( melted_server server )
 	int flag = 1;
 
 	server->shutdown = 0;
+	server->stopping = 0;
 
 	ServerAddr.sin_family = AF_INET;
 	ServerAddr.sin_port = htons( server->port );
-	ServerAddr.sin_addr.s_addr = INADDR_ANY;
+	ServerAddr.sin_addr.s_addr = server->address != NULL ? inet_addr( server->address ) : INADDR_ANY;
 	
 	/* Create socket, and bind to port. Listen there. Backlog = 5
 	   should be sufficient for listen (). */
@@ -232,7 +257,14 @@ int melted_server_execute( melted_server server )
 	fcntl( server->socket, F_SETFL, O_NONBLOCK );
 #endif
 
-	if ( !server->proxy )
+	if ( server->shards > 0 )
+	{
+		melted_log( LOG_NOTICE, "Starting server on %d with %d workers.", server->port, server->shards );
+		server->parser = melted_parser_init_shard( server->id, server->shards, server->port + 1, server->shard_mode, &server->stopping );
+		/* Leave PUSHed documents for the workers to parse */
+		mlt_properties_set_int( &server->parent, "push-parser-off", 1 );
+	}
+	else if ( !server->proxy )
 	{
 		melted_log( LOG_NOTICE, "Starting server on %d.", server->port );
 		server->parser = melted_parser_init_local( );
@@ -257,7 +289,7 @@ int melted_server_execute( melted_server server )
 	if ( !server->proxy && server->config != NULL )
 	{
 		mvcp_response_close( response );
-		response = mvcp_parser_run( server->parser, server->config );
+		response = melted_startup_run( server->parser, server->config );
 
 		if ( response == NULL )
 		{
@@ -269,7 +301,7 @@ int melted_server_execute( melted_server server )
 		if ( mvcp_response_count( response ) > 1 )
 		{
 			if ( mvcp_response_get_error_code( response ) > 299 )
-				melted_log( LOG_ERR, "Error evaluating server configuration. Processing stopped." );
+				melted_log( LOG_ERR, "Error evaluating server configuration %s. Processing stopped.", server->config );
 			for ( index = 0; index < mvcp_response_count( response ); index ++ )
 				melted_log( LOG_DEBUG, "%4d: %s", index, mvcp_response_get_line( response, index ) );
 		}
@@ -287,7 +319,8 @@ int melted_server_execute( melted_server server )
 	return error;
 }
 
-/** Fetch a units properties
+/** Fetch a units properties - the unit may be deleted by a command unless
+    the caller is between melted_units_enter and melted_units_leave.
 */
 
 mlt_properties melted_server_fetch_unit( melted_server server, int index )
@@ -321,6 +354,8 @@ void melted_server_close( melted_server server )
 	{
 		mlt_properties_close( &server->parent );
 		melted_server_shutdown( server );
+		free( server->address );
+		free( server->shard_mode );
 		free( server );
 	}
 }
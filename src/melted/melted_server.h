@@ -49,10 +49,14 @@ typedef struct
 	mvcp_parser parser;
 	pthread_t thread;
 	int shutdown;
+	int stopping;
 	int proxy;
 	char remote_server[ 50 ];
 	int remote_port;
 	char *config;
+	char *address;
+	int shards;
+	char *shard_mode;
 }
 *melted_server, melted_server_t;
 
@@ -64,6 +68,8 @@ extern const char *melted_server_id( melted_server );
 extern void melted_server_set_config( melted_server, const char * );
 extern void melted_server_set_port( melted_server, int );
 extern void melted_server_set_proxy( melted_server, char * );
+extern void melted_server_set_address( melted_server, const char * );
+extern void melted_server_set_shards( melted_server, int, const char * );
 extern int melted_server_execute( melted_server );
 extern mlt_properties melted_server_fetch_unit( melted_server, int );
 extern void melted_server_shutdown( melted_server );
@@ -0,0 +1,734 @@
+/*
+ * melted_shard.c -- Sharding Melted Parser
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef linux
+#include <sys/prctl.h>
+#endif
+
+/* mvcp header files */
+#include <mvcp/mvcp_remote.h>
+#include <mvcp/mvcp_socket.h>
+#include <mvcp/mvcp_tokeniser.h>
+#include <mvcp/mvcp_util.h>
+
+/* Application header files */
+#include "melted_shard.h"
+#include "melted_connection.h"
+#include "melted_log.h"
+
+/** A worker process and the remote parser connected to it.
+*/
+
+typedef struct melted_shard_s *melted_shard;
+
+typedef struct
+{
+	melted_shard shard;
+	int index;
+	pid_t pid;
+	int port;
+	int units;
+	mvcp_parser remote;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+}
+shard_worker;
+
+/** Private melted_shard structure.
+
+    Unit n lives on worker n % count - each worker only allocates unit
+    numbers in its own residue class, so commands, responses and status
+    lines pass through unchanged.
+*/
+
+struct melted_shard_s
+{
+	mvcp_parser parser;
+	char *program;
+	char *mode;
+	int port;
+	int count;
+	shard_worker *workers;
+	pthread_t monitor;
+	int terminated;
+	int *stopping;
+};
+
+/** Forward declarations.
+*/
+
+static mvcp_response melted_shard_connect( melted_shard );
+static mvcp_response melted_shard_execute( melted_shard, char * );
+static mvcp_response melted_shard_push( melted_shard, char *, mlt_service );
+static mvcp_response melted_shard_receive( melted_shard, char *, char * );
+static void melted_shard_close( melted_shard );
+
+/** MVCP Parser constructor.
+
+    \param program The melted executable to run for each worker.
+    \param count The number of worker processes.
+    \param port The port of the first worker - the others follow it.
+    \param mode The option selecting how workers log (-test or -nodetach).
+    \param stopping Set to 1 once SHUTDOWN has stopped the workers, for the
+           server to shut down as usual.
+*/
+
+mvcp_parser melted_parser_init_shard( const char *program, int count, int port, const char *mode, int *stopping )
+{
+	mvcp_parser parser = calloc( 1, sizeof( mvcp_parser_t ) );
+	melted_shard shard = calloc( 1, sizeof( struct melted_shard_s ) );
+
+	if ( parser != NULL )
+	{
+		parser->connect = (parser_connect)melted_shard_connect;
+		parser->execute = (parser_execute)melted_shard_execute;
+		parser->push = (parser_push)melted_shard_push;
+		parser->received = (parser_received)melted_shard_receive;
+		parser->close = (parser_close)melted_shard_close;
+		parser->real = shard;
+
+		if ( shard != NULL )
+		{
+			int index;
+			shard->parser = parser;
+			shard->program = strdup( program );
+			shard->mode = strdup( mode != NULL ? mode : "-nodetach" );
+			shard->port = port;
+			shard->stopping = stopping;
+			shard->count = count > 0 ? count : 1;
+			shard->workers = calloc( shard->count, sizeof( shard_worker ) );
+			for ( index = 0; shard->workers != NULL && index < shard->count; index ++ )
+			{
+				shard->workers[ index ].shard = shard;
+				shard->workers[ index ].index = index;
+				shard->workers[ index ].port = port + index;
+				pthread_mutex_init( &shard->workers[ index ].mutex, NULL );
+			}
+		}
+	}
+	return parser;
+}
+
+/** Create a response carrying only an error.
+*/
+
+static mvcp_response shard_error( int code, const char *message )
+{
+	mvcp_response response = mvcp_response_init( );
+	mvcp_response_set_error( response, code, message );
+	return response;
+}
+
+/** Start the process for a worker.
+*/
+
+static int spawn_worker( melted_shard shard, shard_worker *worker )
+{
+	char port[ 20 ];
+	char numbering[ 40 ];
+	pid_t pid;
+
+	sprintf( port, "%d", worker->port );
+	sprintf( numbering, "%d:%d", worker->index, shard->count );
+
+	pid = fork( );
+	if ( pid == 0 )
+	{
+#ifdef linux
+		/* Do not outlive the front end */
+		prctl( PR_SET_PDEATHSIG, SIGTERM );
+
+		/* Run this very executable, however it was started */
+		execl( "/proc/self/exe", shard->program, shard->mode, "-port", port, "-worker", numbering, NULL );
+#endif
+		execlp( shard->program, shard->program, shard->mode, "-port", port, "-worker", numbering, NULL );
+		_exit( EXIT_FAILURE );
+	}
+	worker->pid = pid;
+	worker->units = 0;
+
+	if ( pid < 0 )
+		melted_log( LOG_ERR, "Unable to start worker %d", worker->index );
+	else
+		melted_log( LOG_NOTICE, "Started worker %d (pid %d) on port %d", worker->index, pid, worker->port );
+
+	return pid > 0 ? 0 : -1;
+}
+
+/** Wait until a worker accepts connections.
+*/
+
+static int wait_for_worker( shard_worker *worker )
+{
+	struct timespec tm = { 0, 100000000 };
+	int tries;
+
+	for ( tries = 0; tries < 100; tries ++ )
+	{
+		mvcp_socket socket = mvcp_socket_init( "127.0.0.1", worker->port );
+		int error = mvcp_socket_connect( socket );
+		mvcp_socket_close( socket );
+		if ( error == 0 )
+			return 0;
+		nanosleep( &tm, NULL );
+	}
+	return -1;
+}
+
+/** Connect the remote parser of a worker.
+*/
+
+static int connect_worker( shard_worker *worker )
+{
+	int error = wait_for_worker( worker );
+
+	if ( error == 0 )
+	{
+		mvcp_response response = mvcp_parser_connect( worker->remote );
+		error = mvcp_response_get_error_code( response ) != 100;
+		mvcp_response_close( response );
+	}
+	if ( error )
+		melted_log( LOG_ERR, "Unable to connect to worker %d on port %d", worker->index, worker->port );
+
+	return error;
+}
+
+/** Copy the worker statuses which differ into the merged notifier.
+*/
+
+static void sync_statuses( mvcp_notifier notifier, mvcp_notifier merged )
+{
+	int count = mvcp_notifier_units( notifier, NULL, 0 );
+	int *units = malloc( ( count + 1 ) * sizeof( int ) );
+	int index;
+
+	if ( units != NULL )
+	{
+		int stored = mvcp_notifier_units( notifier, units, count );
+		if ( stored < count )
+			count = stored;
+		for ( index = 0; index < count; index ++ )
+		{
+			mvcp_status_t status;
+			mvcp_status_t current;
+			mvcp_notifier_get( notifier, &status, units[ index ] );
+			mvcp_notifier_get( merged, &current, units[ index ] );
+			current.dummy = status.dummy;
+			if ( mvcp_status_compare( &status, &current ) )
+				mvcp_notifier_put( merged, &status );
+		}
+		free( units );
+	}
+}
+
+/** Thread merging the status stream of a worker into ours.
+*/
+
+static void *shard_forward_thread( void *arg )
+{
+	shard_worker *worker = arg;
+	melted_shard shard = worker->shard;
+	mvcp_notifier notifier = mvcp_parser_get_notifier( worker->remote );
+	mvcp_notifier merged = mvcp_parser_get_notifier( shard->parser );
+	mvcp_status_t status;
+
+	while ( !shard->terminated )
+	{
+		if ( mvcp_notifier_wait( notifier, &status ) == 0 && status.status == unit_undefined )
+			mvcp_notifier_remove( merged, status.unit );
+		sync_statuses( notifier, merged );
+	}
+
+	return NULL;
+}
+
+/** Forget the units of a worker which has gone away.
+*/
+
+static void forget_units( melted_shard shard, shard_worker *worker )
+{
+	mvcp_notifier merged = mvcp_parser_get_notifier( shard->parser );
+	int count = mvcp_notifier_units( merged, NULL, 0 );
+	int *units = malloc( ( count + 1 ) * sizeof( int ) );
+	int index;
+
+	if ( units != NULL )
+	{
+		int stored = mvcp_notifier_units( merged, units, count );
+		if ( stored < count )
+			count = stored;
+		for ( index = 0; index < count; index ++ )
+			if ( units[ index ] % shard->count == worker->index )
+				mvcp_notifier_remove( merged, units[ index ] );
+		free( units );
+	}
+}
+
+/** Thread restarting workers which exit.
+*/
+
+static void *shard_monitor_thread( void *arg )
+{
+	melted_shard shard = arg;
+	struct timespec tm = { 1, 0 };
+	int index;
+
+	while ( !shard->terminated )
+	{
+		nanosleep( &tm, NULL );
+
+		for ( index = 0; !shard->terminated && index < shard->count; index ++ )
+		{
+			shard_worker *worker = &shard->workers[ index ];
+			int status = 0;
+
+			if ( worker->pid > 0 && waitpid( worker->pid, &status, WNOHANG ) == worker->pid )
+			{
+				melted_log( LOG_ERR, "Worker %d (pid %d) exited with status %d - its units are lost, restarting",
+					index, worker->pid, WIFEXITED( status ) ? WEXITSTATUS( status ) : -WTERMSIG( status ) );
+				pthread_mutex_lock( &worker->mutex );
+				forget_units( shard, worker );
+				if ( spawn_worker( shard, worker ) == 0 )
+					connect_worker( worker );
+				pthread_mutex_unlock( &worker->mutex );
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/** The shard whose workers are stopped on a signal.
+*/
+
+static melted_shard g_signal_shard = NULL;
+
+/** Stop the workers and exit on the usual signals.
+
+    Only async-signal-safe calls are made here, so the server is not closed
+    as on SHUTDOWN; the workers are terminated directly.
+*/
+
+static void signal_handler( int sig )
+{
+	melted_shard shard = g_signal_shard;
+	int index;
+
+	for ( index = 0; shard != NULL && index < shard->count; index ++ )
+		if ( shard->workers[ index ].pid > 0 )
+			kill( shard->workers[ index ].pid, SIGTERM );
+	for ( index = 0; shard != NULL && index < shard->count; index ++ )
+		if ( shard->workers[ index ].pid > 0 )
+			waitpid( shard->workers[ index ].pid, NULL, 0 );
+	_exit( EXIT_SUCCESS );
+}
+
+/** Start and connect to the workers.
+*/
+
+static mvcp_response melted_shard_connect( melted_shard shard )
+{
+	int error = shard == NULL || shard->workers == NULL;
+	int index;
+
+	if ( error )
+		return NULL;
+
+	g_signal_shard = shard;
+	signal( SIGHUP, signal_handler );
+	signal( SIGINT, signal_handler );
+	signal( SIGTERM, signal_handler );
+	signal( SIGPIPE, SIG_IGN );
+
+	mvcp_parser_get_notifier( shard->parser );
+
+	for ( index = 0; !error && index < shard->count; index ++ )
+	{
+		shard_worker *worker = &shard->workers[ index ];
+		worker->remote = mvcp_parser_init_remote_id( "127.0.0.1", worker->port );
+		mvcp_parser_get_notifier( worker->remote );
+		error = spawn_worker( shard, worker ) || connect_worker( worker );
+		if ( !error )
+			pthread_create( &worker->thread, NULL, shard_forward_thread, worker );
+	}
+
+	if ( error )
+		return NULL;
+
+	pthread_create( &shard->monitor, NULL, shard_monitor_thread, shard );
+
+	return shard_error( 100, "VTR Ready" );
+}
+
+/** Execute a command on a worker.
+*/
+
+static mvcp_response worker_execute( shard_worker *worker, char *command )
+{
+	mvcp_response response;
+	pthread_mutex_lock( &worker->mutex );
+	response = mvcp_parser_execute( worker->remote, command );
+	pthread_mutex_unlock( &worker->mutex );
+	if ( response == NULL )
+		response = shard_error( RESPONSE_ERROR, "Worker unavailable" );
+	return response;
+}
+
+/** Parse a unit argument.
+*/
+
+static int parse_unit( const char *string )
+{
+	if ( string != NULL && ( string[ 0 ] == 'U' || string[ 0 ] == 'u' ) && string[ 1 ] != '\0' &&
+		 strspn( string + 1, "0123456789" ) == strlen( string + 1 ) )
+		return atoi( string + 1 );
+	return -1;
+}
+
+/** Get the worker which owns a unit.
+*/
+
+static shard_worker *unit_worker( melted_shard shard, int unit )
+{
+	return &shard->workers[ unit % shard->count ];
+}
+
+/** Add a unit on the worker with the fewest units.
+*/
+
+static mvcp_response shard_add_unit( melted_shard shard, char *command )
+{
+	shard_worker *worker = &shard->workers[ 0 ];
+	mvcp_response response;
+	int index;
+
+	for ( index = 1; index < shard->count; index ++ )
+		if ( shard->workers[ index ].units < worker->units )
+			worker = &shard->workers[ index ];
+
+	response = worker_execute( worker, command );
+	if ( mvcp_response_get_error_code( response ) == RESPONSE_SUCCESS_N )
+		__sync_fetch_and_add( &worker->units, 1 );
+
+	return response;
+}
+
+/** Compare unit rows for sorting.
+*/
+
+static int compare_rows( const void *a, const void *b )
+{
+	return atoi( *( char * const * )a + 1 ) - atoi( *( char * const * )b + 1 );
+}
+
+/** Merge the unit lists of all workers.
+*/
+
+static mvcp_response shard_list_units( melted_shard shard, char *command )
+{
+	mvcp_response response = shard_error( RESPONSE_SUCCESS_N, "OK" );
+	mvcp_response *lists = calloc( shard->count, sizeof( mvcp_response ) );
+	char **rows = NULL;
+	int count = 0;
+	int index;
+	int line;
+
+	for ( index = 0; lists != NULL && index < shard->count; index ++ )
+	{
+		lists[ index ] = worker_execute( &shard->workers[ index ], command );
+		if ( mvcp_response_get_error_code( lists[ index ] ) != RESPONSE_SUCCESS_N )
+			continue;
+		for ( line = 1; line < mvcp_response_count( lists[ index ] ); line ++ )
+		{
+			char *row = mvcp_response_get_line( lists[ index ], line );
+			char **grown = strcmp( row, "" ) ? realloc( rows, ( count + 1 ) * sizeof( char * ) ) : NULL;
+			if ( grown != NULL )
+			{
+				rows = grown;
+				rows[ count ++ ] = row;
+			}
+		}
+	}
+
+	qsort( rows, count, sizeof( char * ), compare_rows );
+	for ( line = 0; line < count; line ++ )
+		mvcp_response_printf( response, 1024, "%s\n", rows[ line ] );
+	mvcp_response_printf( response, 1024, "\n" );
+
+	for ( index = 0; lists != NULL && index < shard->count; index ++ )
+		mvcp_response_close( lists[ index ] );
+	free( lists );
+	free( rows );
+
+	return response;
+}
+
+/** Report the statistics of each worker, prefixed by worker number.
+*/
+
+static mvcp_response shard_stats( melted_shard shard, char *command )
+{
+	mvcp_response response = shard_error( RESPONSE_SUCCESS_N, "OK" );
+	int index;
+	int line;
+
+	mvcp_response_printf( response, 1024, "workers=%d\n", shard->count );
+	for ( index = 0; index < shard->count; index ++ )
+	{
+		mvcp_response temp = worker_execute( &shard->workers[ index ], command );
+		mvcp_response_printf( response, 1024, "w%d.pid=%d\n", index, shard->workers[ index ].pid );
+		for ( line = 1; line < mvcp_response_count( temp ); line ++ )
+			if ( strcmp( mvcp_response_get_line( temp, line ), "" ) )
+				mvcp_response_printf( response, 1024, "w%d.%s\n", index, mvcp_response_get_line( temp, line ) );
+		mvcp_response_close( temp );
+	}
+	mvcp_response_printf( response, 1024, "\n" );
+
+	return response;
+}
+
+/** Execute a command on every worker, returning the first failure.
+*/
+
+static mvcp_response shard_broadcast( melted_shard shard, char *command )
+{
+	mvcp_response response = NULL;
+	int index;
+
+	for ( index = 0; index < shard->count; index ++ )
+	{
+		mvcp_response temp = worker_execute( &shard->workers[ index ], command );
+		if ( response == NULL || ( mvcp_response_get_error_code( response ) < 300 && mvcp_response_get_error_code( temp ) >= 300 ) )
+		{
+			mvcp_response_close( response );
+			response = temp;
+		}
+		else
+		{
+			mvcp_response_close( temp );
+		}
+	}
+
+	return response;
+}
+
+/** Route a unit command to the worker owning the unit.
+*/
+
+static mvcp_response shard_unit_execute( melted_shard shard, int unit, mvcp_tokeniser tokeniser, char *command )
+{
+	char *name = mvcp_tokeniser_get_string( tokeniser, 0 );
+	shard_worker *worker = unit_worker( shard, unit );
+	mvcp_response response;
+
+	/* Clips can only move between units of the same worker */
+	if ( !strcasecmp( name, "XFER" ) )
+	{
+		int dest = parse_unit( mvcp_tokeniser_get_string( tokeniser, 2 ) );
+		if ( dest >= 0 && unit_worker( shard, dest ) != worker )
+			return shard_error( RESPONSE_ERROR, "Units are on different workers" );
+	}
+
+	response = worker_execute( worker, command );
+
+	if ( !strcasecmp( name, "UDEL" ) && mvcp_response_get_error_code( response ) == RESPONSE_SUCCESS )
+		__sync_fetch_and_sub( &worker->units, 1 );
+
+	return response;
+}
+
+/** Commands which do not address a unit - the first worker answers those
+    not handled here.
+*/
+
+static const char *global_commands[] = { "HELP", "NLS", "UADD", "ULS", "CLS", "MLS", "SET", "GET", "STATS", "RUN", "SHUTDOWN", NULL };
+
+static int is_global( const char *name )
+{
+	int index;
+	for ( index = 0; global_commands[ index ] != NULL; index ++ )
+		if ( !strcasecmp( global_commands[ index ], name ) )
+			return 1;
+	return 0;
+}
+
+/** Execute the command.
+*/
+
+static mvcp_response melted_shard_execute( melted_shard shard, char *command )
+{
+	mvcp_response response = NULL;
+	mvcp_tokeniser tokeniser = mvcp_tokeniser_init( );
+	char *copy = strdup( command );
+	char *name = NULL;
+	int unit = -1;
+
+	if ( mvcp_tokeniser_parse_new( tokeniser, copy, " " ) > 0 )
+	{
+		int index;
+		for ( index = 0; index < mvcp_tokeniser_count( tokeniser ); index ++ )
+			mvcp_util_strip( mvcp_tokeniser_get_string( tokeniser, index ), '\"' );
+		name = mvcp_tokeniser_get_string( tokeniser, 0 );
+		unit = parse_unit( mvcp_tokeniser_get_string( tokeniser, 1 ) );
+	}
+
+	if ( name == NULL )
+		response = shard_error( RESPONSE_UNKNOWN_COMMAND, "Unknown command" );
+	else if ( !strcasecmp( name, "UADD" ) )
+		response = shard_add_unit( shard, command );
+	else if ( !strcasecmp( name, "ULS" ) )
+		response = shard_list_units( shard, command );
+	else if ( !strcasecmp( name, "STATS" ) )
+		response = shard_stats( shard, command );
+	else if ( !strcasecmp( name, "SET" ) )
+		response = shard_broadcast( shard, command );
+	else if ( !strcasecmp( name, "SHUTDOWN" ) )
+	{
+		// Keep the monitor from restarting the workers as they exit
+		shard->terminated = 1;
+		mvcp_response_close( shard_broadcast( shard, command ) );
+		if ( shard->stopping != NULL )
+			*shard->stopping = 1;
+		response = shard_error( RESPONSE_SUCCESS, "OK" );
+	}
+	else if ( !strcasecmp( name, "RUN" ) && mvcp_tokeniser_count( tokeniser ) > 1 )
+		response = mvcp_parser_run( shard->parser, mvcp_tokeniser_get_string( tokeniser, 1 ) );
+	else if ( unit >= 0 && !is_global( name ) )
+		response = shard_unit_execute( shard, unit, tokeniser, command );
+	else
+		response = worker_execute( &shard->workers[ 0 ], command );
+
+	mvcp_tokeniser_close( tokeniser );
+	free( copy );
+
+	return response;
+}
+
+/** Get the worker addressed by a PUSH command.
+*/
+
+static shard_worker *push_worker( melted_shard shard, char *command )
+{
+	mvcp_tokeniser tokeniser = mvcp_tokeniser_init( );
+	shard_worker *worker = NULL;
+	int unit;
+
+	mvcp_tokeniser_parse_new( tokeniser, command, " " );
+	unit = parse_unit( mvcp_tokeniser_get_string( tokeniser, 1 ) );
+	if ( unit >= 0 )
+		worker = unit_worker( shard, unit );
+	mvcp_tokeniser_close( tokeniser );
+
+	return worker;
+}
+
+/** Forward a MLT XML document to the worker owning the unit.
+*/
+
+static mvcp_response melted_shard_receive( melted_shard shard, char *command, char *doc )
+{
+	shard_worker *worker = push_worker( shard, command );
+	mvcp_response response = NULL;
+
+	if ( worker == NULL )
+		return shard_error( RESPONSE_MISSING_ARG, "Argument missing" );
+
+	pthread_mutex_lock( &worker->mutex );
+	response = mvcp_parser_received( worker->remote, command, doc );
+	pthread_mutex_unlock( &worker->mutex );
+
+	return response != NULL ? response : shard_error( RESPONSE_ERROR, "Worker unavailable" );
+}
+
+/** Forward a producer to the worker owning the unit.
+*/
+
+static mvcp_response melted_shard_push( melted_shard shard, char *command, mlt_service service )
+{
+	shard_worker *worker = push_worker( shard, command );
+	mvcp_response response = NULL;
+
+	if ( worker == NULL )
+		return shard_error( RESPONSE_MISSING_ARG, "Argument missing" );
+
+	pthread_mutex_lock( &worker->mutex );
+	response = mvcp_parser_push( worker->remote, command, service );
+	pthread_mutex_unlock( &worker->mutex );
+
+	return response != NULL ? response : shard_error( RESPONSE_ERROR, "Worker unavailable" );
+}
+
+/** Stop the workers and close the parser.
+
+    Each forwarding thread is woken from its notifier wait before it is
+    joined.
+*/
+
+static void melted_shard_close( melted_shard shard )
+{
+	mvcp_status_t wake;
+	int index;
+
+	if ( shard == NULL )
+		return;
+
+	shard->terminated = 1;
+	if ( shard->monitor )
+		pthread_join( shard->monitor, NULL );
+
+	memset( &wake, 0, sizeof( wake ) );
+	wake.unit = -1;
+	wake.status = unit_disconnected;
+
+	for ( index = 0; shard->workers != NULL && index < shard->count; index ++ )
+	{
+		shard_worker *worker = &shard->workers[ index ];
+		if ( worker->pid > 0 )
+		{
+			kill( worker->pid, SIGTERM );
+			waitpid( worker->pid, NULL, 0 );
+		}
+		if ( worker->thread )
+		{
+			mvcp_notifier_put( mvcp_parser_get_notifier( worker->remote ), &wake );
+			pthread_join( worker->thread, NULL );
+		}
+		mvcp_parser_close( worker->remote );
+		pthread_mutex_destroy( &worker->mutex );
+	}
+
+	melted_log( LOG_DEBUG, "Stopped %d workers.", shard->count );
+
+	free( shard->workers );
+	free( shard->program );
+	free( shard->mode );
+	free( shard );
+}
@@ -0,0 +1,41 @@
+/*
+ * melted_shard.h -- Sharding Melted Parser
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_SHARD_H_
+#define _MELTED_SHARD_H_
+
+/* Application header files */
+#include <mvcp/mvcp_parser.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Sharding parser API.
+*/
+
+extern mvcp_parser melted_parser_init_shard( const char *program, int count, int port, const char *mode, int *stopping );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
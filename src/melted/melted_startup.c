@@ -0,0 +1,442 @@
+/*
+ * melted_startup.c -- Parallel Configuration Startup
+ * Copyright (C) 2002-2009 Ushodaya Enterprises Limited
+ * Author: Dan Dennedy <dan@dennedy.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Application header files */
+#include "melted_startup.h"
+#include "melted_commands.h"
+#include "melted_log.h"
+#include <mvcp/mvcp_tokeniser.h>
+#include <mvcp/mvcp_util.h>
+
+/** One command of the configuration.
+*/
+
+typedef struct
+{
+	char *command;
+	mvcp_response response;
+	int64_t start;
+	int64_t end;
+}
+startup_line;
+
+struct startup_s;
+
+/** A lane runs the commands of one unit in order, starting with the UADD
+    which created it.
+*/
+
+typedef struct
+{
+	struct startup_s *startup;
+	pthread_t thread;
+	int unit;
+	int *queue;
+	int head;
+	int count;
+	int64_t ready;
+}
+startup_lane;
+
+/** The state of a configuration run.
+*/
+
+typedef struct startup_s
+{
+	mvcp_parser parser;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	startup_line *lines;
+	int count;
+	startup_lane **lanes;
+	int lane_count;
+	int finished;
+	int failed;
+	int64_t origin;
+}
+*melted_startup, melted_startup_t;
+
+/** Unit number still to be reported by a UADD.
+*/
+
+#define UNIT_PENDING -2
+
+/** Obtain a monotonic time stamp in microseconds.
+*/
+
+static int64_t time_now( )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return ( int64_t )now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** Parse a unit argument such as U1.
+
+    \return The unit number or -1 if the string does not name a unit.
+*/
+
+static int parse_unit( const char *string )
+{
+	if ( string != NULL && ( string[ 0 ] == 'U' || string[ 0 ] == 'u' ) && string[ 1 ] != '\0' &&
+		 strspn( string + 1, "0123456789" ) == strlen( string + 1 ) )
+		return atoi( string + 1 );
+	return -1;
+}
+
+/** Read the commands of a configuration file, skipping blank lines and
+    comments.
+
+    \return 0 on success.
+*/
+
+static int read_lines( melted_startup startup, char *filename )
+{
+	FILE *file = fopen( filename, "r" );
+	char command[ 1024 ];
+
+	if ( file == NULL )
+		return -1;
+
+	while ( fgets( command, 1024, file ) )
+	{
+		mvcp_util_trim( mvcp_util_chomp( command ) );
+		if ( strcmp( command, "" ) && command[ 0 ] != '#' )
+		{
+			startup_line *lines = realloc( startup->lines, ( startup->count + 1 ) * sizeof( startup_line ) );
+			if ( lines == NULL )
+				break;
+			startup->lines = lines;
+			memset( &lines[ startup->count ], 0, sizeof( startup_line ) );
+			lines[ startup->count ++ ].command = strdup( command );
+		}
+	}
+	fclose( file );
+
+	return 0;
+}
+
+/** Receive the unit number reserved by the UADD of a lane.
+*/
+
+static void lane_reserved( void *arg, int unit )
+{
+	startup_lane *lane = arg;
+	melted_startup startup = lane->startup;
+	pthread_mutex_lock( &startup->mutex );
+	if ( lane->unit == UNIT_PENDING )
+		lane->unit = unit;
+	pthread_cond_broadcast( &startup->cond );
+	pthread_mutex_unlock( &startup->mutex );
+}
+
+/** Check the response of a command.
+
+    \return 1 if the command failed.
+*/
+
+static int line_failed( startup_line *line )
+{
+	return line->response == NULL || mvcp_response_get_error_code( line->response ) > 299;
+}
+
+/** Execute one command and time it.
+
+    A failure is remembered so no command after it in the file is started.
+*/
+
+static void run_line( melted_startup startup, int index, startup_lane *lane )
+{
+	startup_line *line = &startup->lines[ index ];
+
+	line->start = time_now( );
+	if ( lane != NULL && lane->unit == UNIT_PENDING )
+		melted_set_reserve_listener( lane_reserved, lane );
+	line->response = mvcp_parser_execute( startup->parser, line->command );
+	melted_set_reserve_listener( NULL, NULL );
+	line->end = time_now( );
+
+	if ( line_failed( line ) )
+	{
+		pthread_mutex_lock( &startup->mutex );
+		if ( startup->failed < 0 || index < startup->failed )
+			startup->failed = index;
+		pthread_cond_broadcast( &startup->cond );
+		pthread_mutex_unlock( &startup->mutex );
+	}
+
+	// A remote parser only reports the unit number in the response
+	if ( lane != NULL && lane->unit == UNIT_PENDING )
+	{
+		int unit = -1;
+		int i;
+		for ( i = 1; line->response != NULL && i < mvcp_response_count( line->response ); i ++ )
+			if ( sscanf( mvcp_response_get_line( line->response, i ), "U%d", &unit ) == 1 )
+				break;
+		lane_reserved( lane, unit );
+	}
+}
+
+/** Lane thread - runs the queued commands of the lane's unit.
+*/
+
+static void *lane_run( void *arg )
+{
+	startup_lane *lane = arg;
+	melted_startup startup = lane->startup;
+
+	pthread_mutex_lock( &startup->mutex );
+	while ( 1 )
+	{
+		int index;
+		while ( lane->head == lane->count && !startup->finished )
+			pthread_cond_wait( &startup->cond, &startup->mutex );
+		if ( lane->head == lane->count )
+			break;
+		index = lane->queue[ lane->head ];
+		if ( startup->failed < 0 || index < startup->failed )
+		{
+			pthread_mutex_unlock( &startup->mutex );
+			run_line( startup, index, lane );
+			pthread_mutex_lock( &startup->mutex );
+		}
+		lane->head ++;
+		lane->ready = time_now( );
+		pthread_cond_broadcast( &startup->cond );
+	}
+	pthread_mutex_unlock( &startup->mutex );
+
+	return NULL;
+}
+
+/** Queue a command on a lane - must be called with the mutex held.
+*/
+
+static void lane_queue( startup_lane *lane, int index )
+{
+	int *queue = realloc( lane->queue, ( lane->count + 1 ) * sizeof( int ) );
+	if ( queue != NULL )
+	{
+		lane->queue = queue;
+		lane->queue[ lane->count ++ ] = index;
+		pthread_cond_broadcast( &lane->startup->cond );
+	}
+}
+
+/** Start a lane for a UADD and wait until the unit number is known.
+
+    The number is reserved before the consumer is created, so each UADD
+    still gets the number it would get if the file ran in order.
+*/
+
+static startup_lane *lane_start( melted_startup startup, int index )
+{
+	startup_lane **lanes = realloc( startup->lanes, ( startup->lane_count + 1 ) * sizeof( startup_lane * ) );
+	startup_lane *lane = calloc( 1, sizeof( startup_lane ) );
+
+	if ( lanes == NULL || lane == NULL )
+	{
+		if ( lanes != NULL )
+			startup->lanes = lanes;
+		free( lane );
+		return NULL;
+	}
+
+	startup->lanes = lanes;
+	lane->startup = startup;
+	lane->unit = UNIT_PENDING;
+	lane_queue( lane, index );
+	if ( pthread_create( &lane->thread, NULL, lane_run, lane ) != 0 )
+	{
+		free( lane->queue );
+		free( lane );
+		return NULL;
+	}
+	startup->lanes[ startup->lane_count ++ ] = lane;
+
+	while ( lane->unit == UNIT_PENDING )
+		pthread_cond_wait( &startup->cond, &startup->mutex );
+
+	return lane;
+}
+
+/** Find the lane of a unit - must be called with the mutex held.
+*/
+
+static startup_lane *lane_find( melted_startup startup, int unit )
+{
+	int i;
+	for ( i = startup->lane_count - 1; unit >= 0 && i >= 0; i -- )
+		if ( startup->lanes[ i ]->unit == unit )
+			return startup->lanes[ i ];
+	return NULL;
+}
+
+/** Wait until every lane has run its queue - must be called with the mutex
+    held.
+*/
+
+static void lanes_drain( melted_startup startup )
+{
+	int i;
+	for ( i = 0; i < startup->lane_count; i ++ )
+		while ( startup->lanes[ i ]->head < startup->lanes[ i ]->count )
+			pthread_cond_wait( &startup->cond, &startup->mutex );
+}
+
+/** Log where the startup time went.
+*/
+
+static void log_timeline( melted_startup startup )
+{
+	int64_t total = time_now( ) - startup->origin;
+	int i;
+
+	for ( i = 0; i < startup->count; i ++ )
+	{
+		startup_line *line = &startup->lines[ i ];
+		if ( line->start == 0 )
+			continue;
+		melted_log( LOG_INFO, "startup %8.1f ms +%8.1f ms %s", ( double )( line->start - startup->origin ) / 1000,
+			( double )( line->end - line->start ) / 1000, line->command );
+	}
+	for ( i = 0; i < startup->lane_count; i ++ )
+		if ( startup->lanes[ i ]->unit >= 0 )
+			melted_log( LOG_NOTICE, "startup: U%d configured after %.1f ms", startup->lanes[ i ]->unit,
+				( double )( startup->lanes[ i ]->ready - startup->origin ) / 1000 );
+	melted_log( LOG_NOTICE, "startup: %d commands for %d units in %.1f ms", startup->count, startup->lane_count, ( double )total / 1000 );
+}
+
+/** Execute a configuration file.
+
+    Each UADD starts a lane which then runs every following command that
+    addresses its unit, so units are created and loaded in parallel while
+    the commands of a unit keep their order. Any other command waits for
+    all lanes to finish before it runs, and later commands wait for it.
+
+    The first failing command stops the run, as mvcp_parser_run does:
+    nothing after it in the file is started and the response is 500. The
+    lanes are drained first, so the transcript lists every command which
+    ran, including those already running when the failure happened.
+*/
+
+mvcp_response melted_startup_run( mvcp_parser parser, char *filename )
+{
+	mvcp_response response = mvcp_response_init( );
+	melted_startup_t startup;
+	int i;
+
+	memset( &startup, 0, sizeof( startup ) );
+	startup.parser = parser;
+	startup.failed = -1;
+	startup.origin = time_now( );
+
+	if ( read_lines( &startup, filename ) != 0 )
+	{
+		mvcp_response_set_error( response, 404, "File not found." );
+		return response;
+	}
+
+	pthread_mutex_init( &startup.mutex, NULL );
+	pthread_cond_init( &startup.cond, NULL );
+
+	pthread_mutex_lock( &startup.mutex );
+	for ( i = 0; i < startup.count && startup.failed < 0; i ++ )
+	{
+		mvcp_tokeniser tokeniser = mvcp_tokeniser_init( );
+		char *copy = strdup( startup.lines[ i ].command );
+		char *name = NULL;
+		startup_lane *lane = NULL;
+
+		if ( mvcp_tokeniser_parse_new( tokeniser, copy, " " ) > 0 )
+			name = mvcp_tokeniser_get_string( tokeniser, 0 );
+
+		if ( name != NULL && !strcasecmp( name, "UADD" ) )
+			lane = lane_start( &startup, i );
+		else if ( name != NULL && ( lane = lane_find( &startup, parse_unit( mvcp_tokeniser_get_string( tokeniser, 1 ) ) ) ) != NULL )
+			lane_queue( lane, i );
+
+		if ( lane == NULL )
+			lanes_drain( &startup );
+
+		if ( lane == NULL && startup.failed < 0 )
+		{
+			pthread_mutex_unlock( &startup.mutex );
+			run_line( &startup, i, NULL );
+			pthread_mutex_lock( &startup.mutex );
+		}
+
+		mvcp_tokeniser_close( tokeniser );
+		free( copy );
+	}
+	startup.finished = 1;
+	pthread_cond_broadcast( &startup.cond );
+	pthread_mutex_unlock( &startup.mutex );
+
+	for ( i = 0; i < startup.lane_count; i ++ )
+		pthread_join( startup.lanes[ i ]->thread, NULL );
+
+	log_timeline( &startup );
+
+	mvcp_response_set_error( response, 201, "OK" );
+	for ( i = 0; i < startup.count; i ++ )
+	{
+		startup_line *line = &startup.lines[ i ];
+		if ( line->start != 0 )
+		{
+			mvcp_response_printf( response, 1024, "%s\n", line->command );
+			if ( line->response != NULL )
+			{
+				int index;
+				for ( index = 0; index < mvcp_response_count( line->response ); index ++ )
+					mvcp_response_printf( response, 10240, "%s\n", mvcp_response_get_line( line->response, index ) );
+			}
+		}
+		if ( i == startup.failed )
+		{
+			melted_log( LOG_ERR, "startup: line %d \"%s\" failed: %s", i + 1, line->command,
+				line->response != NULL ? mvcp_response_get_line( line->response, 0 ) : "no response" );
+			mvcp_response_set_error( response, 500, "Batch execution failed" );
+		}
+		if ( line->response != NULL )
+			mvcp_response_close( line->response );
+		free( line->command );
+	}
+
+	for ( i = 0; i < startup.lane_count; i ++ )
+	{
+		free( startup.lanes[ i ]->queue );
+		free( startup.lanes[ i ] );
+	}
+	free( startup.lanes );
+	free( startup.lines );
+	pthread_mutex_destroy( &startup.mutex );
+	pthread_cond_destroy( &startup.cond );
+
+	return response;
+}
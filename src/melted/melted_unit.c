@@ -28,16 +28,27 @@
 #include <sys/mman.h>
 #include <sys/poll.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
 #include <limits.h>
+#include <time.h>
+#include <stdarg.h>
+#include <dirent.h>
 
 #include <sys/mman.h>
 
 #include "melted_unit.h"
+#include "melted_cache.h"
+#include "melted_journal.h"
+#include "melted_pool.h"
+#include "melted_frames.h"
+#include "melted_index.h"
+#include "melted_media.h"
+#include "melted_render.h"
 #include "melted_log.h"
 #include "melted_local.h"
 
@@ -45,6 +56,137 @@
 
 /* Forward references */
 static void melted_unit_status_communicate( melted_unit );
+static void melted_unit_frame_shown( mlt_consumer, melted_unit, mlt_frame );
+static void *melted_unit_worker( void * );
+static int swap_entry( melted_unit, mlt_producer, mlt_producer );
+static int replace_entry( melted_unit, mlt_producer, mlt_producer );
+static void schedule_render( melted_unit, mlt_producer );
+static void journal_step( melted_unit );
+static void journal_record( melted_unit, int, const char *, ... );
+static void journal_position( melted_unit, int );
+static void unit_snapshot( melted_unit );
+static char *persist_service( melted_unit, mlt_producer );
+static void publish_view( melted_unit );
+static void apply_seek( melted_unit );
+static mlt_consumer claim_output( melted_unit );
+static void cut_output( melted_unit, mlt_consumer, mlt_position );
+
+/** Default number of frames decoded ahead by CUE.
+*/
+
+#define DEFAULT_PREROLL 5
+
+/** Default number of frames before the end of a clip at which the next
+    clip is prepared.
+*/
+
+#define DEFAULT_LOOKAHEAD 50
+
+/** Number of frames a consumer buffers when its "buffer" is not set.
+*/
+
+#define DEFAULT_BUFFER 25
+
+/** Minimum time in microseconds between journaled play positions.
+*/
+
+#define JOURNAL_INTERVAL 1000000
+
+/** Number of journal records after which a new snapshot is written.
+*/
+
+#define JOURNAL_COMPACT 1000
+
+/** Default number of seconds a pushed composition must be ahead of air to
+    be rendered in the background.
+*/
+
+#define DEFAULT_RENDER_LEAD 60
+
+/** Number of seconds before air at which an unfinished render is given up.
+*/
+
+#define RENDER_MARGIN 5
+
+/** A row of a playlist view.
+*/
+
+typedef struct
+{
+	char *title;
+	int id;
+	mlt_position start;
+	int frame_in;
+	int frame_out;
+	int frame_count;
+	mlt_position length;
+	double fps;
+}
+view_row;
+
+/** An entry of a unit's clip id index: the cut with the id and the
+    playlist index it was last seen at.
+*/
+
+typedef struct
+{
+	mlt_producer cut;
+	int row;
+}
+clip_ref;
+
+/** An immutable copy of the playlist rows.
+
+    A new view is published after each change of the playlist, so that LIST
+    and USTA never walk the live playlist and never take its lock.
+*/
+
+typedef struct
+{
+	int refs;
+	int generation;
+	int count;
+	view_row *rows;
+}
+*playlist_view, playlist_view_t;
+
+/** Obtain a monotonic time stamp in microseconds.
+*/
+
+static int64_t time_now( )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return ( int64_t )now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** Accumulate a sample in the unit statistics.
+
+    Maintains name.last, name.count, name.mean and name.max.
+*/
+
+static void stats_record( melted_unit unit, const char *name, double value )
+{
+	mlt_properties stats = mlt_properties_get_data( unit->properties, "stats", NULL );
+	char key[ 256 ];
+	int count;
+	double mean;
+
+	snprintf( key, sizeof( key ), "%s.count", name );
+	count = mlt_properties_get_int( stats, key ) + 1;
+	mlt_properties_set_int( stats, key, count );
+
+	snprintf( key, sizeof( key ), "%s.mean", name );
+	mean = mlt_properties_get_double( stats, key );
+	mlt_properties_set_double( stats, key, mean + ( value - mean ) / count );
+
+	snprintf( key, sizeof( key ), "%s.max", name );
+	if ( count == 1 || value > mlt_properties_get_double( stats, key ) )
+		mlt_properties_set_double( stats, key, value );
+
+	snprintf( key, sizeof( key ), "%s.last", name );
+	mlt_properties_set_double( stats, key, value );
+}
 
 /** Allocate a new playout unit.
 
@@ -55,7 +197,7 @@ melted_unit melted_unit_init( int index, char *constructor )
 {
 	melted_unit this = NULL;
 	mlt_consumer consumer = NULL;
-	mlt_profile profile = mlt_profile_init( NULL );
+	pthread_mutexattr_t attr;
 
 	char *id = strdup( constructor );
 	char *arg = strchr( id, ':' );
@@ -63,8 +205,7 @@ melted_unit melted_unit_init( int index, char *constructor )
 	if ( arg != NULL )
 		*arg ++ = '\0';
 
-	profile->is_explicit = 1;
-	consumer = mlt_factory_consumer( profile, id, arg );
+	consumer = melted_pool_take( constructor );
 
 	if ( consumer != NULL )
 	{
@@ -80,7 +221,20 @@ melted_unit melted_unit_init( int index, char *constructor )
 		mlt_properties_set_data( this->properties, "producer", mlt_properties_new( ), 0, ( mlt_destructor )mlt_properties_close, NULL );
 		mlt_properties_set_data( this->properties, "consumer", consumer, 0, ( mlt_destructor )mlt_consumer_close, NULL );
 		mlt_properties_set_data( this->properties, "playlist", playlist, 0, ( mlt_destructor )mlt_playlist_close, NULL );
+		mlt_properties_set_data( this->properties, "stats", mlt_properties_new( ), 0, ( mlt_destructor )mlt_properties_close, NULL );
+		mlt_properties_set_data( this->properties, "cache", melted_cache_init( ), 0, ( mlt_destructor )melted_cache_close, NULL );
+		mlt_properties_set_data( this->properties, "settings", mlt_properties_new( ), 0, ( mlt_destructor )mlt_properties_close, NULL );
 		mlt_consumer_connect( consumer, MLT_PLAYLIST_SERVICE( playlist ) );
+		pthread_mutex_init( &this->mutex, NULL );
+		publish_view( this );
+		pthread_cond_init( &this->cond, NULL );
+		pthread_mutexattr_init( &attr );
+		pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+		pthread_mutex_init( &this->journal_mutex, &attr );
+		pthread_mutexattr_destroy( &attr );
+		this->running = 1;
+		pthread_create( &this->thread, NULL, melted_unit_worker, this );
+		mlt_events_listen( MLT_CONSUMER_PROPERTIES( consumer ), this, "consumer-frame-show", ( mlt_listener )melted_unit_frame_shown );
 	}
 
 	return this;
@@ -144,7 +298,35 @@ void melted_unit_set_notifier( melted_unit this, mvcp_notifier notifier, char *r
 	melted_unit_status_communicate( this );
 }
 
+/** Build the producer cache key for a file.
+
+    The key combines the resource, the size and modification time of the
+    file when it is local, and the producer properties set on the unit, so
+    a cached producer is only reused when it would be created identically.
+*/
+
+static void cache_key( melted_unit unit, const char *file, char *key, size_t size )
+{
+	mlt_properties m_prop = mlt_properties_get_data( unit->properties, "producer", NULL );
+	const char *path = strchr( file, ':' ) != NULL ? strchr( file, ':' ) + 1 : file;
+	struct stat info;
+	int length;
+	int i;
+
+	if ( stat( file, &info ) == 0 || stat( path, &info ) == 0 )
+		length = snprintf( key, size, "%s|%lld|%ld", file, ( long long )info.st_size, ( long )info.st_mtime );
+	else
+		length = snprintf( key, size, "%s", file );
+
+	for ( i = 0; i < mlt_properties_count( m_prop ) && length < size; i ++ )
+		length += snprintf( key + length, size - length, "|%s=%s", mlt_properties_get_name( m_prop, i ), mlt_properties_get_value( m_prop, i ) );
+}
+
 /** Create or locate a producer for the file specified.
+
+    When the unit property "cache" is set, up to that many producers are
+    kept open and a repeated file is returned from the cache, so that the
+    playlist cuts the already probed producer rather than opening it again.
 */
 
 static mlt_producer locate_producer( melted_unit unit, char *file )
@@ -152,8 +334,24 @@ static mlt_producer locate_producer( melted_unit unit, char *file )
 	// Try to get the profile from the consumer
 	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
 	mlt_properties m_prop = mlt_properties_get_data( unit->properties, "producer", NULL );
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	melted_cache cache = mlt_properties_get_data( unit->properties, "cache", NULL );
+	int cache_size = mlt_properties_get_int( MLT_PLAYLIST_PROPERTIES( playlist ), "cache" );
 	mlt_producer producer;
 	mlt_profile profile = NULL;
+	char key[ 4096 ];
+
+	if ( cache_size > 0 )
+	{
+		cache_key( unit, file, key, sizeof( key ) );
+		producer = melted_cache_get( cache, key );
+		if ( producer != NULL )
+			return producer;
+	}
+	else if ( melted_cache_count( cache ) > 0 )
+	{
+		melted_cache_purge( cache, 0 );
+	}
 
 	if ( consumer != NULL )
 	{
@@ -165,12 +363,435 @@ static mlt_producer locate_producer( melted_unit unit, char *file )
 	{
 		mlt_properties p_prop = mlt_producer_properties( producer );
 		mlt_properties_inherit ( p_prop, m_prop );
+		mlt_properties_set( p_prop, "melted.resource", file );
+		melted_frames_attach( producer, file, mlt_properties_get_int( unit->properties, "unit" ) );
+		melted_index_request( file );
+		melted_media_store( file, producer );
+		if ( cache_size > 0 )
+			melted_cache_put( cache, key, producer, cache_size );
+	}
+
+	return producer;
+}
+
+/** Determine if a playlist index lies within the unit's producer window.
+
+    When the unit property "window" is set, only the playing clip and the
+    following "window" clips hold an open producer. All other entries are
+    placeholders which only describe the clip.
+*/
+
+static int in_window( melted_unit unit, int index )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	int current = mlt_playlist_current_clip( playlist );
+
+	if ( mlt_properties_get( playlist_properties, "window" ) == NULL || mlt_properties_get_int( playlist_properties, "window" ) < 0 )
+		return 1;
+	return index >= current && index <= current + mlt_properties_get_int( playlist_properties, "window" );
+}
+
+/** Create a placeholder describing an unopened clip.
+
+    The placeholder is a cheap black producer with the length of the clip
+    it stands in for, carrying the resource and title so the real producer
+    can be opened again when the clip comes into the window.
+
+    \param unit A melted_unit handle.
+    \param resource The resource the placeholder stands in for.
+    \param title The title of the clip (may be NULL).
+    \param length The length of the clip.
+    \return The placeholder or NULL on error.
+*/
+
+static mlt_producer describe_clip( melted_unit unit, char *resource, char *title, mlt_position length )
+{
+	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+	mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+	mlt_producer placeholder = mlt_factory_producer( profile, "colour", "black" );
+
+	if ( placeholder != NULL )
+	{
+		mlt_properties properties = MLT_PRODUCER_PROPERTIES( placeholder );
+		mlt_properties_set_position( properties, "length", length );
+		mlt_producer_set_in_and_out( placeholder, 0, length - 1 );
+		mlt_properties_set( properties, "title", title );
+		mlt_properties_set( properties, "melted.resource", resource );
+		mlt_properties_set_int( properties, "melted.placeholder", 1 );
+	}
+
+	return placeholder;
+}
+
+/** Create a placeholder describing an open producer.
+*/
+
+static mlt_producer create_placeholder( melted_unit unit, mlt_producer producer )
+{
+	mlt_properties source = MLT_PRODUCER_PROPERTIES( producer );
+	return describe_clip( unit, mlt_properties_get( source, "melted.resource" ), mlt_properties_get( source, "title" ), mlt_producer_get_length( producer ) );
+}
+
+/** Replace a newly opened producer by a placeholder if it will be added
+    outside of the unit's window.
+
+    \param unit A melted_unit handle.
+    \param producer The producer - ownership is taken if it is replaced.
+    \param index The playlist index the producer will be added at.
+    \return The producer to add to the playlist.
+*/
+
+static mlt_producer defer_producer( melted_unit unit, mlt_producer producer, int index )
+{
+	if ( !in_window( unit, index ) )
+	{
+		mlt_producer placeholder = create_placeholder( unit, producer );
+		if ( placeholder != NULL )
+		{
+			mlt_producer_close( producer );
+			producer = placeholder;
+		}
 	}
+	return producer;
+}
 
+/** Open a clip to be added at the given playlist index.
+
+    A clip outside of the unit's window whose length is known from the media
+    store is added as a placeholder straight away, without probing the file.
+
+    \return The producer to add to the playlist or NULL if the file is invalid.
+*/
+
+static mlt_producer open_clip( melted_unit unit, char *clip, int index )
+{
+	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+	mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+	melted_media_t media;
+	mlt_producer producer;
+
+	if ( !in_window( unit, index ) && profile != NULL && melted_media_lookup( clip, &media ) == 0 &&
+		 media.length > 0 && media.profile_num == profile->frame_rate_num && media.profile_den == profile->frame_rate_den )
+		return describe_clip( unit, clip, NULL, media.length );
+
+	producer = locate_producer( unit, clip );
+	if ( producer != NULL )
+		producer = defer_producer( unit, producer, index );
 	return producer;
 }
 
-/** Update the generation count.
+/** Get the display name of a clip.
+*/
+
+static char *clip_title( melted_unit unit, mlt_playlist_clip_info *info )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( info->producer );
+	char *title = mlt_properties_get( properties, "title" );
+	if ( title == NULL && mlt_properties_get_int( properties, "melted.placeholder" ) )
+		title = strip_root( unit, mlt_properties_get( properties, "melted.resource" ) );
+	if ( title == NULL )
+		title = strip_root( unit, info->resource );
+	return title;
+}
+
+/** Release a reference to a playlist view.
+*/
+
+static void release_view( playlist_view view )
+{
+	if ( view != NULL && __sync_sub_and_fetch( &view->refs, 1 ) == 0 )
+	{
+		int i;
+		for ( i = 0; i < view->count; i ++ )
+			free( view->rows[ i ].title );
+		free( view->rows );
+		free( view );
+	}
+}
+
+/** Obtain a reference to the current playlist view of the unit.
+
+    \param pending If not NULL, set to the target of a coalesced seek which
+    is still to be applied, or -1 if there is none, read under the same
+    lock apply_seek clears it with.
+*/
+
+static playlist_view acquire_view( melted_unit unit, mlt_position *pending )
+{
+	playlist_view view;
+	pthread_mutex_lock( &unit->mutex );
+	view = mlt_properties_get_data( unit->properties, "view", NULL );
+	if ( view != NULL )
+		__sync_fetch_and_add( &view->refs, 1 );
+	if ( pending != NULL )
+		*pending = mlt_properties_get_int( unit->properties, "seek_pending" ) ?
+				   mlt_properties_get_position( unit->properties, "seek_target" ) : -1;
+	pthread_mutex_unlock( &unit->mutex );
+	return view;
+}
+
+/** Record a cut and its playlist index under its clip id.
+
+    The cut is only compared with the live entries, never dereferenced, so
+    the index may keep the ids of removed entries until it is rebuilt.
+*/
+
+static void index_set( mlt_properties ids, int id, mlt_producer cut, int row )
+{
+	clip_ref *ref;
+	char key[ 32 ];
+
+	snprintf( key, sizeof( key ), "%d", id );
+	ref = mlt_properties_get_data( ids, key, NULL );
+	if ( ref == NULL && ( ref = malloc( sizeof( clip_ref ) ) ) != NULL )
+		mlt_properties_set_data( ids, key, ref, 0, free, NULL );
+	if ( ref != NULL )
+	{
+		ref->cut = cut;
+		ref->row = row;
+	}
+}
+
+/** Get the clip id index entry of an id - must be called with the playlist
+    locked.
+*/
+
+static clip_ref *index_ref( melted_unit unit, int id )
+{
+	mlt_properties ids = mlt_properties_get_data( unit->properties, "ids", NULL );
+	char key[ 32 ];
+
+	snprintf( key, sizeof( key ), "%d", id );
+	return ids != NULL ? mlt_properties_get_data( ids, key, NULL ) : NULL;
+}
+
+/** Give the playlist entry at index a clip id and add it to the unit's id
+    index - must be called with the playlist locked.
+
+    An id of 0 takes the next free id. The index is rebuilt from the
+    playlist, dropping the ids of removed entries, once it holds twice as
+    many ids as the playlist has entries.
+
+    \return The id or 0 if there is no entry at index.
+*/
+
+static int label_entry( melted_unit unit, mlt_playlist playlist, int index, int id )
+{
+	mlt_properties properties = unit->properties;
+	mlt_properties ids = mlt_properties_get_data( properties, "ids", NULL );
+	mlt_producer cut = mlt_playlist_get_clip( playlist, index );
+	int i;
+
+	if ( cut == NULL )
+		return 0;
+	if ( id == 0 )
+		id = mlt_properties_get_int( properties, "clip_id" ) + 1;
+	if ( id > mlt_properties_get_int( properties, "clip_id" ) )
+		mlt_properties_set_int( properties, "clip_id", id );
+	mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( cut ), "melted.id", id );
+
+	if ( ids == NULL || mlt_properties_count( ids ) > 2 * mlt_playlist_count( playlist ) + 64 )
+	{
+		ids = mlt_properties_new( );
+		for ( i = 0; i < mlt_playlist_count( playlist ); i ++ )
+		{
+			mlt_producer entry = mlt_playlist_get_clip( playlist, i );
+			int entry_id = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( entry ), "melted.id" );
+			if ( entry_id != 0 )
+				index_set( ids, entry_id, entry, i );
+		}
+		mlt_properties_set_data( properties, "ids", ids, 0, ( mlt_destructor )mlt_properties_close, NULL );
+	}
+	else
+	{
+		index_set( ids, id, cut, index );
+	}
+
+	return id;
+}
+
+/** Copy the playlist rows into a new view and make it the current one.
+
+    Only the positions of the rows are copied under the playlist lock, with
+    a reference to each cut, and the titles are built from the cuts once
+    the lock is released. The previous view is freed once its last reader
+    releases it. Entries added without an id are given the next one, and
+    the playlist index recorded for each id is brought up to date.
+*/
+
+static void publish_view( melted_unit unit )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	playlist_view view = calloc( 1, sizeof( playlist_view_t ) );
+	mlt_producer *cuts = NULL;
+	playlist_view previous;
+	int i;
+
+	if ( view == NULL )
+		return;
+
+	view->refs = 1;
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	view->generation = mlt_properties_get_int( unit->properties, "generation" );
+	view->rows = calloc( mlt_playlist_count( playlist ) + 1, sizeof( view_row ) );
+	cuts = calloc( mlt_playlist_count( playlist ) + 1, sizeof( mlt_producer ) );
+	for ( i = 0; view->rows != NULL && cuts != NULL && i < mlt_playlist_count( playlist ); i ++ )
+	{
+		mlt_playlist_clip_info info;
+		view_row *row = &view->rows[ view->count ];
+		clip_ref *ref;
+		if ( mlt_playlist_get_clip_info( playlist, &info, i ) != 0 )
+			break;
+		row->id = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.cut ), "melted.id" );
+		if ( ( ref = index_ref( unit, row->id ) ) != NULL && ref->cut == info.cut )
+			ref->row = i;
+		else if ( row->id != 0 || !mlt_properties_get_int( unit->properties, "replaying" ) )
+			row->id = label_entry( unit, playlist, i, row->id );
+		row->start = info.start;
+		row->frame_in = info.frame_in;
+		row->frame_out = info.frame_out;
+		row->frame_count = info.frame_count;
+		row->length = info.length;
+		row->fps = info.fps;
+		mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( info.cut ) );
+		cuts[ view->count ++ ] = info.cut;
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	for ( i = 0; i < view->count; i ++ )
+	{
+		mlt_playlist_clip_info info;
+		memset( &info, 0, sizeof( info ) );
+		info.producer = mlt_producer_cut_parent( cuts[ i ] );
+		info.resource = mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "resource" );
+		if ( info.resource != NULL && strcmp( info.resource, "" ) )
+			view->rows[ i ].title = strdup( clip_title( unit, &info ) );
+		mlt_producer_close( cuts[ i ] );
+	}
+	free( cuts );
+
+	pthread_mutex_lock( &unit->mutex );
+	previous = mlt_properties_get_data( unit->properties, "view", NULL );
+	mlt_properties_set_data( unit->properties, "view", view, 0, NULL, NULL );
+	pthread_mutex_unlock( &unit->mutex );
+	release_view( previous );
+}
+
+/** Find the row of a view playing at a playlist position.
+
+    \return The row index, or the number of rows past the end as for
+    mlt_playlist_current_clip.
+*/
+
+static int view_clip( playlist_view view, mlt_position position )
+{
+	int first = 0;
+	int last = view->count;
+
+	while ( first < last )
+	{
+		int middle = ( first + last ) / 2;
+		if ( position < view->rows[ middle ].start + view->rows[ middle ].frame_count )
+			last = middle;
+		else
+			first = middle + 1;
+	}
+
+	return first;
+}
+
+/** Find the index of the playlist entry with the given clip id.
+
+    The id index gives the cut and where it was last seen. The playlist is
+    only scanned if the cut has moved since the last published change.
+
+    \return The index or -1 if no entry has the id.
+*/
+
+int melted_unit_find_clip( melted_unit unit, int id )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	clip_ref *ref;
+	int index = -1;
+	int i;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	ref = index_ref( unit, id );
+	if ( ref != NULL && ref->row < mlt_playlist_count( playlist ) && mlt_playlist_get_clip( playlist, ref->row ) == ref->cut &&
+		 mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( ref->cut ), "melted.id" ) == id )
+	{
+		index = ref->row;
+	}
+	else if ( ref != NULL )
+	{
+		for ( i = 0; i < mlt_playlist_count( playlist ) && index < 0; i ++ )
+			if ( mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( mlt_playlist_get_clip( playlist, i ) ), "melted.id" ) == id )
+				index = i;
+		if ( index >= 0 )
+			label_entry( unit, playlist, index, id );
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	return index;
+}
+
+/** Describe the media the unit will read next.
+
+    Each item is a child "0", "1"... with the "resource", the media frame
+    read from next ("position"), the media "length" and the output "fps".
+    The first item is the playing clip, marked "current", followed by up to
+    count clips after it. Blanks and clips not opened from a file are
+    skipped.
+
+    \return The items, to be closed by the caller.
+*/
+
+mlt_properties melted_unit_upcoming( melted_unit unit, int count )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_profile profile = consumer != NULL ? mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) ) : NULL;
+	mlt_properties items = mlt_properties_new( );
+	mlt_playlist_clip_info info;
+	int current, index;
+	int n = 0;
+
+	if ( profile == NULL || profile->frame_rate_den == 0 )
+		return items;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	current = mlt_playlist_current_clip( playlist );
+	for ( index = current; index <= current + count && mlt_playlist_get_clip_info( playlist, &info, index ) == 0; index ++ )
+	{
+		char *resource = info.producer != NULL ? mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.resource" ) : NULL;
+		if ( resource != NULL && !mlt_playlist_is_blank( playlist, index ) )
+		{
+			mlt_properties item = mlt_properties_new( );
+			char key[ 16 ];
+			mlt_properties_set( item, "resource", resource );
+			if ( index == current )
+			{
+				mlt_properties_set_int( item, "current", 1 );
+				mlt_properties_set_position( item, "position", info.frame_in + mlt_producer_frame( producer ) - info.start );
+			}
+			else
+			{
+				mlt_properties_set_position( item, "position", info.frame_in );
+			}
+			mlt_properties_set_position( item, "length", mlt_producer_get_length( info.producer ) );
+			mlt_properties_set_double( item, "fps", ( double )profile->frame_rate_num / profile->frame_rate_den );
+			snprintf( key, sizeof( key ), "%d", n ++ );
+			mlt_properties_set_data( items, key, item, 0, ( mlt_destructor )mlt_properties_close, NULL );
+		}
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	return items;
+}
+
+/** Update the generation count and publish the changed playlist.
 */
 
 static void update_generation( melted_unit unit )
@@ -178,6 +799,35 @@ static void update_generation( melted_unit unit )
 	mlt_properties properties = unit->properties;
 	int generation = mlt_properties_get_int( properties, "generation" );
 	mlt_properties_set_int( properties, "generation", ++ generation );
+	publish_view( unit );
+}
+
+/** Reference the cuts of playlist entries about to be removed.
+
+    Removing an entry closes its cut, and closing the last cut of a producer
+    tears its demuxer and decoder down. With the cuts held, the removal under
+    the playlist lock only unlinks them, and they are closed with the
+    returned list once the lock is released - must be called with the
+    playlist lock held.
+*/
+
+static mlt_properties hold_cuts( mlt_playlist playlist, int index, int count )
+{
+	mlt_properties held = mlt_properties_new( );
+
+	for ( ; count > 0 && index < mlt_playlist_count( playlist ); index ++, count -- )
+	{
+		mlt_producer cut = mlt_playlist_get_clip( playlist, index );
+		if ( cut != NULL )
+		{
+			char key[ 32 ];
+			snprintf( key, sizeof( key ), "%d", index );
+			mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( cut ) );
+			mlt_properties_set_data( held, key, cut, 0, ( mlt_destructor )mlt_producer_close, NULL );
+		}
+	}
+
+	return held;
 }
 
 /** Wipe all clips on the playlist for this unit.
@@ -189,12 +839,15 @@ static void clear_unit( melted_unit unit )
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
 	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
 	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_properties held;
 
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	held = hold_cuts( playlist, 0, mlt_playlist_count( playlist ) );
 	mlt_playlist_clear( playlist );
 	mlt_producer_seek( producer, 0 );
 	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_properties_close( held );
 
 	update_generation( unit );
 }
@@ -216,11 +869,13 @@ static void clean_unit( melted_unit unit )
 
 	if ( info.producer != NULL )
 	{
+		int id = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.cut ), "melted.id" );
 		mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( info.producer ) );
 		position -= info.start;
 		clear_unit( unit );
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 		mlt_playlist_append_io( playlist, info.producer, info.frame_in, info.frame_out );
+		label_entry( unit, playlist, 0, id );
 		mlt_producer_seek( producer, position );
 		mlt_producer_set_speed( producer, speed );
 		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
@@ -244,44 +899,54 @@ static void wipe_unit( melted_unit unit )
 
 	if ( info.producer != NULL && info.start > 0 )
 	{
+		mlt_properties held;
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+		held = hold_cuts( playlist, 0, current );
 		mlt_playlist_remove_region( playlist, 0, info.start );
 		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		mlt_properties_close( held );
 	}
 	
 	update_generation( unit );
 }
 
 /** Generate a report on all loaded clips.
+
+    \param ids Non zero to add the clip id of each row, for LIST {unit} ID.
 */
 
-void melted_unit_report_list( melted_unit unit, mvcp_response response )
+void melted_unit_report_list( melted_unit unit, mvcp_response response, int ids )
 {
 	int i;
-	mlt_properties properties = unit->properties;
-	int generation = mlt_properties_get_int( properties, "generation" );
-	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	playlist_view view = acquire_view( unit, NULL );
 
-	mvcp_response_printf( response, 1024, "%d\n", generation );
+	mvcp_response_printf( response, 1024, "%d\n", view->generation );
 		
-	for ( i = 0; i < mlt_playlist_count( playlist ); i ++ )
+	for ( i = 0; i < view->count; i ++ )
 	{
-		mlt_playlist_clip_info info;
-		char *title;
-		mlt_playlist_get_clip_info( playlist , &info, i );
-		title = mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "title" );
-		if ( title == NULL )
-			title = strip_root( unit, info.resource );
-		mvcp_response_printf( response, 10240, "%d \"%s\" %d %d %d %d %.2f\n", 
-								 i, 
-								 title,
-								 info.frame_in, 
-								 info.frame_out,
-								 info.frame_count, 
-								 info.length, 
-								 info.fps );
+		view_row *row = &view->rows[ i ];
+		if ( ids )
+			mvcp_response_printf( response, 10240, "%d \"%s\" %d %d %d %d %.2f %d\n", 
+									 i, 
+									 row->title != NULL ? row->title : "",
+									 row->frame_in, 
+									 row->frame_out,
+									 row->frame_count, 
+									 row->length, 
+									 row->fps,
+									 row->id );
+		else
+			mvcp_response_printf( response, 10240, "%d \"%s\" %d %d %d %d %.2f\n", 
+									 i, 
+									 row->title != NULL ? row->title : "",
+									 row->frame_in, 
+									 row->frame_out,
+									 row->frame_count, 
+									 row->length, 
+									 row->fps );
 	}
 	mvcp_response_printf( response, 1024, "\n" );
+	release_view( view );
 }
 
 /** Load a clip into the unit clearing existing play list.
@@ -302,12 +967,22 @@ mvcp_error_code melted_unit_load( melted_unit unit, char *clip, int32_t in, int3
 	{
 		mlt_properties properties = unit->properties;
 		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
-		int original = mlt_producer_get_playtime( MLT_PLAYLIST_PRODUCER( playlist ) );
+		mlt_properties held;
+		int original;
+		int id;
+		pthread_mutex_lock( &unit->journal_mutex );
+		original = mlt_producer_get_playtime( MLT_PLAYLIST_PRODUCER( playlist ) );
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+		held = hold_cuts( playlist, 0, mlt_playlist_count( playlist ) );
 		mlt_playlist_append_io( playlist, instance, in, out );
 		mlt_playlist_remove_region( playlist, 0, original );
+		id = label_entry( unit, playlist, 0, 0 );
 		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
 		melted_log( LOG_DEBUG, "loaded clip %s", clip );
+		journal_record( unit, 0, "load %d %d %d %s", in, out, mlt_producer_get_length( instance ), clip );
+		journal_record( unit, 1, "id 0 %d", id );
+		pthread_mutex_unlock( &unit->journal_mutex );
+		mlt_properties_close( held );
 		update_generation( unit );
 		melted_unit_status_communicate( unit );
 		mlt_producer_close( instance );
@@ -319,17 +994,24 @@ mvcp_error_code melted_unit_load( melted_unit unit, char *clip, int32_t in, int3
 
 mvcp_error_code melted_unit_insert( melted_unit unit, char *clip, int index, int32_t in, int32_t out )
 {
-	mlt_producer instance = locate_producer( unit, clip );
+	mlt_producer instance = open_clip( unit, clip, index );
 
 	if ( instance != NULL )
 	{
 		mlt_properties properties = unit->properties;
 		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+		int where, id;
 		fprintf( stderr, "inserting clip %s before %d\n", clip, index );
+		pthread_mutex_lock( &unit->journal_mutex );
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+		where = index < 0 ? 0 : index < mlt_playlist_count( playlist ) ? index : mlt_playlist_count( playlist );
 		mlt_playlist_insert( playlist, instance, index, in, out );
+		id = label_entry( unit, playlist, where, 0 );
 		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
 		melted_log( LOG_DEBUG, "inserted clip %s at %d", clip, index );
+		journal_record( unit, 0, "insert %d %d %d %d %s", index, in, out, mlt_producer_get_length( instance ), clip );
+		journal_record( unit, 1, "id %d %d", where, id );
+		pthread_mutex_unlock( &unit->journal_mutex );
 		update_generation( unit );
 		melted_unit_status_communicate( unit );
 		mlt_producer_close( instance );
@@ -343,10 +1025,16 @@ mvcp_error_code melted_unit_remove( melted_unit unit, int index )
 {
 	mlt_properties properties = unit->properties;
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties held;
+	pthread_mutex_lock( &unit->journal_mutex );
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	held = hold_cuts( playlist, index, 1 );
 	mlt_playlist_remove( playlist, index );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
 	melted_log( LOG_DEBUG, "removed clip at %d", index );
+	journal_record( unit, 1, "remove %d", index );
+	pthread_mutex_unlock( &unit->journal_mutex );
+	mlt_properties_close( held );
 	update_generation( unit );
 	melted_unit_status_communicate( unit );
 	return mvcp_ok;
@@ -354,16 +1042,26 @@ mvcp_error_code melted_unit_remove( melted_unit unit, int index )
 
 mvcp_error_code melted_unit_clean( melted_unit unit )
 {
+	int current;
+	pthread_mutex_lock( &unit->journal_mutex );
+	current = melted_unit_get_current_clip( unit );
 	clean_unit( unit );
 	melted_log( LOG_DEBUG, "Cleaned playlist" );
+	journal_record( unit, 1, "clean %d", current );
+	pthread_mutex_unlock( &unit->journal_mutex );
 	melted_unit_status_communicate( unit );
 	return mvcp_ok;
 }
 
 mvcp_error_code melted_unit_wipe( melted_unit unit )
 {
+	int current;
+	pthread_mutex_lock( &unit->journal_mutex );
+	current = melted_unit_get_current_clip( unit );
 	wipe_unit( unit );
 	melted_log( LOG_DEBUG, "Wiped playlist" );
+	journal_record( unit, 1, "wipe %d", current );
+	pthread_mutex_unlock( &unit->journal_mutex );
 	melted_unit_status_communicate( unit );
 	return mvcp_ok;
 }
@@ -371,9 +1069,12 @@ mvcp_error_code melted_unit_wipe( melted_unit unit )
 mvcp_error_code melted_unit_clear( melted_unit unit )
 {
 	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+	pthread_mutex_lock( &unit->journal_mutex );
 	clear_unit( unit );
 	mlt_consumer_purge( consumer );
 	melted_log( LOG_DEBUG, "Cleared playlist" );
+	journal_record( unit, 1, "clear" );
+	pthread_mutex_unlock( &unit->journal_mutex );
 	melted_unit_status_communicate( unit );
 	return mvcp_ok;
 }
@@ -382,87 +1083,2028 @@ mvcp_error_code melted_unit_move( melted_unit unit, int src, int dest )
 {
 	mlt_properties properties = unit->properties;
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
-	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
-	mlt_playlist_move( playlist, src, dest );
-	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-	melted_log( LOG_DEBUG, "moved clip %d to %d", src, dest );
-	update_generation( unit );
-	melted_unit_status_communicate( unit );
-	return mvcp_ok;
+	pthread_mutex_lock( &unit->journal_mutex );
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_playlist_move( playlist, src, dest );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	melted_log( LOG_DEBUG, "moved clip %d to %d", src, dest );
+	journal_record( unit, 1, "move %d %d", src, dest );
+	pthread_mutex_unlock( &unit->journal_mutex );
+	update_generation( unit );
+	melted_unit_status_communicate( unit );
+	return mvcp_ok;
+}
+
+/** Add a clip to the unit play list.
+
+    \todo error handling
+    \param unit A melted_unit handle.
+    \param clip The absolute file name of the clip to load.
+    \param in   The starting frame (-1 for 0)
+	\param out  The ending frame (-1 for maximum)
+*/
+
+mvcp_error_code melted_unit_append( melted_unit unit, char *clip, int32_t in, int32_t out )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_producer instance = open_clip( unit, clip, mlt_playlist_count( playlist ) );
+
+	if ( instance != NULL )
+	{
+		int index, id;
+		pthread_mutex_lock( &unit->journal_mutex );
+		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+		mlt_playlist_append_io( playlist, instance, in, out );
+		index = mlt_playlist_count( playlist ) - 1;
+		id = label_entry( unit, playlist, index, 0 );
+		melted_log( LOG_DEBUG, "appended clip %s", clip );
+		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		journal_record( unit, 0, "append %d %d %d %s", in, out, mlt_producer_get_length( instance ), clip );
+		journal_record( unit, 1, "id %d %d", index, id );
+		pthread_mutex_unlock( &unit->journal_mutex );
+		update_generation( unit );
+		melted_unit_status_communicate( unit );
+		mlt_producer_close( instance );
+		return mvcp_ok;
+	}
+
+	return mvcp_invalid_file;
+}
+
+/** Add an mlt_service to the playlist
+
+    \param unit A melted_unit handle.
+    \param service the service to add
+*/
+
+mvcp_error_code melted_unit_append_service( melted_unit unit, mlt_service service )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	char *resource;
+	int index, id;
+	pthread_mutex_lock( &unit->journal_mutex );
+	resource = persist_service( unit, ( mlt_producer )service );
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_playlist_append( playlist, ( mlt_producer )service );
+	index = mlt_playlist_count( playlist ) - 1;
+	id = label_entry( unit, playlist, index, 0 );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	melted_log( LOG_DEBUG, "appended clip" );
+	if ( resource != NULL )
+	{
+		journal_record( unit, 0, "append -1 -1 %d %s", mlt_producer_get_length( ( mlt_producer )service ), resource );
+		journal_record( unit, 1, "id %d %d", index, id );
+	}
+	pthread_mutex_unlock( &unit->journal_mutex );
+	update_generation( unit );
+	melted_unit_status_communicate( unit );
+	schedule_render( unit, ( mlt_producer )service );
+	return mvcp_ok;
+}
+
+/** Number of times SYNC compares the playlist with the list off lock
+    before it keeps the playlist locked while it does so.
+*/
+
+#define SYNC_ATTEMPTS 3
+
+/** A playlist entry as seen by SYNC.
+*/
+
+typedef struct
+{
+	mlt_playlist_clip_info info;
+	char *key;
+	int keep;
+}
+sync_row;
+
+/** Get the key by which SYNC matches a producer.
+
+    A producer opened from a file, or saved to the journal, is known by its
+    resource. A composition such as a pushed tractor is not: its resource
+    does not say what it plays, so it is known by the producer itself.
+
+    \param resource The resource to use otherwise.
+    \return The key, to be freed by the caller.
+*/
+
+static char *sync_key( mlt_producer producer, char *resource )
+{
+	char key[ 64 ];
+
+	if ( producer != NULL )
+	{
+		mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+		char *own = mlt_properties_get( properties, "resource" );
+		if ( mlt_properties_get( properties, "melted.resource" ) != NULL )
+			return strdup( mlt_properties_get( properties, "melted.resource" ) );
+		if ( mlt_service_identify( MLT_PRODUCER_SERVICE( producer ) ) != producer_type || own == NULL || own[ 0 ] == '<' )
+		{
+			snprintf( key, sizeof( key ), "<%p>", producer );
+			return strdup( key );
+		}
+	}
+
+	return strdup( resource != NULL ? resource : "" );
+}
+
+/** Copy the playlist entries and reference their cuts - must be called
+    with the playlist lock held.
+*/
+
+static sync_row *sync_rows( mlt_playlist playlist, int *total, int *current )
+{
+	sync_row *rows;
+	int i;
+
+	*total = mlt_playlist_count( playlist );
+	*current = mlt_playlist_current_clip( playlist );
+	rows = calloc( *total + 1, sizeof( sync_row ) );
+	for ( i = 0; rows != NULL && i < *total; i ++ )
+	{
+		mlt_playlist_get_clip_info( playlist, &rows[ i ].info, i );
+		if ( rows[ i ].info.cut != NULL )
+			mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( rows[ i ].info.cut ) );
+	}
+
+	return rows;
+}
+
+/** Release the entries copied by sync_rows.
+*/
+
+static void sync_release( sync_row *rows, int total )
+{
+	int i;
+	for ( i = 0; rows != NULL && i < total; i ++ )
+	{
+		free( rows[ i ].key );
+		mlt_producer_close( rows[ i ].info.cut );
+	}
+	free( rows );
+}
+
+/** Determine if the playlist still holds the entries copied by sync_rows -
+    must be called with the playlist lock held.
+*/
+
+static int sync_unchanged( mlt_playlist playlist, sync_row *rows, int total, int current )
+{
+	int i;
+
+	if ( mlt_playlist_count( playlist ) != total || mlt_playlist_current_clip( playlist ) != current )
+		return 0;
+	for ( i = 0; i < total; i ++ )
+		if ( mlt_playlist_get_clip( playlist, i ) != rows[ i ].info.cut )
+			return 0;
+
+	return 1;
+}
+
+/** Determine if a SYNC item describes a playlist entry.
+*/
+
+static int sync_matches( mlt_properties item, sync_row *row )
+{
+	int in = mlt_properties_get_int( item, "in" );
+	int out = mlt_properties_get_int( item, "out" );
+
+	return !strcmp( row->key, mlt_properties_get( item, "key" ) ) &&
+		   ( in < 0 ? 0 : in ) == row->info.frame_in &&
+		   ( out < 0 ? row->info.length - 1 : out ) == row->info.frame_out;
+}
+
+/** Work out which entries after the playing one are kept and which item
+    each kept entry matches.
+
+    \param match Set to the entry matched by each item or -1.
+    \param first Set to the first item after the playing clip.
+    \return 0 on success.
+*/
+
+static int sync_plan( sync_row *rows, int total, int current, mlt_properties items, int *match, int *first )
+{
+	int count = mlt_properties_count( items );
+	int base = current < total ? current + 1 : 0;
+	int width, i, j;
+	int *table;
+
+	for ( i = 0; i < total; i ++ )
+	{
+		if ( rows[ i ].key == NULL )
+			rows[ i ].key = sync_key( rows[ i ].info.producer, rows[ i ].info.resource );
+		rows[ i ].keep = 0;
+	}
+
+	// Skip the list up to the playing clip
+	*first = 0;
+	if ( current < total )
+	{
+		for ( i = 0; i < count; i ++ )
+			if ( sync_matches( mlt_properties_get_data_at( items, i, NULL ), &rows[ current ] ) )
+				break;
+		*first = i < count ? i + 1 : 0;
+	}
+
+	// Longest common sequence of the entries after the playing clip and the list
+	width = count - *first + 1;
+	table = calloc( ( size_t )( total - base + 1 ) * width, sizeof( int ) );
+	if ( table == NULL )
+		return 1;
+	for ( i = total - 1; i >= base; i -- )
+		for ( j = count - 1; j >= *first; j -- )
+		{
+			int *cell = &table[ ( i - base ) * width + j - *first ];
+			if ( sync_matches( mlt_properties_get_data_at( items, j, NULL ), &rows[ i ] ) )
+				*cell = cell[ width + 1 ] + 1;
+			else
+				*cell = cell[ width ] > cell[ 1 ] ? cell[ width ] : cell[ 1 ];
+		}
+
+	// Mark the kept entries and the items they match
+	for ( j = 0; j < count; j ++ )
+		match[ j ] = -1;
+	for ( i = base, j = *first; i < total && j < count; )
+	{
+		int *cell = &table[ ( i - base ) * width + j - *first ];
+		if ( sync_matches( mlt_properties_get_data_at( items, j, NULL ), &rows[ i ] ) )
+		{
+			rows[ i ].keep = 1;
+			match[ j ++ ] = i ++;
+		}
+		else if ( cell[ width ] >= cell[ 1 ] )
+			i ++;
+		else
+			j ++;
+	}
+	free( table );
+
+	return 0;
+}
+
+/** Bring the clips after the playing one in line with a list of clips.
+
+    Each item of the list has a "resource" and optional "in" and "out", and
+    may carry an already constructed "producer". The items up to and
+    including the first one matching the playing clip are skipped. The
+    playing clip and those before it are never changed; after it, entries
+    forming the longest common sequence with the list are kept along with
+    their open producers, and the others are removed or inserted in one
+    batch under the playlist lock. Items and entries are matched as told
+    by sync_key.
+
+    The list is compared with a copy of the entries made under the lock,
+    and the changes are only made if the playlist still holds the same
+    entries when the lock is taken again. Producers of new items are
+    opened off lock, and an item already in the playlist reuses its
+    producer.
+
+    \return mvcp_ok, or mvcp_invalid_file if a resource can not be opened.
+*/
+
+mvcp_error_code melted_unit_sync( melted_unit unit, mlt_properties items )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_properties opened = mlt_properties_new( );
+	mlt_properties keys = mlt_properties_new( );
+	sync_row *rows = NULL;
+	int count = mlt_properties_count( items );
+	int *match = calloc( count + 1, sizeof( int ) );
+	int first = 0, total = 0, current = 0, kept = 0, removed = 0, inserted = 0;
+	int attempt, applied = 0;
+	mvcp_error_code error = match == NULL ? mvcp_invalid_file : mvcp_ok;
+	int i, j;
+
+	pthread_mutex_lock( &unit->journal_mutex );
+
+	// Open the items which are not in the playlist yet
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	rows = sync_rows( playlist, &total, &current );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	for ( i = 0; rows != NULL && i < total; i ++ )
+	{
+		rows[ i ].key = sync_key( rows[ i ].info.producer, rows[ i ].info.resource );
+		mlt_properties_set_int( keys, rows[ i ].key, 1 );
+	}
+
+	for ( i = 0; i < count && error == mvcp_ok; i ++ )
+	{
+		mlt_properties item = mlt_properties_get_data_at( items, i, NULL );
+		char *resource = mlt_properties_get( item, "resource" );
+		mlt_producer producer = mlt_properties_get_data( item, "producer", NULL );
+		char *key = sync_key( producer, resource );
+
+		if ( !mlt_properties_get_int( keys, key ) && mlt_properties_get_data( opened, key, NULL ) == NULL )
+		{
+			if ( producer != NULL )
+			{
+				char *persisted = persist_service( unit, producer );
+				mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( producer ) );
+				if ( persisted != NULL && strcmp( persisted, resource ) )
+				{
+					mlt_properties_set( item, "resource", persisted );
+					free( key );
+					key = sync_key( producer, persisted );
+				}
+			}
+			else if ( ( producer = locate_producer( unit, resource ) ) == NULL )
+			{
+				melted_log( LOG_ERR, "sync unable to open %s", resource );
+				error = mvcp_invalid_file;
+			}
+			if ( producer != NULL )
+				mlt_properties_set_data( opened, key, producer, 0, ( mlt_destructor )mlt_producer_close, NULL );
+		}
+		mlt_properties_set( item, "key", key );
+		free( key );
+	}
+
+	// Compare off lock, then apply if the playlist did not change meanwhile
+	for ( attempt = 1; error == mvcp_ok && !applied; attempt ++ )
+	{
+		int locked = attempt > SYNC_ATTEMPTS;
+		sync_row *stale = NULL;
+		int stale_total = total;
+
+		// The last attempt keeps the lock while it compares
+		if ( locked )
+		{
+			mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+			stale = rows;
+			rows = sync_rows( playlist, &total, &current );
+		}
+		if ( rows == NULL || sync_plan( rows, total, current, items, match, &first ) != 0 )
+		{
+			error = mvcp_invalid_file;
+			if ( locked )
+				mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+			sync_release( stale, stale_total );
+			break;
+		}
+		if ( !locked )
+			mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+		if ( locked || sync_unchanged( playlist, rows, total, current ) )
+		{
+			int base = current < total ? current + 1 : 0;
+
+			// Remove the other entries, then insert the missing items in order
+			for ( i = total - 1; i >= base; i -- )
+			{
+				if ( rows[ i ].keep )
+				{
+					kept ++;
+				}
+				else
+				{
+					mlt_playlist_remove( playlist, i );
+					journal_record( unit, 0, "remove %d", i );
+					removed ++;
+				}
+			}
+			for ( j = first; j < count; j ++ )
+			{
+				mlt_properties item = mlt_properties_get_data_at( items, j, NULL );
+				char *key = mlt_properties_get( item, "key" );
+				mlt_producer producer = mlt_properties_get_data( opened, key, NULL );
+				int in = mlt_properties_get_int( item, "in" );
+				int out = mlt_properties_get_int( item, "out" );
+
+				if ( match[ j ] >= 0 )
+					continue;
+				for ( i = 0; producer == NULL && i < total; i ++ )
+					if ( !strcmp( rows[ i ].key, key ) )
+						producer = rows[ i ].info.producer;
+				if ( producer != NULL )
+				{
+					int where = base + j - first < mlt_playlist_count( playlist ) ? base + j - first : mlt_playlist_count( playlist );
+					mlt_playlist_insert( playlist, producer, base + j - first, in, out );
+					journal_record( unit, 0, "insert %d %d %d %d %s", base + j - first, in, out,
+						mlt_producer_get_length( producer ), mlt_properties_get( item, "resource" ) );
+					journal_record( unit, 0, "id %d %d", where, label_entry( unit, playlist, where, 0 ) );
+					inserted ++;
+				}
+			}
+			applied = 1;
+		}
+		else
+		{
+			melted_log( LOG_DEBUG, "sync: playlist changed while comparing, trying again" );
+		}
+		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		sync_release( stale, stale_total );
+
+		if ( !applied )
+		{
+			stale = rows;
+			stale_total = total;
+			mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+			rows = sync_rows( playlist, &total, &current );
+			mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+			sync_release( stale, stale_total );
+		}
+	}
+
+	if ( removed + inserted > 0 )
+		journal_position( unit, 1 );
+	pthread_mutex_unlock( &unit->journal_mutex );
+
+	// The removed cuts are only closed here, off lock
+	sync_release( rows, total );
+	mlt_properties_close( opened );
+	mlt_properties_close( keys );
+	free( match );
+
+	if ( error == mvcp_ok )
+	{
+		melted_log( LOG_DEBUG, "synced playlist: %d kept, %d removed, %d inserted", kept, removed, inserted );
+		if ( removed + inserted > 0 )
+		{
+			update_generation( unit );
+			melted_unit_status_communicate( unit );
+		}
+	}
+
+	return error;
+}
+
+/** Get the black producer a unit shows while stopped with stop=black.
+*/
+
+static mlt_producer black_producer( melted_unit unit )
+{
+	mlt_producer black = mlt_properties_get_data( unit->properties, "black", NULL );
+
+	if ( black == NULL )
+	{
+		mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+		mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+		black = mlt_factory_producer( profile, "colour", "black" );
+		if ( black != NULL )
+		{
+			mlt_producer_set_speed( black, 0 );
+			mlt_properties_set_data( unit->properties, "black", black, 0, ( mlt_destructor )mlt_producer_close, NULL );
+		}
+	}
+
+	return black;
+}
+
+/** Bring a unit that was stopped warm back to its playlist.
+
+    \return 1 if the unit was stopped warm.
+*/
+
+static int resume_unit( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+
+	if ( !mlt_properties_get_int( properties, "warm" ) )
+		return 0;
+
+	if ( mlt_properties_get_int( properties, "warm_black" ) )
+	{
+		mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+		mlt_consumer_connect( consumer, MLT_PLAYLIST_SERVICE( playlist ) );
+		mlt_consumer_purge( consumer );
+		mlt_properties_set_int( properties, "warm_black", 0 );
+	}
+	mlt_properties_set_int( properties, "warm", 0 );
+
+	return 1;
+}
+
+/** Stop the unit's consumer, closing its output.
+*/
+
+static void release_consumer( melted_unit unit )
+{
+	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+	mlt_consumer_stop( consumer );
+	resume_unit( unit );
+}
+
+/** Start playing the unit.
+
+    \todo error handling
+    \param unit A melted_unit handle.
+    \param speed An integer that specifies the playback rate as a
+                 percentage multiplied by 100.
+*/
+
+void melted_unit_play( melted_unit_t *unit, int speed )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+	int cued = mlt_properties_get_int( properties, "cued" );
+	int warm = resume_unit( unit );
+
+	// Time the command until the first moving frame is shown
+	if ( speed != 0 && ( mlt_producer_get_speed( producer ) == 0 || mlt_consumer_is_stopped( consumer ) ) )
+	{
+		mlt_properties_set_int( properties, "play_cued", cued );
+		mlt_properties_set_int( properties, "play_warm", warm );
+		mlt_properties_set_int64( properties, "play_requested", time_now( ) );
+	}
+
+	mlt_producer_set_speed( producer, ( double )speed / 1000 );
+	mlt_consumer_start( consumer );
+
+	// Drop the paused frames buffered while cued so the next frame moves
+	if ( cued && speed != 0 )
+	{
+		mlt_consumer_purge( consumer );
+		mlt_properties_set_int( properties, "cued", 0 );
+	}
+
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
+	journal_position( unit, 1 );
+	melted_unit_status_communicate( unit );
+}
+
+/** Get the number of frames to decode ahead of a cue or clip transition.
+*/
+
+static int get_preroll( melted_unit unit )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	if ( mlt_properties_get( playlist_properties, "preroll" ) != NULL )
+		return mlt_properties_get_int( playlist_properties, "preroll" );
+	return DEFAULT_PREROLL;
+}
+
+/** Decode the frames following a playlist position, up to the end of its
+    clip, and keep them for the playlist.
+
+    The frames are decoded by a private producer of the clip, so neither
+    the consumer nor the decoder of the playlist is disturbed, and the
+    frame cache hands them to the playlist when it reaches them.
+
+    \param unit A melted_unit handle.
+    \param from The playlist position of the first frame, or -1 for the
+    position the playlist reads next.
+    \param count The number of frames to decode.
+    \return The number of frames decoded.
+*/
+
+static int prime_unit( melted_unit unit, mlt_position from, int count )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_playlist_clip_info info;
+	mlt_position position = 0;
+	char *resource = NULL;
+	int decoded = 0;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	if ( from < 0 )
+		from = mlt_producer_frame( producer );
+	if ( mlt_playlist_get_clip_info( playlist, &info, mlt_playlist_get_clip_index_at( playlist, from ) ) == 0 &&
+		 info.cut != NULL && info.producer != NULL &&
+		 mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.resource" ) != NULL &&
+		 !mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.placeholder" ) )
+	{
+		resource = strdup( mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.resource" ) );
+		position = info.frame_in + from - info.start;
+		if ( count > info.frame_out - position + 1 )
+			count = info.frame_out - position + 1;
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( resource != NULL && consumer != NULL )
+	{
+		mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+		mlt_producer preroll = mlt_factory_producer( profile, NULL, resource );
+		if ( preroll != NULL )
+		{
+			mlt_properties_inherit( MLT_PRODUCER_PROPERTIES( preroll ), mlt_properties_get_data( properties, "producer", NULL ) );
+			decoded = melted_frames_prime( mlt_properties_get_int( properties, "unit" ), preroll, resource, position, count );
+			mlt_producer_close( preroll );
+		}
+	}
+	free( resource );
+
+	return decoded;
+}
+
+/** Prepare the next clip when the current one is about to end.
+
+    When playing forwards and within the "lookahead" number of frames of the
+    end of the current clip, the first frames of the following clip are
+    decoded by the very producer the playlist will play them from and
+    primed for the playlist. Crossing the boundary then takes the primed
+    frames, and the producer's demuxer and decoder are already open and
+    positioned just past them, so neither waits. An entry sharing its
+    producer with the playing one, or still a placeholder, is left alone.
+    Each entry is only prepared once.
+
+    Runs on the unit's worker thread. The playlist is only locked while
+    the next entry is looked up, so the consumer is never held up.
+*/
+
+static void lookahead_unit( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	int lookahead = DEFAULT_LOOKAHEAD;
+	mlt_playlist_clip_info info;
+	mlt_producer playing = NULL;
+	mlt_producer next = NULL;
+	mlt_position in = 0;
+	mlt_position count = 0;
+	char *resource = NULL;
+	int current;
+
+	if ( mlt_properties_get( playlist_properties, "lookahead" ) != NULL )
+		lookahead = mlt_properties_get_int( playlist_properties, "lookahead" );
+	if ( lookahead <= 0 || mlt_producer_get_speed( producer ) <= 0 || mlt_consumer_is_stopped( consumer ) )
+		return;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	current = mlt_playlist_current_clip( playlist );
+	if ( mlt_playlist_get_clip_info( playlist, &info, current ) == 0 &&
+		 info.start + info.frame_count - mlt_producer_frame( producer ) <= lookahead &&
+		 ( playing = info.producer ) != NULL &&
+		 mlt_playlist_get_clip_info( playlist, &info, current + 1 ) == 0 &&
+		 info.cut != NULL && info.producer != NULL && !mlt_playlist_is_blank( playlist, current + 1 ) &&
+		 mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.cut ), "melted.id" ) != mlt_properties_get_int( properties, "lookahead_id" ) )
+	{
+		mlt_properties_set_int( properties, "lookahead_id", mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.cut ), "melted.id" ) );
+		if ( info.producer != playing &&
+			 mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.resource" ) != NULL &&
+			 !mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.placeholder" ) )
+		{
+			resource = strdup( mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.resource" ) );
+			next = info.producer;
+			mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( next ) );
+			in = info.frame_in;
+			count = info.frame_count;
+		}
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( next != NULL )
+	{
+		int64_t start = time_now( );
+		int decoded = melted_frames_prime( mlt_properties_get_int( properties, "unit" ), next, resource, in, count < get_preroll( unit ) ? count : get_preroll( unit ) );
+		stats_record( unit, "lookahead", ( double )( time_now( ) - start ) / 1000 );
+		melted_log( LOG_DEBUG, "U%d prepared clip %d with %d frames", mlt_properties_get_int( properties, "unit" ), current + 1, decoded );
+		mlt_producer_close( next );
+	}
+	free( resource );
+}
+
+/** Number of frames decoded into the ring on each request.
+*/
+
+#define RING_CHUNK 25
+
+/** The background decoder of a unit's ring and its latest request.
+*/
+
+typedef struct
+{
+	melted_unit unit;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+	int pending;
+	char *resource;
+	mlt_position position;
+	mlt_position first;
+	mlt_position last;
+	int jog;
+	mlt_profile profile;
+	mlt_properties defaults;
+}
+ring_decoder;
+
+/** Fill the ring around one requested position.
+
+    The producer is kept from one request to the next while the clip is
+    the same.
+*/
+
+static void ring_fill( ring_decoder *decoder, mlt_producer *producer, char **current, char *resource,
+	mlt_position position, mlt_position first, mlt_position last, int jog )
+{
+	int index = mlt_properties_get_int( decoder->unit->properties, "unit" );
+	mlt_position from = position - RING_CHUNK < first ? first : position - RING_CHUNK;
+	mlt_position keyframe;
+	int64_t start;
+	int decoded;
+
+	// Keep one private producer for the clip being scrubbed
+	if ( *current == NULL || strcmp( *current, resource ) )
+	{
+		mlt_producer_close( *producer );
+		*producer = mlt_factory_producer( decoder->profile, NULL, resource );
+		if ( *producer != NULL )
+			mlt_properties_inherit( MLT_PRODUCER_PROPERTIES( *producer ), decoder->defaults );
+		free( *current );
+		*current = *producer != NULL ? strdup( resource ) : NULL;
+	}
+	if ( *producer == NULL )
+		return;
+
+	// Start on a keyframe so no frame is decoded only to reach the first one
+	keyframe = melted_index_keyframe( resource, from );
+	if ( position - keyframe <= 2 * RING_CHUNK )
+		from = keyframe;
+	start = time_now( );
+	decoded = melted_frames_fill( index, *producer, resource, from, position - from );
+	if ( jog && position < last )
+		decoded += melted_frames_fill( index, *producer, resource, position + 1, last - position < RING_CHUNK ? last - position : RING_CHUNK );
+	if ( decoded > 0 )
+		stats_record( decoder->unit, "ring", ( double )( time_now( ) - start ) / 1000 );
+}
+
+/** The ring decoder thread - serves the most recent request, so the
+    worker never waits for a decode and positions passed over are skipped.
+*/
+
+static void *ring_run( void *arg )
+{
+	ring_decoder *decoder = arg;
+	mlt_producer producer = NULL;
+	char *current = NULL;
+
+	pthread_mutex_lock( &decoder->mutex );
+	while ( decoder->running )
+	{
+		char *resource;
+		mlt_position position = decoder->position;
+		mlt_position first = decoder->first;
+		mlt_position last = decoder->last;
+		int jog = decoder->jog;
+
+		if ( !decoder->pending )
+		{
+			pthread_cond_wait( &decoder->cond, &decoder->mutex );
+			continue;
+		}
+		resource = decoder->resource;
+		decoder->resource = NULL;
+		decoder->pending = 0;
+		pthread_mutex_unlock( &decoder->mutex );
+
+		ring_fill( decoder, &producer, &current, resource, position, first, last, jog );
+		free( resource );
+
+		pthread_mutex_lock( &decoder->mutex );
+	}
+	pthread_mutex_unlock( &decoder->mutex );
+
+	mlt_producer_close( producer );
+	free( current );
+
+	return NULL;
+}
+
+/** Stop a ring decoder, once its current request is done, and free it.
+*/
+
+static void ring_close( ring_decoder *decoder )
+{
+	if ( decoder != NULL )
+	{
+		pthread_mutex_lock( &decoder->mutex );
+		decoder->running = 0;
+		pthread_cond_broadcast( &decoder->cond );
+		pthread_mutex_unlock( &decoder->mutex );
+		pthread_join( decoder->thread, NULL );
+		pthread_mutex_destroy( &decoder->mutex );
+		pthread_cond_destroy( &decoder->cond );
+		mlt_profile_close( decoder->profile );
+		mlt_properties_close( decoder->defaults );
+		free( decoder->resource );
+		free( decoder );
+	}
+}
+
+/** Start the ring decoder of a unit.
+
+    \return The decoder or NULL if its thread could not be started.
+*/
+
+static ring_decoder *ring_open( melted_unit unit, mlt_profile profile )
+{
+	ring_decoder *decoder = calloc( 1, sizeof( ring_decoder ) );
+
+	if ( decoder != NULL )
+	{
+		char *description;
+
+		// The decoder keeps its own copy of the profile of the unit's consumer
+		decoder->unit = unit;
+		decoder->profile = mlt_profile_init( NULL );
+		description = decoder->profile->description;
+		*decoder->profile = *profile;
+		decoder->profile->description = description;
+		decoder->defaults = mlt_properties_new( );
+		mlt_properties_inherit( decoder->defaults, mlt_properties_get_data( unit->properties, "producer", NULL ) );
+		pthread_mutex_init( &decoder->mutex, NULL );
+		pthread_cond_init( &decoder->cond, NULL );
+		decoder->running = 1;
+		if ( pthread_create( &decoder->thread, NULL, ring_run, decoder ) != 0 )
+		{
+			pthread_mutex_destroy( &decoder->mutex );
+			pthread_cond_destroy( &decoder->cond );
+			mlt_profile_close( decoder->profile );
+			mlt_properties_close( decoder->defaults );
+			free( decoder );
+			decoder = NULL;
+		}
+	}
+
+	return decoder;
+}
+
+/** Keep the unit's ring of decoded frames filled around the playhead.
+
+    The unit setting "ring" gives the memory budget of the ring in MB. While
+    the unit plays in reverse or jogs, the frames behind the playhead are
+    decoded forwards by a private producer of the playing clip, so reverse
+    play and scrubbing find them ready instead of each frame costing a
+    backward seek of the decoder. When jogging the frames ahead are filled
+    too.
+
+    Runs on the unit's worker thread, which only passes the playhead to the
+    unit's ring decoder thread. The playlist is only locked while the
+    playing clip is looked up.
+*/
+
+static void ring_step( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	int index = mlt_properties_get_int( properties, "unit" );
+	int64_t budget = ( int64_t )mlt_properties_get_int( playlist_properties, "ring" ) << 20;
+	int jog = mlt_properties_get_int( playlist_properties, "jog" );
+	mlt_playlist_clip_info info;
+	ring_decoder *decoder;
+	mlt_position position = 0;
+	mlt_position first = 0;
+	mlt_position last = 0;
+	char *resource = NULL;
+
+	if ( budget != mlt_properties_get_int64( properties, "ring_budget" ) )
+	{
+		if ( budget <= 0 )
+			mlt_properties_set_data( properties, "ring_decoder", NULL, 0, NULL, NULL );
+		melted_frames_set_ring( index, budget );
+		mlt_properties_set_int64( properties, "ring_budget", budget );
+	}
+	if ( budget <= 0 || consumer == NULL || ( mlt_producer_get_speed( producer ) >= 0 && !jog ) )
+		return;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	if ( mlt_playlist_get_clip_info( playlist, &info, mlt_playlist_current_clip( playlist ) ) == 0 &&
+		 info.cut != NULL && info.producer != NULL &&
+		 mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.resource" ) != NULL &&
+		 !mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.placeholder" ) )
+	{
+		resource = strdup( mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.resource" ) );
+		position = info.frame_in + mlt_producer_frame( producer ) - info.start;
+		first = info.frame_in;
+		last = info.frame_out;
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( resource == NULL )
+		return;
+
+	decoder = mlt_properties_get_data( properties, "ring_decoder", NULL );
+	if ( decoder == NULL && ( decoder = ring_open( unit, mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) ) ) ) != NULL )
+		mlt_properties_set_data( properties, "ring_decoder", decoder, 0, ( mlt_destructor )ring_close, NULL );
+	if ( decoder == NULL )
+	{
+		free( resource );
+		return;
+	}
+
+	// Only the latest playhead is kept; a request not started yet is replaced
+	pthread_mutex_lock( &decoder->mutex );
+	free( decoder->resource );
+	decoder->resource = resource;
+	decoder->position = position;
+	decoder->first = first;
+	decoder->last = last;
+	decoder->jog = jog;
+	decoder->pending = 1;
+	pthread_cond_signal( &decoder->cond );
+	pthread_mutex_unlock( &decoder->mutex );
+}
+
+/** Get the file name extension of the files an avformat muxer writes.
+
+    \param format The muxer set by render.f, or NULL to let the extension
+           choose Matroska.
+*/
+
+static const char *render_extension( const char *format )
+{
+	static const char *extensions[][ 2 ] =
+	{
+		{ "matroska", "mkv" }, { "mpegts", "ts" }, { "mpeg", "mpg" }, { "mpeg2video", "m2v" },
+		{ "ipod", "m4v" }, { "image2", "png" }, { NULL, NULL }
+	};
+	int i;
+
+	if ( format == NULL || *format == '\0' )
+		return "mkv";
+	for ( i = 0; extensions[ i ][ 0 ] != NULL; i ++ )
+		if ( !strcmp( format, extensions[ i ][ 0 ] ) )
+			return extensions[ i ][ 1 ];
+
+	// Most muxers are named after the extension of their files
+	return format;
+}
+
+/** Start rendering a newly pushed composition in the background.
+
+    The unit setting "render" names the directory the rendered file is
+    written to. Only a composition appended at least "render_lead" seconds
+    ahead of air is rendered, at the lowest priority, with the unit
+    settings render.* passed to the avformat consumer. render_step swaps
+    the entry for the file once it is complete.
+*/
+
+static void schedule_render( melted_unit unit, mlt_producer service )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	mlt_profile profile = consumer != NULL ? mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) ) : NULL;
+	char *directory = mlt_properties_get( playlist_properties, "render" );
+	double lead = DEFAULT_RENDER_LEAD;
+	mlt_properties jobs = mlt_properties_get_data( properties, "render_jobs", NULL );
+	mlt_properties options;
+	mlt_playlist_clip_info info;
+	mlt_consumer xml;
+	melted_render render;
+	char source[ PATH_MAX ];
+	char target[ PATH_MAX ];
+	char key[ 32 ];
+	long long stamp = ( long long )time_now( );
+	int index = -1;
+	int id = 0;
+	int i;
+
+	if ( directory == NULL || *directory == '\0' || profile == NULL || profile->frame_rate_num <= 0 )
+		return;
+	if ( mlt_properties_get( playlist_properties, "render_lead" ) != NULL )
+		lead = mlt_properties_get_double( playlist_properties, "render_lead" );
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	for ( i = mlt_playlist_count( playlist ) - 1; i >= 0 && index < 0; i -- )
+		if ( mlt_playlist_get_clip_info( playlist, &info, i ) == 0 && info.producer == service )
+			index = i;
+	if ( index >= 0 && ( info.start - mlt_producer_frame( MLT_PLAYLIST_PRODUCER( playlist ) ) ) * profile->frame_rate_den >= lead * profile->frame_rate_num )
+		id = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.cut ), "melted.id" );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( id <= 0 )
+		return;
+
+	options = mlt_properties_new( );
+	for ( i = 0; i < mlt_properties_count( playlist_properties ); i ++ )
+		if ( !strncmp( mlt_properties_get_name( playlist_properties, i ), "render.", 7 ) )
+			mlt_properties_set( options, mlt_properties_get_name( playlist_properties, i ) + 7, mlt_properties_get_value( playlist_properties, i ) );
+
+	// Save the composition so that the render uses its own instance of it,
+	// named with the same stamp as the file it is rendered to
+	snprintf( source, sizeof( source ), "%s/.melted-U%d-%d-%lld.mlt", directory, mlt_properties_get_int( properties, "unit" ), id, stamp );
+	snprintf( target, sizeof( target ), "%s/melted-U%d-%d-%lld.%s", directory, mlt_properties_get_int( properties, "unit" ), id, stamp,
+		render_extension( mlt_properties_get( options, "f" ) ) );
+	xml = mlt_factory_consumer( profile, "xml", source );
+	if ( xml == NULL )
+	{
+		mlt_properties_close( options );
+		return;
+	}
+	mlt_consumer_connect( xml, MLT_PRODUCER_SERVICE( service ) );
+	mlt_consumer_start( xml );
+	mlt_consumer_close( xml );
+
+	render = melted_render_start( profile, source, target, options );
+	mlt_properties_close( options );
+
+	if ( render == NULL )
+	{
+		unlink( source );
+		return;
+	}
+
+	if ( jobs == NULL )
+	{
+		jobs = mlt_properties_new( );
+		mlt_properties_set_data( properties, "render_jobs", jobs, 0, ( mlt_destructor )mlt_properties_close, NULL );
+	}
+	snprintf( key, sizeof( key ), "%d", id );
+	mlt_properties_set_data( jobs, key, render, 0, ( mlt_destructor )melted_render_close, NULL );
+	melted_log( LOG_DEBUG, "U%d rendering clip #%d to %s", mlt_properties_get_int( properties, "unit" ), id, target );
+}
+
+/** Swap pushed compositions for their rendered files once complete.
+
+    A render which has not finished a few seconds before its clip airs is
+    cancelled and the composition is played live. The render is only
+    released once its thread has finished, so the unit's worker thread
+    never waits for it. A rendered file too short for the entry's in and
+    out points is not used. Runs on the unit's worker thread, one entry per
+    call.
+*/
+
+static void render_step( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_properties jobs = mlt_properties_get_data( properties, "render_jobs", NULL );
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	mlt_profile profile = consumer != NULL ? mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) ) : NULL;
+	int i;
+
+	for ( i = 0; jobs != NULL && profile != NULL && i < mlt_properties_count( jobs ); i ++ )
+	{
+		melted_render render = mlt_properties_get_data_at( jobs, i, NULL );
+		char *key = mlt_properties_get_name( jobs, i );
+		mlt_playlist_clip_info info;
+		mlt_producer cut = NULL;
+		int ahead = 0;
+		int index;
+
+		if ( render == NULL )
+			continue;
+
+		// A cancelled render is reaped once its thread has given up
+		if ( melted_render_cancelled( render ) )
+		{
+			if ( melted_render_state( render ) == 0 )
+				continue;
+			mlt_properties_set_data( jobs, key, NULL, 0, NULL, NULL );
+			break;
+		}
+
+		index = melted_unit_find_clip( unit, atoi( key ) );
+		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+		if ( index >= 0 && mlt_playlist_get_clip_info( playlist, &info, index ) == 0 )
+		{
+			ahead = ( info.start - mlt_producer_frame( MLT_PLAYLIST_PRODUCER( playlist ) ) ) * profile->frame_rate_den >= RENDER_MARGIN * profile->frame_rate_num;
+			cut = info.cut;
+			mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( cut ) );
+		}
+		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+		if ( cut != NULL && ahead && melted_render_state( render ) == 0 )
+		{
+			mlt_producer_close( cut );
+			continue;
+		}
+
+		if ( cut != NULL && ahead && melted_render_state( render ) == 1 )
+		{
+			mlt_producer replacement = locate_producer( unit, ( char * )melted_render_target( render ) );
+			if ( replacement != NULL && mlt_producer_get_length( replacement ) <= info.frame_out )
+			{
+				melted_log( LOG_WARNING, "U%d render of clip #%s has %d frames, fewer than the entry plays, playing it live",
+					mlt_properties_get_int( properties, "unit" ), key, ( int )mlt_producer_get_length( replacement ) );
+				mlt_producer_close( replacement );
+				unlink( melted_render_target( render ) );
+				replacement = NULL;
+			}
+			if ( replacement != NULL )
+			{
+				replacement = defer_producer( unit, replacement, index );
+				if ( replace_entry( unit, cut, replacement ) )
+				{
+					melted_log( LOG_NOTICE, "U%d playing clip #%s from %s", mlt_properties_get_int( properties, "unit" ), key, melted_render_target( render ) );
+					update_generation( unit );
+					melted_unit_status_communicate( unit );
+				}
+				mlt_producer_close( replacement );
+			}
+		}
+		else if ( cut != NULL && melted_render_state( render ) == 0 )
+		{
+			melted_log( LOG_WARNING, "U%d clip #%s airs before its render is complete, playing it live", mlt_properties_get_int( properties, "unit" ), key );
+		}
+		mlt_producer_close( cut );
+
+		// A running render is only asked to stop here and reaped later
+		if ( melted_render_state( render ) == 0 )
+			melted_render_cancel( render );
+		else
+			mlt_properties_set_data( jobs, key, NULL, 0, NULL, NULL );
+		break;
+	}
+}
+
+/** Release played clips beyond the unit's "history" limit.
+
+    Only the oldest clip is removed on each call so that the playlist lock
+    is held briefly. The clip is referenced across the removal and closed
+    after the lock is released, so the demuxer and decoder are torn down
+    on the calling thread rather than while the consumer waits.
+
+    \return 1 if a clip was removed.
+*/
+
+static int trim_unit( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	mlt_playlist_clip_info info;
+	mlt_producer cut = NULL;
+
+	if ( mlt_properties_get( playlist_properties, "history" ) == NULL || mlt_properties_get_int( playlist_properties, "history" ) < 0 )
+		return 0;
+
+	pthread_mutex_lock( &unit->journal_mutex );
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	if ( mlt_playlist_current_clip( playlist ) > mlt_properties_get_int( playlist_properties, "history" ) &&
+		 mlt_playlist_get_clip_info( playlist, &info, 0 ) == 0 && info.cut != NULL )
+	{
+		cut = info.cut;
+		mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( cut ) );
+		mlt_playlist_remove( playlist, 0 );
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( cut != NULL )
+		journal_record( unit, 0, "remove 0" );
+	pthread_mutex_unlock( &unit->journal_mutex );
+
+	if ( cut != NULL )
+	{
+		mlt_producer_close( cut );
+		update_generation( unit );
+		melted_unit_status_communicate( unit );
+	}
+
+	return cut != NULL;
+}
+
+/** Bring one playlist entry in line with the unit's producer window.
+
+    The playing clip is materialised first, then the following clips in
+    order, and finally real producers that have left the window are swapped
+    back to placeholders. Producers are opened and closed with the playlist
+    unlocked; the entry is only swapped if it was not changed meanwhile.
+
+    \return 1 if an entry was changed.
+*/
+
+static int window_step( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	mlt_playlist_clip_info info;
+	mlt_producer cut = NULL;
+	mlt_producer parent = NULL;
+	int64_t start = time_now( );
+	int current, count, window, index, i;
+	int changed = 0;
+
+	if ( mlt_properties_get( playlist_properties, "window" ) == NULL || mlt_properties_get_int( playlist_properties, "window" ) < 0 )
+		return 0;
+	window = mlt_properties_get_int( playlist_properties, "window" );
+
+	// Find the entry to change
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	current = mlt_playlist_current_clip( playlist );
+	count = mlt_playlist_count( playlist );
+
+	// Nothing to do if nothing moved since the window was last settled
+	if ( mlt_properties_get_int( properties, "window_settled" ) &&
+		 mlt_properties_get_int( properties, "window_generation" ) == mlt_properties_get_int( properties, "generation" ) &&
+		 mlt_properties_get_int( properties, "window_current" ) == current &&
+		 mlt_properties_get_int( properties, "window_size" ) == window )
+	{
+		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		return 0;
+	}
+	for ( i = 0; cut == NULL && i < count; i ++ )
+	{
+		if ( i <= window )
+			index = current + i;
+		else if ( i - window - 1 < current )
+			index = i - window - 1;
+		else
+			index = i;
+
+		if ( index < count && mlt_playlist_get_clip_info( playlist, &info, index ) == 0 && info.producer != NULL )
+		{
+			mlt_properties clip_properties = MLT_PRODUCER_PROPERTIES( info.producer );
+			int placeholder = mlt_properties_get_int( clip_properties, "melted.placeholder" );
+			if ( ( i <= window ) == placeholder && mlt_properties_get( clip_properties, "melted.resource" ) != NULL )
+			{
+				cut = info.cut;
+				parent = info.producer;
+				mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( cut ) );
+			}
+		}
+	}
+	mlt_properties_set_int( properties, "window_settled", cut == NULL );
+	mlt_properties_set_int( properties, "window_generation", mlt_properties_get_int( properties, "generation" ) );
+	mlt_properties_set_int( properties, "window_current", current );
+	mlt_properties_set_int( properties, "window_size", window );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( cut == NULL )
+		return 0;
+
+	changed = swap_entry( unit, cut, parent );
+
+	if ( changed )
+		stats_record( unit, "window", ( double )( time_now( ) - start ) / 1000 );
+
+	return changed;
+}
+
+/** Swap a playlist entry between a placeholder and an open producer.
+
+    The producer is opened or described with the playlist unlocked, and the
+    entry is only swapped if it is still in the playlist.
+
+    \param unit A melted_unit handle.
+    \param cut The entry's cut - the reference held by the caller is released.
+    \param parent The producer of the cut.
+    \return 1 if the entry was changed.
+*/
+
+static int swap_entry( melted_unit unit, mlt_producer cut, mlt_producer parent )
+{
+	mlt_producer replacement = NULL;
+	int changed = 0;
+
+	// Open or describe the clip off lock
+	if ( mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( parent ), "melted.placeholder" ) )
+		replacement = locate_producer( unit, mlt_properties_get( MLT_PRODUCER_PROPERTIES( parent ), "melted.resource" ) );
+	else
+		replacement = create_placeholder( unit, parent );
+
+	// Swap it in if the entry is still in the playlist
+	if ( replacement != NULL )
+	{
+		changed = replace_entry( unit, cut, replacement );
+		mlt_producer_close( replacement );
+	}
+
+	mlt_producer_close( cut );
+
+	return changed;
+}
+
+/** Replace the producer of a playlist entry, keeping its in and out points
+    and its clip id.
+
+    \param unit A melted_unit handle.
+    \param cut The entry's cut.
+    \param replacement The new producer - the caller keeps its reference.
+    \return 1 if the entry was still in the playlist and was replaced.
+*/
+
+static int replace_entry( melted_unit unit, mlt_producer cut, mlt_producer replacement )
+{
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_playlist_clip_info info;
+	int changed = 0;
+	int index;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	for ( index = 0; index < mlt_playlist_count( playlist ); index ++ )
+		if ( mlt_playlist_get_clip_info( playlist, &info, index ) == 0 && info.cut == cut )
+			break;
+	if ( index < mlt_playlist_count( playlist ) )
+	{
+		mlt_position position = mlt_producer_position( producer );
+		int id = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( cut ), "melted.id" );
+		mlt_playlist_remove( playlist, index );
+		mlt_playlist_insert( playlist, replacement, index, info.frame_in, info.frame_out );
+		label_entry( unit, playlist, index, id );
+		mlt_producer_seek( producer, position );
+		changed = 1;
+	}
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	return changed;
+}
+
+/** Open one of the placeholders left by a restore.
+
+    Only used when the unit has no producer window, which would otherwise
+    manage the placeholders itself. The playing clip is opened first, then
+    the others in playlist order.
+
+    \return 1 if an entry was changed.
+*/
+
+static int restore_step( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	mlt_playlist_clip_info info;
+	mlt_producer cut = NULL;
+	mlt_producer parent = NULL;
+	int i;
+
+	if ( !mlt_properties_get_int( properties, "restore_pending" ) ||
+		 ( mlt_properties_get( playlist_properties, "window" ) != NULL && mlt_properties_get_int( playlist_properties, "window" ) >= 0 ) )
+		return 0;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	for ( i = -1; cut == NULL && i < mlt_playlist_count( playlist ); i ++ )
+	{
+		int index = i < 0 ? mlt_playlist_current_clip( playlist ) : i;
+		if ( mlt_playlist_get_clip_info( playlist, &info, index ) == 0 && info.producer != NULL &&
+			 mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.producer ), "melted.placeholder" ) )
+		{
+			cut = info.cut;
+			parent = info.producer;
+			mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( cut ) );
+		}
+	}
+	if ( cut == NULL )
+		mlt_properties_set_int( properties, "restore_pending", 0 );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	return cut != NULL ? swap_entry( unit, cut, parent ) : 0;
+}
+
+/** The unit worker thread - woken each time the consumer shows a frame.
+*/
+
+static void *melted_unit_worker( void *arg )
+{
+	melted_unit unit = arg;
+
+	pthread_mutex_lock( &unit->mutex );
+	while ( unit->running )
+	{
+		pthread_cond_wait( &unit->cond, &unit->mutex );
+		if ( !unit->running )
+			break;
+		pthread_mutex_unlock( &unit->mutex );
+		window_step( unit );
+		restore_step( unit );
+		lookahead_unit( unit );
+		ring_step( unit );
+		render_step( unit );
+		trim_unit( unit );
+		journal_step( unit );
+		pthread_mutex_lock( &unit->mutex );
+	}
+	pthread_mutex_unlock( &unit->mutex );
+
+	return NULL;
+}
+
+/** Cue the unit for playback.
+
+    Seeks to the requested position, decodes the first frames and leaves the
+    consumer running paused so that a following PLAY starts on the next
+    frame.
+
+    \param unit A melted_unit handle.
+    \param clip The clip index to cue or -1 for the current position.
+    \param position The frame position within the clip.
+*/
+
+void melted_unit_cue( melted_unit unit, int clip, int32_t position )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	int64_t start = time_now( );
+	int count;
+
+	mlt_producer_set_speed( producer, 0 );
+	if ( clip >= 0 )
+		melted_unit_change_position( unit, clip, position );
+
+	if ( mlt_playlist_current( playlist ) != NULL &&
+		 mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( mlt_producer_cut_parent( mlt_playlist_current( playlist ) ) ), "melted.placeholder" ) )
+		window_step( unit );
+	melted_frames_unprime( mlt_properties_get_int( properties, "unit" ) );
+	count = prime_unit( unit, -1, get_preroll( unit ) );
+
+	resume_unit( unit );
+	mlt_consumer_start( consumer );
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "refresh", 1 );
+	mlt_properties_set_int( properties, "cued", 1 );
+
+	stats_record( unit, "cue", ( double )( time_now( ) - start ) / 1000 );
+	melted_log( LOG_DEBUG, "cued U%d with %d frames", mlt_properties_get_int( properties, "unit" ), count );
+	melted_unit_status_communicate( unit );
+}
+
+/** Consumer listener used to measure the start latency of PLAY.
+*/
+
+static void melted_unit_frame_shown( mlt_consumer consumer, melted_unit unit, mlt_frame frame )
+{
+	mlt_properties properties = unit->properties;
+	int64_t requested = mlt_properties_get_int64( properties, "play_requested" );
+	mlt_consumer claimed = NULL;
+	mlt_position shown;
+
+	if ( requested != 0 && frame != NULL && mlt_properties_get_double( MLT_FRAME_PROPERTIES( frame ), "_speed" ) != 0 )
+	{
+		double latency = ( double )( time_now( ) - requested ) / 1000;
+		int cued = mlt_properties_get_int( properties, "play_cued" );
+		int warm = mlt_properties_get_int( properties, "play_warm" );
+		mlt_properties_set_int64( properties, "play_requested", 0 );
+		stats_record( unit, cued ? "play_cued" : warm ? "play_warm" : "play", latency );
+		melted_log( LOG_INFO, "U%d first frame %.1fms after PLAY%s", mlt_properties_get_int( properties, "unit" ), latency,
+			cued ? " (cued)" : warm ? " (warm)" : "" );
+	}
+
+	pthread_mutex_lock( &unit->mutex );
+	if ( frame != NULL )
+	{
+		shown = mlt_frame_get_position( frame );
+		mlt_properties_set_position( properties, "shown_position", shown );
+		if ( mlt_properties_get_int( properties, "display_inputs" ) > 0 && shown == mlt_properties_get_position( properties, "display_target" ) )
+		{
+			stats_record( unit, "seek", ( double )( time_now( ) - mlt_properties_get_int64( properties, "display_time" ) ) / 1000 );
+			stats_record( unit, "seek_inputs", mlt_properties_get_int( properties, "display_inputs" ) );
+			mlt_properties_set_int( properties, "display_inputs", 0 );
+		}
+	}
+	if ( consumer == mlt_properties_get_data( properties, "consumer", NULL ) )
+		claimed = claim_output( unit );
+	shown = mlt_properties_get_position( properties, "shown_position" );
+	if ( mlt_properties_get_int( properties, "seek_pending" ) )
+		apply_seek( unit );
+	pthread_cond_broadcast( &unit->cond );
+	pthread_mutex_unlock( &unit->mutex );
+
+	if ( claimed != NULL )
+		cut_output( unit, claimed, shown );
+}
+
+/** Estimate the memory held by the unit's output.
+
+    Counts the frames the consumer buffers, at the size of the profile, and
+    the decoded images kept for the unit alone. What the open producers hold
+    in their demuxers and decoders is not known to melted and not included.
+*/
+
+static void report_memory( melted_unit unit, mvcp_response response )
+{
+	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+	int64_t frames = melted_frames_unit_bytes( mlt_properties_get_int( unit->properties, "unit" ) );
+	int64_t buffer = 0;
+
+	if ( consumer != NULL )
+	{
+		mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+		mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+		int count = mlt_properties_get( properties, "buffer" ) != NULL ? mlt_properties_get_int( properties, "buffer" ) : DEFAULT_BUFFER;
+		int frequency = mlt_properties_get( properties, "frequency" ) != NULL ? mlt_properties_get_int( properties, "frequency" ) : 48000;
+		int channels = mlt_properties_get( properties, "channels" ) != NULL ? mlt_properties_get_int( properties, "channels" ) : 2;
+		if ( profile != NULL && profile->frame_rate_num > 0 )
+			buffer = ( int64_t )count * ( mlt_image_format_size( mlt_image_yuv422, profile->width, profile->height, NULL ) +
+				( int64_t )frequency * profile->frame_rate_den / profile->frame_rate_num * channels * sizeof( int16_t ) );
+	}
+
+	mvcp_response_printf( response, 1024, "memory.buffer=%lld\n", ( long long )buffer );
+	mvcp_response_printf( response, 1024, "memory.frames=%lld\n", ( long long )frames );
+	mvcp_response_printf( response, 1024, "memory=%lld\n", ( long long )( buffer + frames ) );
+}
+
+/** Report the unit statistics.
+
+    Besides the accumulated timings, reports the number of clips held by the
+    playlist, how many of those have already been played, the number of
+    distinct producers (open media) they reference, the producer cache
+    counters and an estimate of the memory held by the output.
+*/
+
+void melted_unit_report_stats( melted_unit unit, mvcp_response response )
+{
+	mlt_properties stats = mlt_properties_get_data( unit->properties, "stats", NULL );
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_properties parents = mlt_properties_new( );
+	melted_cache cache = mlt_properties_get_data( unit->properties, "cache", NULL );
+	int i;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	for ( i = 0; i < mlt_playlist_count( playlist ); i ++ )
+	{
+		mlt_playlist_clip_info info;
+		if ( mlt_playlist_get_clip_info( playlist, &info, i ) == 0 && info.producer != NULL && !mlt_playlist_is_blank( playlist, i ) )
+		{
+			char key[ 32 ];
+			snprintf( key, sizeof( key ), "%p", info.producer );
+			mlt_properties_set_int( parents, key, 1 );
+		}
+	}
+	mvcp_response_printf( response, 1024, "clips=%d\n", mlt_playlist_count( playlist ) );
+	mvcp_response_printf( response, 1024, "played=%d\n", mlt_playlist_current_clip( playlist ) );
+	mvcp_response_printf( response, 1024, "producers=%d\n", mlt_properties_count( parents ) );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_properties_close( parents );
+
+	pthread_mutex_lock( &cache->mutex );
+	mvcp_response_printf( response, 1024, "cache.size=%d\n", cache->count );
+	mvcp_response_printf( response, 1024, "cache.hits=%d\n", cache->hits );
+	mvcp_response_printf( response, 1024, "cache.misses=%d\n", cache->misses );
+	if ( cache->hits + cache->misses > 0 )
+		mvcp_response_printf( response, 1024, "cache.hit_rate=%.2f\n", ( double )cache->hits / ( cache->hits + cache->misses ) );
+	pthread_mutex_unlock( &cache->mutex );
+
+	melted_frames_report_unit( mlt_properties_get_int( unit->properties, "unit" ), response );
+	report_memory( unit, response );
+
+	for ( i = 0; i < mlt_properties_count( stats ); i ++ )
+		mvcp_response_printf( response, 1024, "%s=%s\n", mlt_properties_get_name( stats, i ), mlt_properties_get_value( stats, i ) );
+	mvcp_response_printf( response, 1024, "\n" );
+}
+
+/** Append a record to the unit's journal, if it has one.
+
+    Commands changing the playlist hold the journal mutex from the change
+    until the record is written, so that a snapshot never includes a change
+    whose record follows it in the journal.
+
+    \param sync Non zero to wait for the record to reach the disk.
+*/
+
+static void journal_record( melted_unit unit, int sync, const char *format, ... )
+{
+	melted_journal journal;
+
+	if ( mlt_properties_get_int( unit->properties, "replaying" ) )
+		return;
+
+	pthread_mutex_lock( &unit->journal_mutex );
+	journal = mlt_properties_get_data( unit->properties, "journal", NULL );
+	if ( journal != NULL )
+	{
+		va_list list;
+		va_start( list, format );
+		melted_journal_vwrite( journal, sync, format, list );
+		va_end( list );
+	}
+	pthread_mutex_unlock( &unit->journal_mutex );
+}
+
+/** Journal the current clip, the offset in it and the speed.
+*/
+
+static void journal_position( melted_unit unit, int sync )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_playlist_clip_info info;
+	mlt_position frame;
+	int current;
+
+	if ( mlt_properties_get_data( properties, "journal", NULL ) == NULL )
+		return;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	current = mlt_playlist_current_clip( playlist );
+	frame = mlt_producer_frame( producer );
+	if ( mlt_playlist_get_clip_info( playlist, &info, current ) != 0 )
+		info.start = info.frame_in = 0;
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	journal_record( unit, sync, "position %d %d %d", current, ( int )( frame - info.start + info.frame_in ),
+		( int )( mlt_producer_get_speed( producer ) * 1000 ) );
+	mlt_properties_set_int64( properties, "journal_time", time_now( ) );
+	mlt_properties_set_position( properties, "journal_frame", frame );
+}
+
+/** Save a service which has no resource, such as a pushed composition, in
+    the directory <base>.d beside the unit's journal so that it can be
+    restored.
+
+    \return The resource of the service or NULL if it has none and the unit
+            has no journal.
+*/
+
+static char *persist_service( melted_unit unit, mlt_producer producer )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	char *resource = mlt_properties_get( properties, "melted.resource" );
+	melted_journal journal;
+	char path[ PATH_MAX ];
+
+	if ( resource != NULL )
+		return resource;
+
+	pthread_mutex_lock( &unit->journal_mutex );
+	journal = mlt_properties_get_data( unit->properties, "journal", NULL );
+	if ( journal != NULL )
+	{
+		mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+		mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+		mlt_consumer xml;
+
+		snprintf( path, sizeof( path ), "%s.d", melted_journal_base( journal ) );
+		if ( mkdir( path, 0755 ) != 0 && errno != EEXIST )
+			melted_log( LOG_WARNING, "unable to create %s", path );
+		snprintf( path, sizeof( path ), "%s.d/%lld.mlt", melted_journal_base( journal ), ( long long )time_now( ) );
+		xml = mlt_factory_consumer( profile, "xml", path );
+		if ( xml != NULL )
+		{
+			mlt_consumer_connect( xml, MLT_PRODUCER_SERVICE( producer ) );
+			mlt_consumer_start( xml );
+			mlt_consumer_close( xml );
+			mlt_properties_set( properties, "melted.resource", path );
+			resource = mlt_properties_get( properties, "melted.resource" );
+		}
+	}
+	pthread_mutex_unlock( &unit->journal_mutex );
+
+	return resource;
+}
+
+/** Remove the saved services which the snapshot no longer refers to.
+
+    Only the directory persist_service writes to is looked at, so no other
+    file next to the journal is ever touched.
+*/
+
+static void remove_services( const char *base, const char *records, time_t started )
+{
+	char dir[ PATH_MAX ];
+	DIR *directory;
+	struct dirent *entry;
+
+	snprintf( dir, sizeof( dir ), "%s.d", base );
+	directory = opendir( dir );
+	while ( directory != NULL && ( entry = readdir( directory ) ) != NULL )
+	{
+		size_t length = strlen( entry->d_name );
+		char path[ PATH_MAX ];
+		struct stat info;
+
+		if ( length < 4 || strcmp( entry->d_name + length - 4, ".mlt" ) )
+			continue;
+		snprintf( path, sizeof( path ), "%s/%s", dir, entry->d_name );
+		if ( strstr( records, path ) == NULL && stat( path, &info ) == 0 && info.st_mtime < started )
+			unlink( path );
+	}
+	if ( directory != NULL )
+		closedir( directory );
+}
+
+/** Write a snapshot of the unit's settings, playlist and position and
+    empty its journal.
+
+    Clips are recorded with their length, so a restore adds them as
+    placeholders rather than probing every file again. The playlist lock is
+    only held while the entries are referenced; pushed compositions are
+    saved after it is released.
+*/
+
+static void unit_snapshot( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_properties settings = mlt_properties_get_data( properties, "settings", NULL );
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_playlist_clip_info info;
+	melted_journal journal;
+	time_t started = time( NULL );
+	mlt_properties entries;
+	char *records = NULL;
+	size_t size = 0;
+	FILE *file;
+	int current, offset = 0, speed;
+	int i;
+
+	pthread_mutex_lock( &unit->journal_mutex );
+	journal = mlt_properties_get_data( properties, "journal", NULL );
+	if ( journal == NULL || ( file = open_memstream( &records, &size ) ) == NULL )
+	{
+		pthread_mutex_unlock( &unit->journal_mutex );
+		return;
+	}
+
+	for ( i = 0; i < mlt_properties_count( settings ); i ++ )
+		fprintf( file, "set %s=%s\n", mlt_properties_get_name( settings, i ), mlt_properties_get_value( settings, i ) );
+	fprintf( file, "clear\n" );
+
+	// Each entry is a child holding its points and, unless blank, its producer
+	entries = mlt_properties_new( );
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	for ( i = 0; i < mlt_playlist_count( playlist ); i ++ )
+	{
+		mlt_properties entry;
+		char key[ 32 ];
+		if ( mlt_playlist_get_clip_info( playlist, &info, i ) != 0 || info.producer == NULL )
+			continue;
+		entry = mlt_properties_new( );
+		mlt_properties_set_int( entry, "in", info.frame_in );
+		mlt_properties_set_int( entry, "out", info.frame_out );
+		mlt_properties_set_int( entry, "count", info.frame_count );
+		mlt_properties_set_int( entry, "id", mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( info.cut ), "melted.id" ) );
+		if ( !mlt_playlist_is_blank( playlist, i ) )
+		{
+			mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( info.producer ) );
+			mlt_properties_set_data( entry, "producer", info.producer, 0, ( mlt_destructor )mlt_producer_close, NULL );
+			mlt_properties_set( entry, "resource", info.resource );
+		}
+		snprintf( key, sizeof( key ), "%d", i );
+		mlt_properties_set_data( entries, key, entry, 0, ( mlt_destructor )mlt_properties_close, NULL );
+	}
+	current = mlt_playlist_current_clip( playlist );
+	if ( mlt_playlist_get_clip_info( playlist, &info, current ) == 0 )
+		offset = mlt_producer_frame( producer ) - info.start + info.frame_in;
+	else
+		current = -1;
+	speed = mlt_producer_get_speed( producer ) * 1000;
+	fprintf( file, "ids %d\n", mlt_properties_get_int( properties, "clip_id" ) );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	for ( i = 0; i < mlt_properties_count( entries ); i ++ )
+	{
+		mlt_properties entry = mlt_properties_get_data_at( entries, i, NULL );
+		mlt_producer clip = mlt_properties_get_data( entry, "producer", NULL );
+		if ( clip == NULL )
+		{
+			fprintf( file, "blank %d\n", mlt_properties_get_int( entry, "count" ) - 1 );
+		}
+		else
+		{
+			char *resource = persist_service( unit, clip );
+			fprintf( file, "append %d %d %d %s\n", mlt_properties_get_int( entry, "in" ), mlt_properties_get_int( entry, "out" ),
+				( int )mlt_producer_get_length( clip ), resource != NULL ? resource : mlt_properties_get( entry, "resource" ) );
+		}
+		if ( mlt_properties_get_int( entry, "id" ) != 0 )
+			fprintf( file, "id %d %d\n", i, mlt_properties_get_int( entry, "id" ) );
+	}
+	if ( current >= 0 )
+		fprintf( file, "position %d %d %d\n", current, offset, speed );
+	mlt_properties_close( entries );
+	fclose( file );
+
+	if ( records != NULL && melted_journal_snapshot( journal, records ) == 0 )
+		remove_services( melted_journal_base( journal ), records, started );
+	pthread_mutex_unlock( &unit->journal_mutex );
+
+	mlt_properties_set_int64( properties, "journal_time", time_now( ) );
+	free( records );
+}
+
+/** Journal the play position from time to time, and after a coalesced
+    seek has been applied, and compact the journal once it has grown.
+*/
+
+static void journal_step( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	melted_journal journal;
+	int sought;
+
+	pthread_mutex_lock( &unit->mutex );
+	sought = mlt_properties_get_int( properties, "seek_journal" );
+	mlt_properties_set_int( properties, "seek_journal", 0 );
+	pthread_mutex_unlock( &unit->mutex );
+
+	pthread_mutex_lock( &unit->journal_mutex );
+	journal = mlt_properties_get_data( properties, "journal", NULL );
+	if ( journal != NULL )
+	{
+		if ( ( sought || time_now( ) - mlt_properties_get_int64( properties, "journal_time" ) >= JOURNAL_INTERVAL ) &&
+			 mlt_producer_frame( MLT_PLAYLIST_PRODUCER( playlist ) ) != mlt_properties_get_position( properties, "journal_frame" ) )
+			journal_position( unit, 0 );
+		if ( melted_journal_records( journal ) > JOURNAL_COMPACT )
+			unit_snapshot( unit );
+	}
+	pthread_mutex_unlock( &unit->journal_mutex );
 }
 
-/** Add a clip to the unit play list.
+/** Add a journaled clip to the playlist.
 
-    \todo error handling
-    \param unit A melted_unit handle.
-    \param clip The absolute file name of the clip to load.
-    \param in   The starting frame (-1 for 0)
-	\param out  The ending frame (-1 for maximum)
+    A clip of known length is added as a placeholder which the producer
+    window, or restore_step without one, opens when needed.
 */
 
-mvcp_error_code melted_unit_append( melted_unit unit, char *clip, int32_t in, int32_t out )
+static void restore_clip( melted_unit unit, int index, int32_t in, int32_t out, int length, char *file )
 {
-	mlt_producer instance = locate_producer( unit, clip );
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_producer producer = length > 0 ? describe_clip( unit, file, NULL, length ) : locate_producer( unit, file );
 
-	if ( instance != NULL )
+	if ( producer == NULL )
 	{
-		mlt_properties properties = unit->properties;
-		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
-		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
-		mlt_playlist_append_io( playlist, instance, in, out );
-		melted_log( LOG_DEBUG, "appended clip %s", clip );
-		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-		update_generation( unit );
-		melted_unit_status_communicate( unit );
-		mlt_producer_close( instance );
-		return mvcp_ok;
+		melted_log( LOG_WARNING, "unable to restore clip %s", file );
+		return;
 	}
 
-	return mvcp_invalid_file;
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	if ( index < 0 )
+		mlt_playlist_append_io( playlist, producer, in, out );
+	else
+		mlt_playlist_insert( playlist, producer, index, in, out );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_producer_close( producer );
+
+	if ( length > 0 )
+		mlt_properties_set_int( unit->properties, "restore_pending", 1 );
 }
 
-/** Add an mlt_service to the playlist
+/** Give a restored clip the id it was journaled with.
 
-    \param unit A melted_unit handle.
-    \param service the service to add
+    The id is only taken by an entry without one, so a clip which could not
+    be restored does not pass its id on to another entry.
 */
 
-mvcp_error_code melted_unit_append_service( melted_unit unit, mlt_service service )
+static void restore_id( melted_unit unit, int index, int id )
 {
-	mlt_properties properties = unit->properties;
-	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
+	mlt_producer cut;
+
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
-	mlt_playlist_append( playlist, ( mlt_producer )service );
+	cut = mlt_playlist_get_clip( playlist, index );
+	if ( cut != NULL && mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( cut ), "melted.id" ) == 0 )
+		label_entry( unit, playlist, index, id );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-	melted_log( LOG_DEBUG, "appended clip" );
-	update_generation( unit );
-	melted_unit_status_communicate( unit );
-	return mvcp_ok;
 }
 
-/** Start playing the unit.
-
-    \todo error handling
-    \param unit A melted_unit handle.
-    \param speed An integer that specifies the playback rate as a
-                 percentage multiplied by 100.
+/** Apply one snapshot or journal record to the unit.
 */
 
-void melted_unit_play( melted_unit_t *unit, int speed )
+static void apply_record( void *arg, char *record )
 {
+	melted_unit unit = arg;
 	mlt_properties properties = unit->properties;
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
-	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
-	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
-	mlt_producer_set_speed( producer, ( double )speed / 1000 );
-	mlt_consumer_start( consumer );
-	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
-	melted_unit_status_communicate( unit );
+	mlt_playlist_clip_info info;
+	int a = 0, b = 0, c = 0, d = 0, skip = 0;
+
+	if ( !strncmp( record, "set ", 4 ) )
+	{
+		melted_unit_set( unit, record + 4 );
+	}
+	else if ( sscanf( record, "load %d %d %d %n", &a, &b, &c, &skip ) == 3 && skip > 0 )
+	{
+		clear_unit( unit );
+		restore_clip( unit, -1, a, b, c, record + skip );
+	}
+	else if ( sscanf( record, "insert %d %d %d %d %n", &a, &b, &c, &d, &skip ) == 4 && skip > 0 )
+	{
+		restore_clip( unit, a, b, c, d, record + skip );
+	}
+	else if ( sscanf( record, "append %d %d %d %n", &a, &b, &c, &skip ) == 3 && skip > 0 )
+	{
+		restore_clip( unit, -1, a, b, c, record + skip );
+	}
+	else if ( sscanf( record, "remove %d", &a ) == 1 )
+	{
+		melted_unit_remove( unit, a );
+	}
+	else if ( sscanf( record, "move %d %d", &a, &b ) == 2 )
+	{
+		melted_unit_move( unit, a, b );
+	}
+	else if ( sscanf( record, "clean %d", &a ) == 1 )
+	{
+		// Remove everything but the clip which was playing
+		while ( mlt_playlist_count( playlist ) > a + 1 )
+			melted_unit_remove( unit, a + 1 );
+		while ( a -- > 0 && mlt_playlist_count( playlist ) > 1 )
+			melted_unit_remove( unit, 0 );
+	}
+	else if ( sscanf( record, "wipe %d", &a ) == 1 )
+	{
+		// Remove the clips before the one which was playing
+		while ( a -- > 0 && mlt_playlist_count( playlist ) > 1 )
+			melted_unit_remove( unit, 0 );
+	}
+	else if ( !strcmp( record, "clear" ) )
+	{
+		clear_unit( unit );
+	}
+	else if ( sscanf( record, "in %d %d", &a, &b ) == 2 && mlt_playlist_get_clip_info( playlist, &info, a ) == 0 )
+	{
+		mlt_playlist_resize_clip( playlist, a, b, info.frame_out );
+	}
+	else if ( sscanf( record, "out %d %d", &a, &b ) == 2 && mlt_playlist_get_clip_info( playlist, &info, a ) == 0 )
+	{
+		mlt_playlist_resize_clip( playlist, a, info.frame_in, b );
+	}
+	else if ( sscanf( record, "ids %d", &a ) == 1 )
+	{
+		if ( a > mlt_properties_get_int( properties, "clip_id" ) )
+			mlt_properties_set_int( properties, "clip_id", a );
+	}
+	else if ( sscanf( record, "id %d %d", &a, &b ) == 2 )
+	{
+		restore_id( unit, a, b );
+	}
+	else if ( sscanf( record, "blank %d", &a ) == 1 )
+	{
+		mlt_playlist_blank( playlist, a );
+	}
+	else if ( sscanf( record, "position %d %d %d", &a, &b, &c ) == 3 )
+	{
+		mlt_properties_set_int( properties, "restore_clip", a );
+		mlt_properties_set_int( properties, "restore_offset", b );
+		mlt_properties_set_int( properties, "restore_speed", c );
+	}
+	else
+	{
+		melted_log( LOG_WARNING, "ignoring journal record: %s", record );
+	}
+}
+
+/** Open the journal named by the unit's journal setting and rebuild the
+    unit's state from it.
+
+    The clips are restored as placeholders, so only the clip at the restored
+    position is opened before playback resumes.
+*/
+
+void melted_unit_restore( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	char *base = melted_unit_get( unit, "journal" );
+	int64_t start = time_now( );
+	melted_journal journal;
+	int count;
+
+	if ( base == NULL || !strcmp( base, "" ) || ( journal = melted_journal_open( base ) ) == NULL )
+		return;
+
+	pthread_mutex_lock( &unit->journal_mutex );
+	mlt_properties_set_int( properties, "replaying", 1 );
+	mlt_properties_set_int( properties, "restore_clip", -1 );
+	count = melted_journal_replay( journal, apply_record, unit );
+	mlt_properties_set_int( properties, "replaying", 0 );
+	mlt_properties_set_data( properties, "journal", journal, 0, ( mlt_destructor )melted_journal_close, NULL );
+	pthread_mutex_unlock( &unit->journal_mutex );
+
+	if ( count > 0 )
+	{
+		int speed = mlt_properties_get_int( properties, "restore_speed" );
+
+		update_generation( unit );
+		if ( mlt_properties_get_int( properties, "restore_clip" ) >= 0 )
+			melted_unit_change_position( unit, mlt_properties_get_int( properties, "restore_clip" ),
+				mlt_properties_get_int( properties, "restore_offset" ) );
+
+		// Open the clip at the playhead now rather than on the first shown frame
+		if ( !window_step( unit ) )
+			restore_step( unit );
+
+		if ( speed != 0 )
+			melted_unit_play( unit, speed );
+		else
+			melted_unit_status_communicate( unit );
+
+		stats_record( unit, "restore", ( double )( time_now( ) - start ) / 1000 );
+		melted_log( LOG_NOTICE, "restored %d clips from %s in %d ms", mlt_playlist_count( mlt_properties_get_data( properties, "playlist", NULL ) ),
+			base, ( int )( ( time_now( ) - start ) / 1000 ) );
+	}
+
+	unit_snapshot( unit );
+}
+
+/** Write a final snapshot and detach the unit's journal.
+*/
+
+void melted_unit_suspend( melted_unit unit )
+{
+	unit_snapshot( unit );
+	pthread_mutex_lock( &unit->journal_mutex );
+	mlt_properties_set_data( unit->properties, "journal", NULL, 0, NULL, NULL );
+	pthread_mutex_unlock( &unit->journal_mutex );
 }
 
 /** Stop playback.
 
-    Terminates the consumer and halts playout.
+    Terminates the consumer and halts playout. With the stop property set
+    to hold or black the consumer keeps running on the held frame or on
+    black instead.
 
     \param unit A melted_unit handle.
 */
@@ -472,8 +3114,27 @@ void melted_unit_terminate( melted_unit unit )
 	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
 	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
 	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	char *mode = mlt_properties_get( MLT_PLAYLIST_PROPERTIES( playlist ), "stop" );
+
 	mlt_producer_set_speed( producer, 0 );
-	mlt_consumer_stop( consumer );
+
+	// Keep the consumer threads and the device running so PLAY starts at once
+	if ( mode != NULL && ( !strcmp( mode, "hold" ) || !strcmp( mode, "black" ) ) && !mlt_consumer_is_stopped( consumer ) )
+	{
+		if ( !strcmp( mode, "black" ) && !mlt_properties_get_int( unit->properties, "warm_black" ) && black_producer( unit ) != NULL )
+		{
+			mlt_consumer_connect( consumer, MLT_PRODUCER_SERVICE( black_producer( unit ) ) );
+			mlt_consumer_purge( consumer );
+			mlt_properties_set_int( unit->properties, "warm_black", 1 );
+		}
+		mlt_properties_set_int( unit->properties, "warm", 1 );
+	}
+	else
+	{
+		release_consumer( unit );
+	}
+	mlt_properties_set_int( unit->properties, "cued", 0 );
+	journal_position( unit, 1 );
 	melted_unit_status_communicate( unit );
 }
 
@@ -486,7 +3147,7 @@ void melted_unit_terminate( melted_unit unit )
 int melted_unit_has_terminated( melted_unit unit )
 {
 	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
-	return mlt_consumer_is_stopped( consumer );
+	return mlt_consumer_is_stopped( consumer ) || mlt_properties_get_int( unit->properties, "warm" );
 }
 
 /** Transfer the currently loaded clip to another unit
@@ -510,6 +3171,7 @@ int melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit )
 	}
 
 	clear_unit( src_unit );
+	unit_snapshot( src_unit );
 
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( dest_playlist ) );
 
@@ -523,6 +3185,7 @@ int melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit )
 
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( dest_playlist ) );
 
+	unit_snapshot( dest_unit );
 	update_generation( dest_unit );
 	melted_unit_status_communicate( dest_unit );
 
@@ -531,6 +3194,173 @@ int melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit )
 	return 0;
 }
 
+/** Take the consumer waiting in "switch_consumer" for the cut - must be
+    called with the unit mutex held.
+
+    "cutting" stays set until cut_output is done, so the thread changing the
+    output waits for a cut made by the consumer thread to end.
+
+    \return The consumer to cut to or NULL if there is none waiting.
+*/
+
+static mlt_consumer claim_output( melted_unit unit )
+{
+	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "switch_consumer", NULL );
+	if ( consumer != NULL )
+	{
+		mlt_properties_set_int( unit->properties, "cutting", 1 );
+		mlt_properties_set_data( unit->properties, "switch_consumer", NULL, 0, NULL, NULL );
+	}
+	return consumer;
+}
+
+/** Move the playlist from the unit's consumer to one taken with
+    claim_output - must be called without the unit mutex held.
+
+    Called right after the old consumer shows a frame. The playlist is put
+    back to the frame following the one shown, so the new consumer goes on
+    from there and the frames the old one had read ahead are played again
+    instead of being lost. The playlist is locked here and its get_frame
+    listeners take the unit mutex for the status, so the mutex must not be
+    held around the cut.
+*/
+
+static void cut_output( melted_unit unit, mlt_consumer consumer, mlt_position shown )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_consumer old = mlt_properties_get_data( properties, "consumer", NULL );
+	mlt_producer black = mlt_properties_get_data( properties, "black", NULL );
+	int warm_black = mlt_properties_get_int( properties, "warm_black" );
+
+	// The render lock keeps the old consumer from reading past the cut
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_consumer_connect( old, MLT_PRODUCER_SERVICE( black ) );
+	if ( !warm_black )
+		mlt_producer_seek( producer, shown + ( mlt_position )mlt_producer_get_speed( producer ) );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	mlt_consumer_connect( consumer, warm_black ? MLT_PRODUCER_SERVICE( black ) : MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_consumer_purge( consumer );
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "refresh", 1 );
+
+	pthread_mutex_lock( &unit->mutex );
+	mlt_properties_set_int( properties, "cutting", 0 );
+	pthread_cond_broadcast( &unit->cond );
+	pthread_mutex_unlock( &unit->mutex );
+}
+
+/** Replace the unit's consumer without interrupting playback.
+
+    The new consumer is constructed and started on black while the old one
+    keeps playing, and the frames following the one on screen are decoded
+    for it. The next time the old consumer shows a frame, cut_output hands
+    the playlist over from that frame on, and the old one is then stopped.
+    If the old consumer shows nothing for a second, the cut is made anyway.
+
+    \param unit A melted_unit handle.
+    \param constructor The consumer, as given to UADD.
+    \return 0 on success.
+*/
+
+int melted_unit_set_output( melted_unit unit, char *constructor )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties settings = mlt_properties_get_data( properties, "settings", NULL );
+	mlt_consumer old = mlt_properties_get_data( properties, "consumer", NULL );
+	mlt_producer black = black_producer( unit );
+	int running = !mlt_consumer_is_stopped( old );
+	int changed = 0;
+	int64_t start = time_now( );
+	mlt_consumer consumer;
+	char *id;
+	int i;
+
+	if ( black == NULL || ( consumer = melted_pool_take( constructor ) ) == NULL )
+		return -1;
+
+	// Carry the consumer settings made with USET over
+	for ( i = 0; i < mlt_properties_count( settings ); i ++ )
+	{
+		char *name = mlt_properties_get_name( settings, i );
+		if ( !strncmp( name, "consumer.", 9 ) )
+		{
+			mlt_properties_set( MLT_CONSUMER_PROPERTIES( consumer ), name + 9, mlt_properties_get_value( settings, i ) );
+			changed = 1;
+		}
+	}
+
+	if ( running )
+	{
+		mlt_properties old_properties = MLT_CONSUMER_PROPERTIES( old );
+		int buffer = mlt_properties_get( old_properties, "buffer" ) != NULL ? mlt_properties_get_int( old_properties, "buffer" ) : DEFAULT_BUFFER;
+		mlt_consumer claimed;
+		mlt_position shown;
+		struct timespec until;
+
+		// Open the new output off air and decode what it is going to show
+		mlt_consumer_connect( consumer, MLT_PRODUCER_SERVICE( black ) );
+		mlt_consumer_start( consumer );
+		pthread_mutex_lock( &unit->mutex );
+		shown = mlt_properties_get_position( properties, "shown_position" );
+		pthread_mutex_unlock( &unit->mutex );
+		if ( !mlt_properties_get_int( properties, "warm_black" ) )
+			prime_unit( unit, shown, 2 * buffer );
+
+		// Cut over when the old output next shows a frame
+		clock_gettime( CLOCK_REALTIME, &until );
+		until.tv_sec ++;
+		pthread_mutex_lock( &unit->mutex );
+		mlt_properties_set_data( properties, "switch_consumer", consumer, 0, NULL, NULL );
+		while ( ( mlt_properties_get_data( properties, "switch_consumer", NULL ) != NULL ||
+				  mlt_properties_get_int( properties, "cutting" ) ) &&
+				pthread_cond_timedwait( &unit->cond, &unit->mutex, &until ) == 0 )
+			;
+		claimed = claim_output( unit );
+		while ( claimed == NULL && mlt_properties_get_int( properties, "cutting" ) )
+			pthread_cond_wait( &unit->cond, &unit->mutex );
+		shown = mlt_properties_get_position( properties, "shown_position" );
+		pthread_mutex_unlock( &unit->mutex );
+		if ( claimed != NULL )
+			cut_output( unit, claimed, shown );
+	}
+	else
+	{
+		if ( mlt_properties_get_int( properties, "warm_black" ) )
+			mlt_consumer_connect( consumer, MLT_PRODUCER_SERVICE( black ) );
+		else
+			mlt_consumer_connect( consumer, MLT_PLAYLIST_SERVICE( playlist ) );
+		mlt_consumer_purge( consumer );
+		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "refresh", 1 );
+	}
+	mlt_events_listen( MLT_CONSUMER_PROPERTIES( consumer ), unit, "consumer-frame-show", ( mlt_listener )melted_unit_frame_shown );
+
+	// Commands may still hold the old consumer, so it is kept until the next change
+	mlt_events_disconnect( MLT_CONSUMER_PROPERTIES( old ), unit );
+	mlt_properties_inc_ref( MLT_CONSUMER_PROPERTIES( old ) );
+	mlt_properties_set_data( properties, "consumer", consumer, 0, ( mlt_destructor )mlt_consumer_close, NULL );
+	if ( running )
+		mlt_consumer_stop( old );
+	mlt_properties_set_data( properties, "retired_consumer", old, 0, ( mlt_destructor )mlt_consumer_close, NULL );
+
+	id = strdup( constructor );
+	if ( strchr( id, ':' ) != NULL )
+		*strchr( id, ':' ) = '\0';
+	mlt_properties_set( properties, "constructor", constructor );
+	mlt_properties_set( properties, "id", id );
+	mlt_properties_set( properties, "arg", strchr( constructor, ':' ) != NULL ? strchr( constructor, ':' ) + 1 : NULL );
+	mlt_properties_set_int( properties, "consumer_changed", changed );
+	free( id );
+
+	stats_record( unit, "output", ( double )( time_now( ) - start ) / 1000 );
+	melted_log( LOG_NOTICE, "U%d output changed to %s", mlt_properties_get_int( properties, "unit" ), constructor );
+	melted_unit_status_communicate( unit );
+
+	return 0;
+}
+
 /** Determine if unit is offline.
 */
 
@@ -540,6 +3370,13 @@ int melted_unit_is_offline( melted_unit unit )
 }
 
 /** Obtain the status for a given unit
+
+    The playhead is looked up in the latest published view. Right after an
+    edit, before the new view is published, it is mapped onto the rows of
+    the previous one, and the generation reported is the one of the view
+    used, so a client comparing generations sees the status against the
+    list it belongs to; the status sent once the view is published is
+    exact.
 */
 
 int melted_unit_get_status( melted_unit unit, mvcp_status status )
@@ -553,34 +3390,37 @@ int melted_unit_get_status( melted_unit unit, mvcp_status status )
 		mlt_properties properties = unit->properties;
 		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
 		mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
-		mlt_producer clip = mlt_playlist_current( playlist );
+		mlt_position position;
+		playlist_view view = acquire_view( unit, &position );
+		int clip_index;
+		view_row *row;
 
-		mlt_playlist_clip_info info;
-		int clip_index = mlt_playlist_current_clip( playlist );
-		mlt_playlist_get_clip_info( playlist, &info, clip_index );
+		if ( position < 0 )
+			position = mlt_producer_position( producer );
+		clip_index = view_clip( view, position );
+		row = clip_index < view->count ? &view->rows[ clip_index ] : NULL;
 
-		if ( info.resource != NULL && strcmp( info.resource, "" ) )
+		if ( row != NULL && row->title != NULL )
 		{
-			char *title = mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "title" );
-			if ( title == NULL )
-				title = strip_root( unit, info.resource );
-			strncpy( status->clip, title, sizeof( status->clip ) );
+			strncpy( status->clip, row->title, sizeof( status->clip ) );
 			status->speed = (int)( mlt_producer_get_speed( producer ) * 1000.0 );
-			status->fps = info.fps;
-			status->in = info.frame_in;
-			status->out = info.frame_out;
-			status->position = mlt_producer_frame( clip );
-			status->length = mlt_producer_get_length( clip );
-			strncpy( status->tail_clip, title, sizeof( status->tail_clip ) );
-			status->tail_in = info.frame_in;
-			status->tail_out = info.frame_out;
-			status->tail_position = mlt_producer_frame( clip );
-			status->tail_length = mlt_producer_get_length( clip );
-			status->clip_index = mlt_playlist_current_clip( playlist );
+			status->fps = row->fps;
+			status->in = row->frame_in;
+			status->out = row->frame_out;
+			status->position = position - row->start + row->frame_in;
+			status->length = row->length;
+			strncpy( status->tail_clip, row->title, sizeof( status->tail_clip ) );
+			status->tail_in = row->frame_in;
+			status->tail_out = row->frame_out;
+			status->tail_position = status->position;
+			status->tail_length = row->length;
+			status->clip_index = clip_index;
+			status->clip_id = row->id;
 			status->seek_flag = 1;
 		}
 
-		status->generation = mlt_properties_get_int( properties, "generation" );
+		status->generation = view->generation;
+		release_view( view );
 
 		if ( melted_unit_has_terminated( unit ) )
 			status->status = unit_stopped;
@@ -600,15 +3440,103 @@ int melted_unit_get_status( melted_unit unit, mvcp_status status )
 	return error;
 }
 
-/** Change position in the playlist.
+/** Move the playlist to the position of a seek request - must be called
+    with the unit mutex held.
+
+    With USET jog=1, a target which is the frame on screen keeps that frame
+    rather than having the consumer decode it again.
+
+    A coalesced request is applied here from the consumer's frame shown
+    event, on the consumer thread. mlt_producer_seek only stores the
+    position for the next read, as for a seek from a command thread, and
+    does not lock the playlist. The playlist's get_frame listeners take the
+    unit mutex for the status with the playlist locked, so the playlist
+    must never be locked with the unit mutex held. The new position is
+    journaled by the worker, off this thread.
 */
 
-void melted_unit_change_position( melted_unit unit, int clip, int32_t position )
+static void apply_seek( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	mlt_position position = mlt_properties_get_position( properties, "seek_target" );
+
+	// The display of the target ends the latency measurement of the requests
+	mlt_properties_set_int( properties, "seek_pending", 0 );
+	mlt_properties_set_position( properties, "display_target", position );
+	mlt_properties_set_int64( properties, "display_time", mlt_properties_get_int64( properties, "seek_time" ) );
+	mlt_properties_set_int( properties, "display_inputs", mlt_properties_get_int( properties, "seek_inputs" ) );
+	mlt_properties_set_int( properties, "seek_inputs", 0 );
+	mlt_properties_set_int( properties, "seek_journal", 1 );
+
+	if ( mlt_properties_get_int( MLT_PLAYLIST_PROPERTIES( playlist ), "jog" ) &&
+		 position == mlt_producer_frame( producer ) &&
+		 position == mlt_properties_get_position( properties, "shown_position" ) )
+		return;
+
+	mlt_producer_seek( producer, position );
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
+}
+
+/** Ask for the unit to seek.
+
+    Requests are applied at once unless coalesce is set, USET jog=1 is
+    given and the consumer is showing the playlist. Then only the most
+    recent target is applied, when the next frame is shown, so a burst of
+    STEP or GOTO commands from a jog wheel does not have the consumer
+    decode positions which are never seen.
+
+    \param relative Non zero if the position is an offset from the last
+    requested one.
+    \return Non zero if the request was applied at once.
+*/
+
+static int request_seek( melted_unit unit, mlt_position position, int relative, int coalesce )
 {
 	mlt_properties properties = unit->properties;
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
 	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
+	int applied = 0;
+
+	pthread_mutex_lock( &unit->mutex );
+	if ( relative )
+		position += mlt_properties_get_int( properties, "seek_pending" ) ?
+					mlt_properties_get_position( properties, "seek_target" ) : mlt_producer_frame( producer );
+	if ( mlt_properties_get_int( properties, "seek_inputs" ) == 0 )
+		mlt_properties_set_int64( properties, "seek_time", time_now( ) );
+	mlt_properties_set_int( properties, "seek_inputs", mlt_properties_get_int( properties, "seek_inputs" ) + 1 );
+	mlt_properties_set_position( properties, "seek_target", position );
+	if ( coalesce && mlt_properties_get_int( MLT_PLAYLIST_PROPERTIES( playlist ), "jog" ) && !melted_unit_has_terminated( unit ) )
+	{
+		mlt_properties_set_int( properties, "seek_pending", 1 );
+	}
+	else
+	{
+		apply_seek( unit );
+		mlt_properties_set_int( properties, "seek_journal", 0 );
+		applied = 1;
+	}
+	pthread_mutex_unlock( &unit->mutex );
+
+	return applied;
+}
+
+/** Seek to a frame of a clip.
+
+    A seek applied at once is journaled here. A coalesced one is journaled
+    by the worker once a frame shown has applied it, so a burst of jog
+    commands neither journals stale positions nor syncs the journal for
+    each command.
+*/
+
+static void seek_unit( melted_unit unit, int clip, int32_t position, int coalesce )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
 	mlt_playlist_clip_info info;
+	int applied = 1;
 
 	if ( clip < 0 )
 	{
@@ -625,7 +3553,6 @@ void melted_unit_change_position( melted_unit unit, int clip, int32_t position )
 	{
 		int32_t frame_start = info.start;
 		int32_t frame_offset = position;
-		mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
 
 		if ( frame_offset < 0 )
 			frame_offset = info.frame_out;
@@ -634,13 +3561,33 @@ void melted_unit_change_position( melted_unit unit, int clip, int32_t position )
 		if ( frame_offset >= info.frame_out )
 			frame_offset = info.frame_out;
 		
-		mlt_producer_seek( producer, frame_start + frame_offset - info.frame_in );
-		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
+		applied = request_seek( unit, frame_start + frame_offset - info.frame_in, 0, coalesce );
 	}
 
+	if ( applied )
+		journal_position( unit, 1 );
 	melted_unit_status_communicate( unit );
 }
 
+/** Change position in the playlist.
+*/
+
+void melted_unit_change_position( melted_unit unit, int clip, int32_t position )
+{
+	seek_unit( unit, clip, position, 0 );
+}
+
+/** Change position in the playlist on behalf of a control surface.
+
+    As melted_unit_change_position, but coalesced with other requests when
+    USET jog=1 is given.
+*/
+
+void melted_unit_jog_position( melted_unit unit, int clip, int32_t position )
+{
+	seek_unit( unit, clip, position, 1 );
+}
+
 /** Get the index of the current clip.
 */
 
@@ -665,9 +3612,12 @@ int melted_unit_set_clip_in( melted_unit unit, int index, int32_t position )
 	if ( error == 0 )
 	{
 		melted_unit_play( unit, 0 );
+		pthread_mutex_lock( &unit->journal_mutex );
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 		error = mlt_playlist_resize_clip( playlist, index, position, info.frame_out );
 		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		journal_record( unit, 1, "in %d %d", index, position );
+		pthread_mutex_unlock( &unit->journal_mutex );
 		update_generation( unit );
 		melted_unit_change_position( unit, index, 0 );
 	}
@@ -688,9 +3638,12 @@ int melted_unit_set_clip_out( melted_unit unit, int index, int32_t position )
 	if ( error == 0 )
 	{
 		melted_unit_play( unit, 0 );
+		pthread_mutex_lock( &unit->journal_mutex );
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 		error = mlt_playlist_resize_clip( playlist, index, info.frame_in, position );
 		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		journal_record( unit, 1, "out %d %d", index, position );
+		pthread_mutex_unlock( &unit->journal_mutex );
 		update_generation( unit );
 		melted_unit_status_communicate( unit );
 		melted_unit_change_position( unit, index, -1 );
@@ -704,13 +3657,7 @@ int melted_unit_set_clip_out( melted_unit unit, int index, int32_t position )
 
 void melted_unit_step( melted_unit unit, int32_t offset )
 {
-	mlt_properties properties = unit->properties;
-	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
-	mlt_producer producer = MLT_PLAYLIST_PRODUCER( playlist );
-	mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
-	mlt_position position = mlt_producer_frame( producer );
-	mlt_producer_seek( producer, position + offset );
-	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
+	request_seek( unit, offset, 1, 1 );
 }
 
 /** Set the unit's clip mode regarding in and out points.
@@ -755,6 +3702,9 @@ void melted_unit_step( melted_unit unit, int32_t offset )
 int melted_unit_set( melted_unit unit, char *name_value )
 {
 	mlt_properties properties = NULL;
+	char *setting = strdup( name_value );
+	int journal = !strncmp( name_value, "journal=", 8 );
+	int error;
 
 	if ( strncmp( name_value, "consumer.", 9 ) )
 	{
@@ -774,9 +3724,32 @@ int melted_unit_set( melted_unit unit, char *name_value )
 		mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
 		properties = MLT_CONSUMER_PROPERTIES( consumer );
 		name_value += 9;
+
+		// A reconfigured consumer is not handed back to the pool
+		mlt_properties_set_int( unit->properties, "consumer_changed", 1 );
+	}
+
+	// Changing the journal saves the state to the old one and restores from the new one
+	if ( journal )
+		melted_unit_suspend( unit );
+
+	error = mlt_properties_parse( properties, name_value );
+
+	if ( journal )
+	{
+		melted_unit_restore( unit );
+	}
+	else if ( error == 0 && setting != NULL && strchr( setting, '=' ) != NULL )
+	{
+		mlt_properties settings = mlt_properties_get_data( unit->properties, "settings", NULL );
+		char *value = strchr( setting, '=' );
+		*value ++ = '\0';
+		mlt_properties_set( settings, setting, value );
+		journal_record( unit, 1, "set %s=%s", setting, value );
 	}
+	free( setting );
 
-	return mlt_properties_parse( properties, name_value );
+	return error;
 }
 
 char *melted_unit_get( melted_unit unit, char *name )
@@ -786,6 +3759,30 @@ char *melted_unit_get( melted_unit unit, char *name )
 	return mlt_properties_get( properties, name );
 }
 
+/** Hand the consumer of a closing unit back to the pool if it has room.
+
+    The consumer must be stopped. It is detached from the unit and from the
+    playlist, and kept alive by a reference released by the pool.
+*/
+
+static void recycle_consumer( melted_unit unit )
+{
+	mlt_properties properties = unit->properties;
+	mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+	char *constructor = mlt_properties_get( properties, "constructor" );
+
+	if ( consumer != NULL && constructor != NULL && !mlt_properties_get_int( properties, "consumer_changed" ) &&
+		 mlt_consumer_is_stopped( consumer ) && melted_pool_wants( constructor ) )
+	{
+		mlt_events_disconnect( MLT_CONSUMER_PROPERTIES( consumer ), unit );
+		mlt_consumer_connect( consumer, NULL );
+		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "refresh", 0 );
+		mlt_properties_inc_ref( MLT_CONSUMER_PROPERTIES( consumer ) );
+		melted_pool_give( constructor, consumer );
+		melted_log( LOG_DEBUG, "returned consumer %s to the pool", constructor );
+	}
+}
+
 /** Release the unit
 
     \todo error handling
@@ -797,8 +3794,24 @@ void melted_unit_close( melted_unit unit )
 	if ( unit != NULL )
 	{
 		melted_log( LOG_DEBUG, "closing unit..." );
+		pthread_mutex_lock( &unit->mutex );
+		unit->running = 0;
+		pthread_cond_broadcast( &unit->cond );
+		pthread_mutex_unlock( &unit->mutex );
+		pthread_join( unit->thread, NULL );
+		melted_unit_suspend( unit );
 		melted_unit_terminate( unit );
+		mlt_properties_set_data( unit->properties, "render_jobs", NULL, 0, NULL, NULL );
+		release_consumer( unit );
+		recycle_consumer( unit );
+		release_view( mlt_properties_get_data( unit->properties, "view", NULL ) );
+		mlt_properties_set_data( unit->properties, "ring_decoder", NULL, 0, NULL, NULL );
+		melted_frames_set_ring( mlt_properties_get_int( unit->properties, "unit" ), 0 );
+		melted_frames_unprime( mlt_properties_get_int( unit->properties, "unit" ) );
 		mlt_properties_close( unit->properties );
+		pthread_mutex_destroy( &unit->mutex );
+		pthread_cond_destroy( &unit->cond );
+		pthread_mutex_destroy( &unit->journal_mutex );
 		free( unit );
 		melted_log( LOG_DEBUG, "... unit closed." );
 	}
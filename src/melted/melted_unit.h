@@ -34,11 +34,16 @@ extern "C"
 typedef struct
 {
 	mlt_properties properties;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+	pthread_mutex_t journal_mutex;
 } 
 melted_unit_t, *melted_unit;
 
 extern melted_unit         melted_unit_init( int index, char *arg );
-extern void 				melted_unit_report_list( melted_unit unit, mvcp_response response );
+extern void 				melted_unit_report_list( melted_unit unit, mvcp_response response, int ids );
 extern void                 melted_unit_allow_stdin( melted_unit unit, int flag );
 extern mvcp_error_code   melted_unit_load( melted_unit unit, char *clip, int32_t in, int32_t out, int flush );
 extern mvcp_error_code 	melted_unit_insert( melted_unit unit, char *clip, int index, int32_t in, int32_t out );
@@ -49,8 +54,12 @@ extern mvcp_error_code 	melted_unit_clean( melted_unit unit );
 extern mvcp_error_code 	melted_unit_wipe( melted_unit unit );
 extern mvcp_error_code 	melted_unit_clear( melted_unit unit );
 extern mvcp_error_code 	melted_unit_move( melted_unit unit, int src, int dest );
+extern mvcp_error_code 	melted_unit_sync( melted_unit unit, mlt_properties items );
 extern int                  melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit );
+extern int                  melted_unit_set_output( melted_unit, char * );
 extern void                 melted_unit_play( melted_unit_t *unit, int speed );
+extern void                 melted_unit_cue( melted_unit unit, int clip, int32_t position );
+extern void                 melted_unit_report_stats( melted_unit unit, mvcp_response response );
 extern void                 melted_unit_terminate( melted_unit );
 extern int                  melted_unit_has_terminated( melted_unit );
 extern int                  melted_unit_get_nodeid( melted_unit unit );
@@ -59,6 +68,7 @@ extern int                  melted_unit_is_offline( melted_unit unit );
 extern void                 melted_unit_set_notifier( melted_unit, mvcp_notifier, char * );
 extern int                  melted_unit_get_status( melted_unit, mvcp_status );
 extern void                 melted_unit_change_position( melted_unit, int, int32_t position );
+extern void                 melted_unit_jog_position( melted_unit, int, int32_t position );
 extern void                 melted_unit_change_speed( melted_unit unit, int speed );
 extern int                  melted_unit_set_clip_in( melted_unit unit, int index, int32_t position );
 extern int                  melted_unit_set_clip_out( melted_unit unit, int index, int32_t position );
@@ -69,6 +79,8 @@ extern void                 melted_unit_restore( melted_unit );
 extern int					melted_unit_set( melted_unit, char *name_value );
 extern char *				melted_unit_get( melted_unit, char *name );
 extern int					melted_unit_get_current_clip( melted_unit );
+extern int					melted_unit_find_clip( melted_unit, int id );
+extern mlt_properties		melted_unit_upcoming( melted_unit, int count );
 
 
 #ifdef __cplusplus
@@ -25,11 +25,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <mvcp/mvcp_util.h>
+
 #include "melted_unit.h"
 #include "melted_commands.h"
 #include "melted_log.h"
@@ -95,13 +98,27 @@ int melted_list( command_argument cmd_arg )
 
 	if ( unit != NULL )
 	{
-		melted_unit_report_list( unit, cmd_arg->response );
+		// The clip ids are only added for clients which ask for them with LIST {unit} ID
+		int ids = mvcp_tokeniser_count( cmd_arg->tokeniser ) > 2 &&
+				  !strcasecmp( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 2 ), "ID" );
+		melted_unit_report_list( unit, cmd_arg->response, ids );
 		return RESPONSE_SUCCESS;
 	}
 
 	return RESPONSE_INVALID_UNIT;
 }
 
+/** Value of parse_clip for a clip id which is not in the playlist.
+*/
+
+#define CLIP_UNKNOWN INT_MIN
+
+/** Get the clip index addressed by an argument.
+
+    The argument is an index, an offset from the playing clip with + or -,
+    or a clip id as shown by LIST with #.
+*/
+
 static int parse_clip( command_argument cmd_arg, int arg )
 {
 	melted_unit unit = melted_get_unit(cmd_arg->unit);
@@ -110,7 +127,13 @@ static int parse_clip( command_argument cmd_arg, int arg )
 	if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) > arg )
 	{
 		char *token = mvcp_tokeniser_get_string( cmd_arg->tokeniser, arg );
-		if ( token[ 0 ] == '+' )
+		if ( token[ 0 ] == '#' )
+		{
+			clip = melted_unit_find_clip( unit, atoi( token + 1 ) );
+			if ( clip < 0 )
+				clip = CLIP_UNKNOWN;
+		}
+		else if ( token[ 0 ] == '+' )
 			clip += atoi( token + 1 );
 		else if ( token[ 0 ] == '-' )
 			clip -= atoi( token + 1 );
@@ -136,6 +159,8 @@ int melted_insert( command_argument cmd_arg )
 		long in = -1, out = -1;
 		int index = parse_clip( cmd_arg, 3 );
 		
+		if ( index == CLIP_UNKNOWN )
+			return RESPONSE_OUT_OF_RANGE;
 		if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) == 6 )
 		{
 			in = atoi( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 4 ) );
@@ -163,6 +188,8 @@ int melted_remove( command_argument cmd_arg )
 	{
 		int index = parse_clip( cmd_arg, 2 );
 			
+		if ( index == CLIP_UNKNOWN )
+			return RESPONSE_OUT_OF_RANGE;
 		if ( melted_unit_remove( unit, index ) != mvcp_ok )
 			return RESPONSE_BAD_FILE;
 	}
@@ -222,6 +249,8 @@ int melted_move( command_argument cmd_arg )
 			int src = parse_clip( cmd_arg, 2 );
 			int dest = parse_clip( cmd_arg, 3 );
 			
+			if ( src == CLIP_UNKNOWN || dest == CLIP_UNKNOWN )
+				return RESPONSE_OUT_OF_RANGE;
 			if ( melted_unit_move( unit, src, dest ) != mvcp_ok )
 				return RESPONSE_BAD_FILE;
 		}
@@ -267,17 +296,130 @@ int melted_append( command_argument cmd_arg )
 	return RESPONSE_SUCCESS;
 }
 
+/** Add an item to a SYNC list.
+*/
+
+static mlt_properties add_sync_item( mlt_properties items, const char *resource, int in, int out )
+{
+	mlt_properties item = mlt_properties_new( );
+	char key[ 32 ];
+
+	snprintf( key, sizeof( key ), "%d", mlt_properties_count( items ) );
+	mlt_properties_set( item, "resource", resource );
+	mlt_properties_set_int( item, "in", in );
+	mlt_properties_set_int( item, "out", out );
+	mlt_properties_set_data( items, key, item, 0, ( mlt_destructor )mlt_properties_close, NULL );
+
+	return item;
+}
+
+/** Synchronise the unit with the clips of a pushed playlist.
+*/
+
+static int push_sync( melted_unit unit, mlt_service service )
+{
+	mlt_properties items = mlt_properties_new( );
+	int error;
+
+	if ( mlt_service_identify( service ) == playlist_type )
+	{
+		mlt_playlist playlist = ( mlt_playlist )service;
+		int i;
+
+		for ( i = 0; i < mlt_playlist_count( playlist ); i ++ )
+		{
+			mlt_playlist_clip_info info;
+			if ( mlt_playlist_get_clip_info( playlist, &info, i ) == 0 && !mlt_playlist_is_blank( playlist, i ) )
+			{
+				mlt_properties properties = MLT_PRODUCER_PROPERTIES( info.producer );
+				char *resource = mlt_properties_get( properties, "melted.resource" );
+				mlt_properties item;
+				if ( resource == NULL )
+					resource = info.resource;
+				item = add_sync_item( items, resource != NULL ? resource : "", info.frame_in, info.frame_out );
+				mlt_properties_set_data( item, "producer", info.producer, 0, NULL, NULL );
+			}
+		}
+	}
+	else
+	{
+		mlt_properties properties = MLT_SERVICE_PROPERTIES( service );
+		char *resource = mlt_properties_get( properties, "resource" );
+		mlt_properties item = add_sync_item( items, resource != NULL ? resource : "", -1, -1 );
+		mlt_properties_set_data( item, "producer", service, 0, NULL, NULL );
+	}
+
+	error = melted_unit_sync( unit, items ) == mvcp_ok ? RESPONSE_SUCCESS : RESPONSE_BAD_FILE;
+	mlt_properties_close( items );
+
+	return error;
+}
+
 int melted_push( command_argument cmd_arg, mlt_service service )
 {
 	melted_unit unit = melted_get_unit(cmd_arg->unit);
 	if ( !unit )
 		return RESPONSE_INVALID_UNIT;
+	if ( service != NULL && mvcp_tokeniser_count( cmd_arg->tokeniser ) > 2 &&
+		 !strcasecmp( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 2 ), "SYNC" ) )
+		return push_sync( unit, service );
 	if ( service != NULL )
 		if ( melted_unit_append_service( unit, service ) == mvcp_ok )
 			return RESPONSE_SUCCESS;
 	return RESPONSE_BAD_FILE;
 }
 
+/** Synchronise the unit with a list of clips in a file on the server.
+
+    Each line of the file gives a clip as for APND, optionally followed by
+    its in and out points. Empty lines and lines starting with # are
+    ignored.
+*/
+
+int melted_sync( command_argument cmd_arg )
+{
+	melted_unit unit = melted_get_unit( cmd_arg->unit );
+	char *filename = (char*) cmd_arg->argument;
+	char fullname[ 1024 ];
+	char line[ 2048 ];
+	mvcp_tokeniser tokeniser;
+	mlt_properties items;
+	FILE *file;
+	int error;
+
+	if ( unit == NULL )
+		return RESPONSE_INVALID_UNIT;
+
+	get_fullname( cmd_arg, fullname, sizeof( fullname ), filename );
+	file = fopen( fullname, "r" );
+	if ( file == NULL )
+		return RESPONSE_BAD_FILE;
+
+	items = mlt_properties_new( );
+	tokeniser = mvcp_tokeniser_init( );
+	while ( fgets( line, sizeof( line ), file ) != NULL )
+	{
+		mvcp_util_trim( mvcp_util_chomp( line ) );
+		if ( line[ 0 ] != '\0' && line[ 0 ] != '#' && mvcp_tokeniser_parse_new( tokeniser, line, " " ) > 0 )
+		{
+			char clip[ 1024 ];
+			int count = mvcp_tokeniser_count( tokeniser );
+			char *name = mvcp_util_strip( mvcp_tokeniser_get_string( tokeniser, 0 ), '\"' );
+			get_fullname( cmd_arg, clip, sizeof( clip ), name );
+			add_sync_item( items, clip,
+				count > 2 ? atoi( mvcp_tokeniser_get_string( tokeniser, 1 ) ) : -1,
+				count > 2 ? atoi( mvcp_tokeniser_get_string( tokeniser, 2 ) ) : -1 );
+		}
+	}
+	mvcp_tokeniser_close( tokeniser );
+	fclose( file );
+
+	error = melted_unit_sync( unit, items ) == mvcp_ok ? RESPONSE_SUCCESS : RESPONSE_BAD_FILE;
+	mlt_properties_close( items );
+
+	return error;
+}
+
 int melted_receive( command_argument cmd_arg, char *doc )
 {
 	melted_unit unit = melted_get_unit(cmd_arg->unit);
@@ -321,6 +463,27 @@ int melted_play( command_argument cmd_arg )
 	return RESPONSE_SUCCESS;
 }
 
+int melted_cue( command_argument cmd_arg )
+{
+	melted_unit unit = melted_get_unit(cmd_arg->unit);
+
+	if ( unit == NULL || melted_unit_is_offline( unit ) )
+		return RESPONSE_INVALID_UNIT;
+	else if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) > 2 )
+	{
+		int32_t position = atol( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 2 ) );
+		int clip = parse_clip( cmd_arg, 3 );
+		if ( clip == CLIP_UNKNOWN )
+			return RESPONSE_OUT_OF_RANGE;
+		melted_unit_cue( unit, clip, position );
+	}
+	else
+	{
+		melted_unit_cue( unit, -1, 0 );
+	}
+	return RESPONSE_SUCCESS;
+}
+
 int melted_stop( command_argument cmd_arg )
 {
 	melted_unit unit = melted_get_unit(cmd_arg->unit);
@@ -376,7 +539,9 @@ int melted_goto( command_argument cmd_arg )
 	else
 	{
 		int clip = parse_clip( cmd_arg, 3 );
-		melted_unit_change_position( unit, clip, *(int*) cmd_arg->argument );
+		if ( clip == CLIP_UNKNOWN )
+			return RESPONSE_OUT_OF_RANGE;
+		melted_unit_jog_position( unit, clip, *(int*) cmd_arg->argument );
 	}
 	return RESPONSE_SUCCESS;
 }
@@ -400,6 +565,8 @@ int melted_set_in_point( command_argument cmd_arg )
 
 	if ( unit == NULL )
 		return RESPONSE_INVALID_UNIT;
+	else if ( clip == CLIP_UNKNOWN )
+		return RESPONSE_OUT_OF_RANGE;
 	else
 	{
 		int position = *(int *) cmd_arg->argument;
@@ -422,6 +589,8 @@ int melted_set_out_point( command_argument cmd_arg )
 	
 	if ( unit == NULL )
 		return RESPONSE_INVALID_UNIT;
+	else if ( clip == CLIP_UNKNOWN )
+		return RESPONSE_OUT_OF_RANGE;
 	else
 	{
 		int position = *(int *) cmd_arg->argument;
@@ -448,12 +617,27 @@ int melted_get_unit_status( command_argument cmd_arg )
 	else
 	{
 		char text[ 10240 ];
-		mvcp_response_printf( cmd_arg->response, sizeof( text ), mvcp_status_serialise( &status, text, sizeof( text ) ) );
+		// The clip id is only added for clients which ask for it with USTA {unit} ID
+		if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) > 2 &&
+			 !strcasecmp( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 2 ), "ID" ) )
+			mvcp_status_serialise_id( &status, text, sizeof( text ) );
+		else
+			mvcp_status_serialise( &status, text, sizeof( text ) );
+		mvcp_response_printf( cmd_arg->response, sizeof( text ), text );
 		return RESPONSE_SUCCESS_1;
 	}
 	return 0;
 }
 
+int melted_get_unit_stats( command_argument cmd_arg )
+{
+	melted_unit unit = melted_get_unit(cmd_arg->unit);
+
+	if ( unit == NULL )
+		return RESPONSE_INVALID_UNIT;
+	melted_unit_report_stats( unit, cmd_arg->response );
+	return RESPONSE_SUCCESS_N;
+}
 
 int melted_set_unit_property( command_argument cmd_arg )
 {
@@ -484,6 +668,17 @@ int melted_get_unit_property( command_argument cmd_arg )
 }
 
 
+int melted_set_output( command_argument cmd_arg )
+{
+	melted_unit unit = melted_get_unit(cmd_arg->unit);
+	char *constructor = (char*) cmd_arg->argument;
+	if ( unit == NULL )
+		return RESPONSE_INVALID_UNIT;
+	else if ( constructor == NULL || melted_unit_set_output( unit, constructor ) != 0 )
+		return RESPONSE_ERROR;
+	return RESPONSE_SUCCESS;
+}
+
 int melted_transfer( command_argument cmd_arg )
 {
 	melted_unit src_unit = melted_get_unit(cmd_arg->unit);
@@ -38,7 +38,9 @@ extern response_codes melted_wipe( command_argument );
 extern response_codes melted_clear( command_argument );
 extern response_codes melted_move( command_argument );
 extern response_codes melted_append( command_argument );
+extern response_codes melted_sync( command_argument );
 extern response_codes melted_play( command_argument );
+extern response_codes melted_cue( command_argument );
 extern response_codes melted_stop( command_argument );
 extern response_codes melted_pause( command_argument );
 extern response_codes melted_rewind( command_argument );
@@ -48,9 +50,11 @@ extern response_codes melted_ff( command_argument );
 extern response_codes melted_set_in_point( command_argument );
 extern response_codes melted_set_out_point( command_argument );
 extern response_codes melted_get_unit_status( command_argument );
+extern response_codes melted_get_unit_stats( command_argument );
 extern response_codes melted_set_unit_property( command_argument );
 extern response_codes melted_get_unit_property( command_argument );
 extern response_codes melted_transfer( command_argument );
+extern response_codes melted_set_output( command_argument );
 extern response_codes melted_push( command_argument, mlt_service );
 extern response_codes melted_receive( command_argument, char * );
 
@@ -160,7 +160,12 @@ void client_show_status( client demo, mvcp_status status )
 
 void client_queue_action( client demo, mvcp_status status )
 {
-	client_queue queue = &demo->queues[ status->unit ];
+	client_queue queue = NULL;
+
+	/* The client only queues for the first MAX_UNITS units */
+	if ( status->unit < 0 || status->unit >= MAX_UNITS )
+		return;
+	queue = &demo->queues[ status->unit ];
 
 	/* SPECIAL CASE STATUS NOTIFICATIONS TO IGNORE */
 
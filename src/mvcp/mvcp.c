@@ -258,6 +258,14 @@ mvcp_error_code mvcp_unit_add( mvcp this, char *guid, int *unit )
 	return error;
 }
 
+/** Remove a unit from the server.
+*/
+
+mvcp_error_code mvcp_unit_delete( mvcp this, int unit )
+{
+	return mvcp_execute( this, 1024, "UDEL U%d", unit );
+}
+
 /** Load a file on the specified unit.
 */
 
@@ -314,6 +322,14 @@ mvcp_error_code mvcp_unit_append( mvcp this, int unit, char *file, int32_t in, i
 	return mvcp_execute( this, 10240, "APND U%d \"%s\" %d %d", unit, file, in, out );
 }
 
+/** Synchronise the clips after the playing one with a list file on the server.
+*/
+
+mvcp_error_code mvcp_unit_sync( mvcp this, int unit, char *file )
+{
+	return mvcp_execute( this, 10240, "SYNC U%d \"%s\"", unit, file );
+}
+
 /** Push a service on to a unit.
 */
 
@@ -410,6 +426,16 @@ mvcp_error_code mvcp_unit_play_at_speed( mvcp this, int unit, int speed )
 	return mvcp_execute( this, 10240, "PLAY U%d %d", unit, speed );
 }
 
+/** Cue the unit at the specified frame in the clip ready for playback.
+*/
+
+mvcp_error_code mvcp_unit_cue( mvcp this, int unit, mvcp_clip_offset offset, int clip, int32_t position )
+{
+	char temp[ 100 ];
+	mvcp_interpret_clip_offset( temp, offset, clip );
+	return mvcp_execute( this, 1024, "CUE U%d %d %s", unit, position, temp );
+}
+
 /** Stop playback on the specified unit.
 */
 
@@ -553,12 +579,13 @@ mvcp_error_code mvcp_unit_get( mvcp this, int unit, char *name, char *value, int
 	return error;
 }
 
-/** Get a units status.
+/** Get a units status with USTA, adding the clip id with USTA {unit} ID if
+    ids is non zero. Servers without clip ids refuse the ID form.
 */
 
-mvcp_error_code mvcp_unit_status( mvcp this, int unit, mvcp_status status )
+static mvcp_error_code get_unit_status( mvcp this, int unit, mvcp_status status, int ids )
 {
-	mvcp_error_code error = mvcp_execute( this, 1024, "USTA U%d", unit );
+	mvcp_error_code error = mvcp_execute( this, 1024, ids ? "USTA U%d ID" : "USTA U%d", unit );
 	int error_code = mvcp_response_get_error_code( this->last_response );
 
 	memset( status, 0, sizeof( mvcp_status_t ) );
@@ -571,6 +598,22 @@ mvcp_error_code mvcp_unit_status( mvcp this, int unit, mvcp_status status )
 	return error;
 }
 
+/** Get a units status.
+*/
+
+mvcp_error_code mvcp_unit_status( mvcp this, int unit, mvcp_status status )
+{
+	return get_unit_status( this, unit, status, 0 );
+}
+
+/** Get a units status with the id of its current clip.
+*/
+
+mvcp_error_code mvcp_unit_status_id( mvcp this, int unit, mvcp_status status )
+{
+	return get_unit_status( this, unit, status, 1 );
+}
+
 /** Transfer the current settings of unit src to unit dest.
 */
 
@@ -579,6 +622,14 @@ mvcp_error_code mvcp_unit_transfer( mvcp this, int src, int dest )
 	return mvcp_execute( this, 1024, "XFER U%d U%d", src, dest );
 }
 
+/** Switch a unit to another output without stopping playback.
+*/
+
+mvcp_error_code mvcp_unit_output( mvcp this, int unit, const char *constructor )
+{
+	return mvcp_execute( this, 1024, "UOUT U%d %s", unit, constructor );
+}
+
 /** Obtain the parsers notifier.
 */
 
@@ -605,6 +656,22 @@ mvcp_dir mvcp_dir_init( mvcp this, const char *directory )
 	return dir;
 }
 
+/** List the contents of the specified directory with the length and frame
+	rate of each file, as far as the server knows them.
+*/
+
+mvcp_dir mvcp_dir_init_media( mvcp this, const char *directory )
+{
+	mvcp_dir dir = malloc( sizeof( mvcp_dir_t ) );
+	if ( dir != NULL )
+	{
+		memset( dir, 0, sizeof( mvcp_dir_t ) );
+		dir->directory = strdup( directory );
+		dir->response = mvcp_parser_executef( this->parser, "MLS \"%s\"", directory );
+	}
+	return dir;
+}
+
 /** Return the error code associated to the dir.
 */
 
@@ -646,6 +713,11 @@ mvcp_error_code mvcp_dir_get( mvcp_dir dir, int index, mvcp_dir_entry entry )
 				case 2:
 					entry->size = strtoull( mvcp_tokeniser_get_string( tokeniser, 1 ), NULL, 10 );
 					break;
+				case 4:
+					entry->size = strtoull( mvcp_tokeniser_get_string( tokeniser, 1 ), NULL, 10 );
+					entry->length = atoi( mvcp_tokeniser_get_string( tokeniser, 2 ) );
+					entry->fps = atof( mvcp_tokeniser_get_string( tokeniser, 3 ) );
+					break;
 				default:
 					error = mvcp_invalid_file;
 					break;
@@ -680,21 +752,38 @@ void mvcp_dir_close( mvcp_dir dir )
 	}
 }
 
-/** List the playlist of the specified unit.
+/** List the playlist of the specified unit, with the clip ids if ids is
+    non zero.
 */
 
-mvcp_list mvcp_list_init( mvcp this, int unit )
+static mvcp_list list_init( mvcp this, int unit, int ids )
 {
 	mvcp_list list = calloc( 1, sizeof( mvcp_list_t ) );
 	if ( list != NULL )
 	{
-		list->response = mvcp_parser_executef( this->parser, "LIST U%d", unit );
+		list->response = mvcp_parser_executef( this->parser, ids ? "LIST U%d ID" : "LIST U%d", unit );
 		if ( mvcp_response_count( list->response ) >= 2 )
 			list->generation = atoi( mvcp_response_get_line( list->response, 1 ) );
 	}
 	return list;
 }
 
+/** List the playlist of the specified unit.
+*/
+
+mvcp_list mvcp_list_init( mvcp this, int unit )
+{
+	return list_init( this, unit, 0 );
+}
+
+/** List the playlist of the specified unit with the id of each clip.
+*/
+
+mvcp_list mvcp_list_init_id( mvcp this, int unit )
+{
+	return list_init( this, unit, 1 );
+}
+
 /** Return the error code associated to the list.
 */
 
@@ -729,6 +818,8 @@ mvcp_error_code mvcp_list_get( mvcp_list list, int index, mvcp_list_entry entry
 			entry->max = atol( mvcp_tokeniser_get_string( tokeniser, 4 ) );
 			entry->size = atol( mvcp_tokeniser_get_string( tokeniser, 5 ) );
 			entry->fps = atof( mvcp_tokeniser_get_string( tokeniser, 6 ) );
+			if ( mvcp_tokeniser_count( tokeniser ) > 7 )
+				entry->id = atoi( mvcp_tokeniser_get_string( tokeniser, 7 ) );
 		}
 		else
 		{
@@ -96,11 +96,13 @@ extern mvcp_error_code mvcp_run( mvcp, char * );
 
 /* Unit functions */
 extern mvcp_error_code mvcp_unit_add( mvcp, char *, int * );
+extern mvcp_error_code mvcp_unit_delete( mvcp, int );
 extern mvcp_error_code mvcp_unit_load( mvcp, int, char * );
 extern mvcp_error_code mvcp_unit_load_clipped( mvcp, int, char *, int32_t, int32_t );
 extern mvcp_error_code mvcp_unit_load_back( mvcp, int, char * );
 extern mvcp_error_code mvcp_unit_load_back_clipped( mvcp, int, char *, int32_t, int32_t );
 extern mvcp_error_code mvcp_unit_append( mvcp, int, char *, int32_t, int32_t );
+extern mvcp_error_code mvcp_unit_sync( mvcp, int, char * );
 extern mvcp_error_code mvcp_unit_receive( mvcp, int, char *, char * );
 extern mvcp_error_code mvcp_unit_push( mvcp, int, char *, mlt_service );
 extern mvcp_error_code mvcp_unit_clean( mvcp, int );
@@ -112,6 +114,7 @@ extern mvcp_error_code mvcp_unit_remove_current_clip( mvcp, int );
 extern mvcp_error_code mvcp_unit_clip_insert( mvcp, int, mvcp_clip_offset, int, char *, int32_t, int32_t );
 extern mvcp_error_code mvcp_unit_play( mvcp, int );
 extern mvcp_error_code mvcp_unit_play_at_speed( mvcp, int, int );
+extern mvcp_error_code mvcp_unit_cue( mvcp, int, mvcp_clip_offset, int, int32_t );
 extern mvcp_error_code mvcp_unit_stop( mvcp, int );
 extern mvcp_error_code mvcp_unit_pause( mvcp, int );
 extern mvcp_error_code mvcp_unit_rewind( mvcp, int );
@@ -129,7 +132,9 @@ extern mvcp_error_code mvcp_unit_clear_in_out( mvcp, int );
 extern mvcp_error_code mvcp_unit_set( mvcp, int, const char *, const char * );
 extern mvcp_error_code mvcp_unit_get( mvcp, int, char *, char *, int );
 extern mvcp_error_code mvcp_unit_status( mvcp, int, mvcp_status );
+extern mvcp_error_code mvcp_unit_status_id( mvcp, int, mvcp_status );
 extern mvcp_error_code mvcp_unit_transfer( mvcp, int, int );
+extern mvcp_error_code mvcp_unit_output( mvcp, int, const char * );
 
 /* Notifier functionality. */
 extern mvcp_notifier mvcp_get_notifier( mvcp );
@@ -153,11 +158,14 @@ typedef struct
 	char name[ NAME_MAX ];
 	char full[ PATH_MAX + NAME_MAX ];
 	unsigned long long size;
+	int length;
+	double fps;
 }
 *mvcp_dir_entry, mvcp_dir_entry_t;
 
 /* Directory reading. */
 extern mvcp_dir mvcp_dir_init( mvcp, const char * );
+extern mvcp_dir mvcp_dir_init_media( mvcp, const char * );
 extern mvcp_error_code mvcp_dir_get_error_code( mvcp_dir );
 extern mvcp_error_code mvcp_dir_get( mvcp_dir, int, mvcp_dir_entry );
 extern int mvcp_dir_count( mvcp_dir );
@@ -185,11 +193,13 @@ typedef struct
 	int32_t max;
 	int32_t size;
 	float fps;
+	int id;
 }
 *mvcp_list_entry, mvcp_list_entry_t;
 
 /* List reading. */
 extern mvcp_list mvcp_list_init( mvcp, int );
+extern mvcp_list mvcp_list_init_id( mvcp, int );
 extern mvcp_error_code mvcp_list_get_error_code( mvcp_list );
 extern mvcp_error_code mvcp_list_get( mvcp_list, int, mvcp_list_entry );
 extern int mvcp_list_count( mvcp_list );
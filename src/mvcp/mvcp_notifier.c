@@ -32,6 +32,25 @@
 /* Application header files */
 #include "mvcp_notifier.h"
 
+/** Status notifier.
+
+    The store grows to hold the highest unit number seen. The units with a
+    stored status are also kept in a dense list so they can be visited
+    without scanning the store.
+*/
+
+struct mvcp_notifier_s
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	mvcp_status_t last;
+	mvcp_status store;
+	int *position;
+	int size;
+	int *units;
+	int count;
+};
+
 /** Notifier initialisation.
 */
 
@@ -40,22 +59,57 @@ mvcp_notifier mvcp_notifier_init( )
 	mvcp_notifier this = calloc( 1, sizeof( mvcp_notifier_t ) );
 	if ( this != NULL )
 	{
-		int index = 0;
 		pthread_mutex_init( &this->mutex, NULL );
 		pthread_cond_init( &this->cond, NULL );
-		for ( index = 0; index < MAX_UNITS; index ++ )
-			this->store[ index ].unit = index;
 	}
 	return this;
 }
 
+/** Grow the store to hold the specified unit - must be called with the mutex held.
+*/
+
+static int mvcp_notifier_grow( mvcp_notifier this, int unit )
+{
+	if ( unit >= this->size )
+	{
+		int size = this->size == 0 ? 16 : this->size;
+		mvcp_status store;
+		int *position;
+		int *units;
+
+		while ( size <= unit )
+			size *= 2;
+
+		store = realloc( this->store, size * sizeof( mvcp_status_t ) );
+		if ( store == NULL )
+			return -1;
+		this->store = store;
+		position = realloc( this->position, size * sizeof( int ) );
+		if ( position == NULL )
+			return -1;
+		this->position = position;
+		units = realloc( this->units, size * sizeof( int ) );
+		if ( units == NULL )
+			return -1;
+		this->units = units;
+
+		memset( this->store + this->size, 0, ( size - this->size ) * sizeof( mvcp_status_t ) );
+		for ( ; this->size < size; this->size ++ )
+		{
+			this->store[ this->size ].unit = this->size;
+			this->position[ this->size ] = -1;
+		}
+	}
+	return 0;
+}
+
 /** Get a stored status for the specified unit.
 */
 
 void mvcp_notifier_get( mvcp_notifier this, mvcp_status status, int unit )
 {
 	pthread_mutex_lock( &this->mutex );
-	if ( unit >= 0 && unit < MAX_UNITS )
+	if ( unit >= 0 && unit < this->size )
 		mvcp_status_copy( status, &this->store[ unit ] );
 	else
 		memset( status, 0, sizeof( mvcp_status_t ) );
@@ -92,24 +146,81 @@ int mvcp_notifier_wait( mvcp_notifier this, mvcp_status status )
 void mvcp_notifier_put( mvcp_notifier this, mvcp_status status )
 {
 	pthread_mutex_lock( &this->mutex );
-	mvcp_status_copy( &this->store[ status->unit ], status );
+	if ( status->unit >= 0 && mvcp_notifier_grow( this, status->unit ) == 0 )
+	{
+		mvcp_status_copy( &this->store[ status->unit ], status );
+		if ( this->position[ status->unit ] == -1 )
+		{
+			this->position[ status->unit ] = this->count;
+			this->units[ this->count ++ ] = status->unit;
+		}
+	}
 	mvcp_status_copy( &this->last, status );
 	pthread_cond_broadcast( &this->cond );
 	pthread_mutex_unlock( &this->mutex );
 }
 
+/** Forget a unit which has been removed and tell all waiting.
+*/
+
+void mvcp_notifier_remove( mvcp_notifier this, int unit )
+{
+	pthread_mutex_lock( &this->mutex );
+	if ( unit >= 0 && unit < this->size && this->position[ unit ] != -1 )
+	{
+		int last = this->units[ -- this->count ];
+		this->units[ this->position[ unit ] ] = last;
+		this->position[ last ] = this->position[ unit ];
+		this->position[ unit ] = -1;
+		memset( &this->store[ unit ], 0, sizeof( mvcp_status_t ) );
+		this->store[ unit ].unit = unit;
+		this->store[ unit ].status = unit_undefined;
+		mvcp_status_copy( &this->last, &this->store[ unit ] );
+		pthread_cond_broadcast( &this->cond );
+	}
+	pthread_mutex_unlock( &this->mutex );
+}
+
+/** Get the units with a stored status.
+
+    \param units An array to receive the unit numbers (may be NULL).
+    \param size The size of the array.
+    \return The number of units, which may be larger than size.
+*/
+
+int mvcp_notifier_units( mvcp_notifier this, int *units, int size )
+{
+	int count;
+	pthread_mutex_lock( &this->mutex );
+	count = this->count;
+	if ( units != NULL )
+		memcpy( units, this->units, ( count < size ? count : size ) * sizeof( int ) );
+	pthread_mutex_unlock( &this->mutex );
+	return count;
+}
+
 /** Communicate a disconnected status for all units to all waiting.
 */
 
 void mvcp_notifier_disconnected( mvcp_notifier notifier )
 {
-	int unit = 0;
+	int count = mvcp_notifier_units( notifier, NULL, 0 );
+	int *units = malloc( count * sizeof( int ) + 1 );
 	mvcp_status_t status;
-	for ( unit = 0; unit < MAX_UNITS; unit ++ )
+	int index = 0;
+
+	if ( units != NULL )
 	{
-		mvcp_notifier_get( notifier, &status, unit );
-		status.status = unit_disconnected;
-		mvcp_notifier_put( notifier, &status );
+		int stored = mvcp_notifier_units( notifier, units, count );
+		if ( stored < count )
+			count = stored;
+		for ( index = 0; index < count; index ++ )
+		{
+			mvcp_notifier_get( notifier, &status, units[ index ] );
+			status.status = unit_disconnected;
+			mvcp_notifier_put( notifier, &status );
+		}
+		free( units );
 	}
 }
 
@@ -122,6 +233,9 @@ void mvcp_notifier_close( mvcp_notifier this )
 	{
 		pthread_mutex_destroy( &this->mutex );
 		pthread_cond_destroy( &this->cond );
+		free( this->store );
+		free( this->position );
+		free( this->units );
 		free( this );
 	}
 }
@@ -32,24 +32,23 @@ extern "C"
 {
 #endif
 
+/** Number of units handled by the console client - the server and the
+    notifier have no limit.
+*/
+
 #define MAX_UNITS 16
 
-/** Status notifier definition.
+/** Status notifier definition - only accessed through the functions below.
 */
 
-typedef struct
-{
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-	mvcp_status_t last;
-	mvcp_status_t store[ MAX_UNITS ];
-}
-*mvcp_notifier, mvcp_notifier_t;
+typedef struct mvcp_notifier_s *mvcp_notifier, mvcp_notifier_t;
 
 extern mvcp_notifier mvcp_notifier_init( );
 extern void mvcp_notifier_get( mvcp_notifier, mvcp_status, int );
 extern int mvcp_notifier_wait( mvcp_notifier, mvcp_status );
 extern void mvcp_notifier_put( mvcp_notifier, mvcp_status );
+extern void mvcp_notifier_remove( mvcp_notifier, int );
+extern int mvcp_notifier_units( mvcp_notifier, int *, int );
 extern void mvcp_notifier_disconnected( mvcp_notifier );
 extern void mvcp_notifier_close( mvcp_notifier );
 
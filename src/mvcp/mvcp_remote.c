@@ -51,6 +51,7 @@ typedef struct
 	mvcp_parser parser;
 	pthread_mutex_t mutex;
 	int connected;
+	int ids;
 }
 *mvcp_remote, mvcp_remote_t;
 
@@ -64,10 +65,11 @@ static mvcp_response mvcp_remote_push( mvcp_remote, char *, mlt_service );
 static void mvcp_remote_close( mvcp_remote );
 static int mvcp_remote_read_response( mvcp_socket, mvcp_response );
 
-/** MVCP Parser constructor.
+/** Construct a remote parser, asking for clip ids in the statuses if ids
+    is non zero.
 */
 
-mvcp_parser mvcp_parser_init_remote( char *server, int port )
+static mvcp_parser remote_init( char *server, int port, int ids )
 {
 	mvcp_parser parser = calloc( 1, sizeof( mvcp_parser_t ) );
 	mvcp_remote remote = calloc( 1, sizeof( mvcp_remote_t ) );
@@ -86,12 +88,32 @@ mvcp_parser mvcp_parser_init_remote( char *server, int port )
 			remote->parser = parser;
 			remote->server = strdup( server );
 			remote->port = port;
+			remote->ids = ids;
 			pthread_mutex_init( &remote->mutex, NULL );
 		}
 	}
 	return parser;
 }
 
+/** MVCP Parser constructor.
+*/
+
+mvcp_parser mvcp_parser_init_remote( char *server, int port )
+{
+	return remote_init( server, port, 0 );
+}
+
+/** MVCP Parser constructor for a server known to report clip ids.
+
+    The status connection is opened with STATUS ID, so the statuses carry
+    the id of the current clip. Servers without clip ids refuse it.
+*/
+
+mvcp_parser mvcp_parser_init_remote_id( char *server, int port )
+{
+	return remote_init( server, port, 1 );
+}
+
 /** Thread for receiving and distributing the status information.
 */
 
@@ -106,7 +128,10 @@ static void *mvcp_remote_status_thread( void *arg )
 	mvcp_status_t status;
 	int index = 0;
 
-	mvcp_socket_write_data( remote->status, "STATUS\r\n", 8 );
+	if ( remote->ids )
+		mvcp_socket_write_data( remote->status, "STATUS ID\r\n", 11 );
+	else
+		mvcp_socket_write_data( remote->status, "STATUS\r\n", 8 );
 
 	while ( !remote->terminated && 
 			( length = mvcp_socket_read_data( remote->status, temp + offset, sizeof( temp ) ) ) >= 0 )
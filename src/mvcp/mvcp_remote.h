@@ -33,6 +33,7 @@ extern "C"
 */
 
 extern mvcp_parser mvcp_parser_init_remote( char *, int );
+extern mvcp_parser mvcp_parser_init_remote_id( char *, int );
 
 #ifdef __cplusplus
 }
@@ -34,7 +34,8 @@
 void mvcp_status_parse( mvcp_status status, char *text )
 {
 	mvcp_tokeniser tokeniser = mvcp_tokeniser_init( );
-	if ( mvcp_tokeniser_parse_new( tokeniser, text, " " ) == 17 )
+	int count = mvcp_tokeniser_parse_new( tokeniser, text, " " );
+	if ( count == 17 || count == 18 )
 	{
 		status->unit = atoi( mvcp_tokeniser_get_string( tokeniser, 0 ) );
 		strncpy( status->clip, mvcp_util_strip( mvcp_tokeniser_get_string( tokeniser, 2 ), '\"' ), sizeof( status->clip ) );
@@ -53,6 +54,8 @@ void mvcp_status_parse( mvcp_status status, char *text )
 		status->seek_flag = atoi( mvcp_tokeniser_get_string( tokeniser, 14 ) );
 		status->generation = atoi( mvcp_tokeniser_get_string( tokeniser, 15 ) );
 		status->clip_index = atoi( mvcp_tokeniser_get_string( tokeniser, 16 ) );
+		if ( count == 18 )
+			status->clip_id = atoi( mvcp_tokeniser_get_string( tokeniser, 17 ) );
 
 		if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "unknown" ) )
 			status->status = unit_unknown;
@@ -79,10 +82,11 @@ void mvcp_status_parse( mvcp_status status, char *text )
 	mvcp_tokeniser_close( tokeniser );
 }
 
-/** Serialise a status into a string.
+/** Serialise a status into a string, with the clip id as an 18th field if
+    asked for.
 */
 
-char *mvcp_status_serialise( mvcp_status status, char *text, int length )
+static char *status_serialise( mvcp_status status, char *text, int length, int with_id )
 {
 	const char *status_string = NULL;
 
@@ -121,7 +125,7 @@ char *mvcp_status_serialise( mvcp_status status, char *text, int length )
 			break;
 	}
 
-	snprintf( text, length, "%d %s \"%s\" %d %d %.2f %d %d %d \"%s\" %d %d %d %d %d %d %d\r\n",
+	snprintf( text, length, "%d %s \"%s\" %d %d %.2f %d %d %d \"%s\" %d %d %d %d %d %d %d",
 							status->unit,
 							status_string,
 							status->clip,
@@ -139,10 +143,30 @@ char *mvcp_status_serialise( mvcp_status status, char *text, int length )
 							status->seek_flag,
 							status->generation,
 							status->clip_index );
+	if ( with_id )
+		snprintf( text + strlen( text ), length - strlen( text ), " %d", status->clip_id );
+	snprintf( text + strlen( text ), length - strlen( text ), "\r\n" );
 
 	return text;
 }
 
+/** Serialise a status into a string.
+*/
+
+char *mvcp_status_serialise( mvcp_status status, char *text, int length )
+{
+	return status_serialise( status, text, length, 0 );
+}
+
+/** Serialise a status into a string with the clip id, for clients which
+    asked for it.
+*/
+
+char *mvcp_status_serialise_id( mvcp_status status, char *text, int length )
+{
+	return status_serialise( status, text, length, 1 );
+}
+
 /** Compare two status codes for changes.
 */
 
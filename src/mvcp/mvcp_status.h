@@ -67,6 +67,7 @@ typedef struct
 	int generation;
 	int clip_index;
 	int dummy;
+	int clip_id;
 }
 *mvcp_status, mvcp_status_t;
 
@@ -75,6 +76,7 @@ typedef struct
 
 extern void mvcp_status_parse( mvcp_status, char * );
 extern char *mvcp_status_serialise( mvcp_status, char *, int );
+extern char *mvcp_status_serialise_id( mvcp_status, char *, int );
 extern int mvcp_status_compare( mvcp_status, mvcp_status );
 extern mvcp_status mvcp_status_copy( mvcp_status, mvcp_status );
 